@@ -0,0 +1,307 @@
+#ifndef KAntag_H
+#define KAntag_H
+
+/*
+ * Noisy neighbour antagonists (--antagonist).
+ *
+ * A spec is a '+' separated list of <kind>[:<MB>]@<cpu list>, e.g.
+ * stream@2-3+llc:16@4+syscall@5. One worker process is forked and pinned
+ * per listed CPU:
+ *
+ *   stream[:<MB>]  streaming copy through a <MB> buffer (default 256),
+ *                  eating memory bandwidth
+ *   llc[:<MB>]     random read-modify-write of cache lines in a <MB>
+ *                  buffer (default 32), thrashing the LLC
+ *   syscall        getppid() in a tight loop
+ *   fork           fork() + wait() of a child that exits right away
+ *
+ * After the regular loop the benchmark runs count round trips quiet and
+ * count round trips with the antagonists running, records every round
+ * trip and prints the percentiles of both, plus the rate every worker
+ * achieved. Workers count their progress in a MAP_SHARED table and are
+ * SIGKILLed at the end of the loaded pass.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "KUtils.h"
+#include "KStats.h"
+#include "KTopo.h"
+
+#define KANTAG_MAX 64
+#define KANTAG_MAX_CPUS 1024
+#define KANTAG_LINE 64
+#define KANTAG_WARMUP_US 100000
+
+typedef enum kantag_kind_t
+{
+ KANTAG_STREAM = 0,
+ KANTAG_LLC,
+ KANTAG_SYSCALL,
+ KANTAG_FORK,
+ KANTAG_NKINDS
+}kantag_kind;
+
+static inline const char *
+kantag_name(int kind)
+{
+  static const char *names[KANTAG_NKINDS] = { "stream", "llc", "syscall", "fork" };
+
+  return names[kind];
+}
+
+struct kantag_worker
+{
+  kantag_kind kind;
+  int cpu;
+  size_t ws;
+  pid_t pid;
+};
+
+struct kantag
+{
+  int n;
+  struct kantag_worker w[KANTAG_MAX];
+  volatile uint64_t *ops;         /* per worker, shared */
+  struct klat lat[2];             /* quiet, loaded */
+  int64_t t_start, t_stop;
+};
+
+/*
+ * Parses --antagonist and sets up the shared counters and the sample
+ * buffers of both passes; call before fork(). Returns -1 with a message.
+ */
+static inline int
+kantag_parse(struct kantag *ka, int64_t count)
+{
+  static const size_t def_mb[KANTAG_NKINDS] = { 256, 32, 0, 0 };
+  char map[KANTAG_MAX_CPUS];
+  char *list, *tok, *save, *at, *colon, *end;
+  int kind, cpu, ret = 0;
+  long mb;
+
+  memset(ka, 0, sizeof(*ka));
+  if (kopts.antagonist == NULL)
+    return 0;
+
+  if ((list = strdup(kopts.antagonist)) == NULL) {
+    perror("strdup");
+    return -1;
+  }
+  for (tok = strtok_r(list, "+", &save); tok != NULL && ret == 0;
+       tok = strtok_r(NULL, "+", &save)) {
+    if ((at = strchr(tok, '@')) == NULL) {
+      fprintf(stderr, "antagonist: '%s' has no @<cpus>\n", tok);
+      ret = -1;
+      break;
+    }
+    *at = '\0';
+    if ((colon = strchr(tok, ':')) != NULL)
+      *colon = '\0';
+    for (kind = 0; kind < KANTAG_NKINDS; kind++)
+      if (strcmp(tok, kantag_name(kind)) == 0)
+        break;
+    if (kind == KANTAG_NKINDS) {
+      fprintf(stderr, "antagonist: bad kind '%s' (stream, llc, syscall, fork)\n",
+              tok);
+      ret = -1;
+      break;
+    }
+    mb = def_mb[kind];
+    if (colon != NULL) {
+      mb = strtol(colon + 1, &end, 10);
+      if (end == colon + 1 || *end || mb <= 0 || def_mb[kind] == 0) {
+        fprintf(stderr, "antagonist: bad size for %s\n", tok);
+        ret = -1;
+        break;
+      }
+    }
+    if (ktopo_parse_list(at + 1, map, KANTAG_MAX_CPUS) == 0) {
+      fprintf(stderr, "antagonist: bad cpu list '%s'\n", at + 1);
+      ret = -1;
+      break;
+    }
+    for (cpu = 0; cpu < KANTAG_MAX_CPUS; cpu++) {
+      if (!map[cpu])
+        continue;
+      if (ka->n == KANTAG_MAX) {
+        fprintf(stderr, "antagonist: more than %d workers\n", KANTAG_MAX);
+        ret = -1;
+        break;
+      }
+      ka->w[ka->n].kind = kind;
+      ka->w[ka->n].cpu = cpu;
+      ka->w[ka->n].ws = (size_t)mb << 20;
+      ka->n++;
+    }
+  }
+  free(list);
+  if (ret != 0)
+    return -1;
+
+  ka->ops = mmap(NULL, KANTAG_MAX * sizeof(uint64_t), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (ka->ops == MAP_FAILED) {
+    perror("mmap");
+    return -1;
+  }
+  if (klat_init(&ka->lat[0], count) == -1 || klat_init(&ka->lat[1], count) == -1)
+    return -1;
+  return 0;
+}
+
+/* Body of worker k; never returns. */
+static inline void
+kantag_work(struct kantag *ka, int k)
+{
+  struct kantag_worker *w = &ka->w[k];
+  volatile uint64_t *ops = &ka->ops[k];
+  uint64_t *a, *b, x = 88172645463325252ULL;
+  size_t words, lines, i;
+  cpu_set_t set;
+  pid_t pid;
+
+  CPU_ZERO(&set);
+  CPU_SET(w->cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+    perror("sched_setaffinity of antagonist failed");
+    _exit(EXIT_FAILURE);
+  }
+
+  switch (w->kind) {
+  case KANTAG_STREAM:
+    if ((a = malloc(w->ws)) == NULL) {
+      perror("malloc");
+      _exit(EXIT_FAILURE);
+    }
+    memset(a, 1, w->ws);
+    words = w->ws / sizeof(uint64_t) / 2;
+    b = a + words;
+    for (;;) {
+      for (i = 0; i < words; i++)
+        b[i] = a[i] + 1;
+      *ops += 2 * words * sizeof(uint64_t);
+    }
+  case KANTAG_LLC:
+    if ((a = malloc(w->ws)) == NULL) {
+      perror("malloc");
+      _exit(EXIT_FAILURE);
+    }
+    memset(a, 1, w->ws);
+    lines = w->ws / KANTAG_LINE;
+    for (;;) {
+      for (i = 0; i < 4096; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        a[(x % lines) * (KANTAG_LINE / sizeof(uint64_t))]++;
+      }
+      *ops += 4096;
+    }
+  case KANTAG_SYSCALL:
+    for (;;) {
+      syscall(SYS_getppid);
+      (*ops)++;
+    }
+  default:
+    for (;;) {
+      pid = fork();
+      if (pid == 0)
+        _exit(0);
+      if (pid > 0)
+        waitpid(pid, NULL, 0);
+      (*ops)++;
+    }
+  }
+}
+
+/* Forks and pins every worker, then lets them ramp up. Exits on failure. */
+static inline void
+kantag_start(struct kantag *ka)
+{
+  int k;
+
+  fflush(stdout);
+  for (k = 0; k < ka->n; k++) {
+    ka->ops[k] = 0;
+    ka->w[k].pid = fork();
+    if (ka->w[k].pid == -1) {
+      perror("fork");
+      exit(EXIT_FAILURE);
+    }
+    if (ka->w[k].pid == 0)
+      kantag_work(ka, k);
+  }
+  usleep(KANTAG_WARMUP_US);
+  ka->t_start = kutils_now_ns();
+}
+
+static inline void
+kantag_stop(struct kantag *ka)
+{
+  int k;
+
+  ka->t_stop = kutils_now_ns();
+  for (k = 0; k < ka->n; k++)
+    kill(ka->w[k].pid, SIGKILL);
+  for (k = 0; k < ka->n; k++)
+    waitpid(ka->w[k].pid, NULL, 0);
+}
+
+/*
+ * Prints the quiet and loaded percentiles and what every worker achieved
+ * from its start, warmup included.
+ */
+static inline void
+kantag_report(struct kantag *ka, const char *label)
+{
+  double secs = (ka->t_stop - ka->t_start + KANTAG_WARMUP_US * 1000LL) / 1e9;
+  struct kstats_summary s[2];
+  char row[64];
+  double rate;
+  int k, p;
+
+  for (p = 0; p < 2; p++)
+    kstats_summarize(ka->lat[p].samples, ka->lat[p].n, &s[p]);
+  kstats_print_header("antagonists (ns)");
+  for (p = 0; p < 2; p++) {
+    snprintf(row, sizeof(row), "%s %s", label, p ? "loaded" : "quiet");
+    kstats_print_row(row, &s[p]);
+  }
+
+  printf("%-10s %5s %8s %16s\n", "worker", "cpu", "MB", "rate");
+  for (k = 0; k < ka->n; k++) {
+    rate = secs > 0 ? ka->ops[k] / secs : 0;
+    printf("%-10s %5d ", kantag_name(ka->w[k].kind), ka->w[k].cpu);
+    if (ka->w[k].kind == KANTAG_STREAM || ka->w[k].kind == KANTAG_LLC)
+      printf("%8zu ", ka->w[k].ws >> 20);
+    else
+      printf("%8s ", "-");
+    switch (ka->w[k].kind) {
+    case KANTAG_STREAM:
+      printf("%11.2f MB/s\n", rate / (1 << 20));
+      break;
+    case KANTAG_LLC:
+      printf("%9.2f Macc/s\n", rate / 1e6);
+      break;
+    case KANTAG_SYSCALL:
+      printf("%8.2f Mcall/s\n", rate / 1e6);
+      break;
+    default:
+      printf("%8.2f Kfork/s\n", rate / 1e3);
+      break;
+    }
+  }
+}
+
+#endif //KAntag_H
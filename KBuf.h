@@ -0,0 +1,215 @@
+#ifndef KBuf_H
+#define KBuf_H
+
+/*
+ * Message buffer allocation strategies (--buf).
+ *
+ *   malloc      plain malloc(), pages faulted in by the first message
+ *   populate    anonymous mmap with MAP_POPULATE
+ *   thp         2 MB aligned anonymous mmap with madvise(MADV_HUGEPAGE),
+ *               touched right away so khugepaged is not needed
+ *   hugetlb     MAP_HUGETLB with 2 MB pages (needs vm.nr_hugepages)
+ *   hugetlb-1g  MAP_HUGETLB with 1 GB pages (needs 1 GB pages reserved)
+ *   mlock       anonymous mmap, mlock()ed
+ *
+ * Buffers allocated before fork() are copy-on-write in both processes and
+ * memory locks are not inherited, so each side calls kbuf_side() once it
+ * is set up: that breaks the sharing by writing every page and locks the
+ * buffer again, keeping page faults out of the timed loop. With malloc it
+ * does nothing, which keeps the original behaviour.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "KUtils.h"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+typedef enum kbuf_mode_t
+{
+ KBUF_MALLOC = 0,
+ KBUF_POPULATE,
+ KBUF_THP,
+ KBUF_HUGETLB,
+ KBUF_HUGETLB_1G,
+ KBUF_MLOCK,
+ KBUF_NMODES
+}kbuf_mode;
+
+static const char *kbuf_names[KBUF_NMODES] =
+{
+  "malloc", "populate", "thp", "hugetlb", "hugetlb-1g", "mlock",
+};
+
+/* Returns the mode selected by --buf, or -1 with a message. */
+static inline int
+kbuf_mode_get(void)
+{
+  int m;
+
+  if (kopts.buf == NULL)
+    return KBUF_MALLOC;
+  for (m = 0; m < KBUF_NMODES; m++)
+    if (strcmp(kopts.buf, kbuf_names[m]) == 0)
+      return m;
+  fprintf(stderr, "buf: bad mode '%s' (malloc, populate, thp, hugetlb, "
+          "hugetlb-1g, mlock)\n", kopts.buf);
+  return -1;
+}
+
+static inline size_t
+kbuf_page_size(int mode)
+{
+  switch (mode) {
+  case KBUF_THP:
+  case KBUF_HUGETLB:
+    return 2UL << 20;
+  case KBUF_HUGETLB_1G:
+    return 1UL << 30;
+  default:
+    return sysconf(_SC_PAGESIZE);
+  }
+}
+
+/* Rounds len up to whole pages of the selected mode. */
+static inline size_t
+kbuf_round(int mode, size_t len)
+{
+  size_t psz = kbuf_page_size(mode);
+
+  if (len == 0)
+    len = 1;
+  return (len + psz - 1) / psz * psz;
+}
+
+/* Writes one byte per base page, so every page is private and mapped. */
+static inline void
+kbuf_touch(void *buf, size_t len)
+{
+  volatile char *p = (volatile char *)buf;
+  long psz = sysconf(_SC_PAGESIZE);
+  size_t off;
+
+  for (off = 0; off < len; off += psz)
+    p[off] = p[off];
+}
+
+/*
+ * Allocates len bytes with the strategy selected by --buf. Returns NULL
+ * with errno set on failure, like malloc().
+ */
+static inline void *
+kbuf_alloc(size_t len)
+{
+  int mode = kbuf_mode_get();
+  size_t maplen, align;
+  char *p, *q;
+  int err;
+
+  if (mode == -1) {
+    errno = EINVAL;
+    return NULL;
+  }
+  if (mode == KBUF_MALLOC)
+    return malloc(len);
+
+  maplen = kbuf_round(mode, len);
+  switch (mode) {
+  case KBUF_POPULATE:
+    p = (char *)mmap(NULL, maplen, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    break;
+  case KBUF_THP:
+    /* over-allocate so a 2 MB aligned range can be carved out */
+    align = kbuf_page_size(mode);
+    p = (char *)mmap(NULL, maplen + align, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+      break;
+    q = (char *)(((uintptr_t)p + align - 1) & ~(align - 1));
+    if (q > p)
+      munmap(p, q - p);
+    munmap(q + maplen, p + align - q);
+    p = q;
+    if (madvise(p, maplen, MADV_HUGEPAGE) == -1)
+      return NULL;
+    kbuf_touch(p, maplen);
+    break;
+  case KBUF_HUGETLB:
+  case KBUF_HUGETLB_1G:
+    p = (char *)mmap(NULL, maplen, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE |
+                     (mode == KBUF_HUGETLB ? MAP_HUGE_2MB : MAP_HUGE_1GB),
+                     -1, 0);
+    if (p == MAP_FAILED) {
+      err = errno;
+      fprintf(stderr, "buf: no %zu bytes of %s pages, check /sys/kernel/mm/"
+              "hugepages/hugepages-%zukB/nr_hugepages\n", maplen,
+              kbuf_names[mode], kbuf_page_size(mode) >> 10);
+      errno = err;
+    }
+    break;
+  default:
+    p = (char *)mmap(NULL, maplen, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p != MAP_FAILED && mlock(p, maplen) == -1)
+      return NULL;
+    break;
+  }
+
+  return p == MAP_FAILED ? NULL : p;
+}
+
+/* Releases a buffer of len bytes from kbuf_alloc(). */
+static inline void
+kbuf_free(void *buf, size_t len)
+{
+  int mode = kbuf_mode_get();
+
+  if (mode <= KBUF_MALLOC)
+    free(buf);
+  else
+    munmap(buf, kbuf_round(mode, len));
+}
+
+/*
+ * Called by each side before its timed loop on buffers that were
+ * allocated before fork(). Exits on failure.
+ */
+static inline void
+kbuf_side(void *buf, size_t len)
+{
+  int mode = kbuf_mode_get();
+
+  if (mode == KBUF_MALLOC || mode == -1)
+    return;
+  len = kbuf_round(mode, len);
+  kbuf_touch(buf, len);
+  if (mode == KBUF_MLOCK && mlock(buf, len) == -1) {
+    perror("mlock");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static inline void
+kbuf_describe(size_t len)
+{
+  int mode = kbuf_mode_get();
+
+  if (mode <= KBUF_MALLOC)
+    return;
+  printf("buffer allocation: %s, %zu bytes in %zu kB pages\n", kbuf_names[mode],
+         kbuf_round(mode, len), kbuf_page_size(mode) >> 10);
+}
+
+#endif //KBuf_H
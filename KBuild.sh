@@ -26,12 +26,17 @@ if [[ ${OPERATION} == "build" ]]; then
     mv udp_lat                  binaries/udp_lat.${TARGET}.elf
     mv tcp_lat_epoll            binaries/tcp_lat_epoll.${TARGET}.elf
     mv tcp_lat_epoll_with_ack   binaries/tcp_lat_epoll_with_ack.${TARGET}.elf
+    mv c10k_lat                 binaries/c10k_lat.${TARGET}.elf
+    mv topo_sweep               binaries/topo_sweep.${TARGET}.elf
+    mv size_sweep               binaries/size_sweep.${TARGET}.elf
 
     if [[ ${TARGET} == "aarch64" ]]; then
         mv tcp_self_lat_wave   binaries/tcp_self_lat_wave.${TARGET}.elf
         mv unix_self_lat_wave  binaries/unix_self_lat_wave.${TARGET}.elf
 
         mv tcp_lat_wave        binaries/tcp_lat_wave.${TARGET}.elf
+    else
+        mv tcp_lat_coro        binaries/tcp_lat_coro.${TARGET}.elf
     fi
 
 fi
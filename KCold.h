@@ -0,0 +1,223 @@
+#ifndef KCold_H
+#define KCold_H
+
+/*
+ * Cold cache round trips (--cold).
+ *
+ * The regular loop sends the same small buffer every time, so it always
+ * hits in L1. With --cold the benchmark runs a second loop of the same
+ * number of round trips after it, in one of three modes:
+ *
+ *   pool[:<MB>]   each round trip uses the next buffer of a <MB> pool
+ *                 (default 64), so message data comes from memory
+ *   sweep[:<MB>]  between round trips each side streams through a <MB>
+ *                 buffer (default 64), evicting the LLC, kernel socket and
+ *                 pipe state included
+ *   flush         between round trips each side flushes the lines of its
+ *                 message buffer (clflush on x86, dc civac on aarch64)
+ *
+ * Only the round trips are timed, the eviction work is not. Two counters
+ * shared by the sides keep it out of the window even when both run on one
+ * CPU: the child evicts once the parent has stopped the clock for the
+ * round trip, and the parent starts the clock for the next one once the
+ * child is done evicting. The parent prints the cold average next to the
+ * hot one.
+ */
+
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "KUtils.h"
+#include "KBuf.h"
+
+#define KCOLD_LINE 64
+#define KCOLD_DEFAULT_MB 64
+
+enum { KCOLD_PARENT = 0, KCOLD_CHILD = 1 };
+
+typedef enum kcold_mode_t
+{
+ KCOLD_NONE = 0,
+ KCOLD_POOL,
+ KCOLD_SWEEP,
+ KCOLD_FLUSH,
+}kcold_mode;
+
+struct kcold
+{
+  kcold_mode mode;
+  size_t ws;              /* pool / sweep bytes */
+  char *area;             /* pool or sweep buffer of this side */
+  size_t stride;          /* pool: bytes per message buffer */
+  size_t nbufs;           /* pool: message buffers in the pool */
+  int64_t *done;          /* [KCOLD_PARENT]: round trips timed,
+                             [KCOLD_CHILD]: round trips evicted for */
+  int64_t delta_ns;       /* parent: sum of the timed round trips */
+  unsigned long sink;
+};
+
+/*
+ * Parses --cold and maps the counter shared with the child; call before
+ * fork(). Returns -1 with a message on a bad spec.
+ */
+static inline int
+kcold_parse(struct kcold *kc)
+{
+  const char *spec = kopts.cold, *arg;
+  char *end;
+  long mb = KCOLD_DEFAULT_MB;
+
+  memset(kc, 0, sizeof(*kc));
+  if (spec == NULL)
+    return 0;
+
+  if (strncmp(spec, "pool", 4) == 0) {
+    kc->mode = KCOLD_POOL;
+    arg = spec + 4;
+  } else if (strncmp(spec, "sweep", 5) == 0) {
+    kc->mode = KCOLD_SWEEP;
+    arg = spec + 5;
+  } else if (strcmp(spec, "flush") == 0) {
+    kc->mode = KCOLD_FLUSH;
+    arg = spec + 5;
+  } else {
+    fprintf(stderr, "cold: bad mode '%s' (pool[:<MB>], sweep[:<MB>], flush)\n",
+            spec);
+    return -1;
+  }
+
+  if (*arg == ':' && kc->mode != KCOLD_FLUSH) {
+    mb = strtol(arg + 1, &end, 10);
+    if (end == arg + 1 || *end || mb <= 0) {
+      fprintf(stderr, "cold: bad working set '%s'\n", arg + 1);
+      return -1;
+    }
+  } else if (*arg) {
+    fprintf(stderr, "cold: bad mode '%s' (pool[:<MB>], sweep[:<MB>], flush)\n",
+            spec);
+    return -1;
+  }
+  kc->ws = (size_t)mb << 20;
+
+  kc->done = mmap(NULL, 2 * sizeof(*kc->done), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (kc->done == MAP_FAILED) {
+    perror("mmap");
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Sets up the pool or sweep buffer of one side; call after fork() so the
+ * memory is private to the side. Exits on failure.
+ */
+static inline void
+kcold_side(struct kcold *kc, size_t size)
+{
+  if (kc->mode != KCOLD_POOL && kc->mode != KCOLD_SWEEP)
+    return;
+
+  if ((kc->area = kbuf_alloc(kc->ws)) == NULL) {
+    perror("kbuf_alloc");
+    exit(EXIT_FAILURE);
+  }
+  memset(kc->area, 0, kc->ws);
+
+  if (kc->mode == KCOLD_POOL) {
+    kc->stride = (size + KCOLD_LINE - 1) / KCOLD_LINE * KCOLD_LINE;
+    kc->nbufs = kc->ws / kc->stride;
+    if (kc->nbufs < 2) {
+      fprintf(stderr, "cold: pool of %zu bytes holds less than two messages\n",
+              kc->ws);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+/* Message buffer of round trip i. */
+static inline char *
+kcold_buf(struct kcold *kc, char *buf, int64_t i)
+{
+  if (kc->mode != KCOLD_POOL)
+    return buf;
+  return kc->area + (size_t)(i % kc->nbufs) * kc->stride;
+}
+
+static inline void
+kcold_flush(char *buf, size_t len)
+{
+  char *p;
+
+  for (p = buf; p < buf + len; p += KCOLD_LINE) {
+#if defined(__x86_64__) || defined(__i386__)
+    __asm__ volatile("clflush (%0)" :: "r"(p) : "memory");
+#elif defined(__aarch64__)
+    __asm__ volatile("dc civac, %0" :: "r"(p) : "memory");
+#endif
+  }
+#if defined(__x86_64__) || defined(__i386__)
+  __asm__ volatile("mfence" ::: "memory");
+#elif defined(__aarch64__)
+  __asm__ volatile("dsb ish" ::: "memory");
+#endif
+}
+
+/* Eviction work between two round trips; buf is the message buffer. */
+static inline void
+kcold_evict(struct kcold *kc, char *buf, size_t size)
+{
+  volatile char *p;
+  unsigned long sum = 0;
+  size_t off;
+
+  switch (kc->mode) {
+  case KCOLD_SWEEP:
+    p = kc->area;
+    for (off = 0; off < kc->ws; off += KCOLD_LINE)
+      sum += p[off];
+    kc->sink += sum;
+    break;
+  case KCOLD_FLUSH:
+    kcold_flush(buf, size);
+    break;
+  default:
+    break;
+  }
+}
+
+/* Marks round trip i as timed (parent) or evicted for (child). */
+static inline void
+kcold_done(struct kcold *kc, int side, int64_t i)
+{
+  __atomic_store_n(&kc->done[side], i + 1, __ATOMIC_RELEASE);
+}
+
+/* Waits until the other side has marked n round trips. */
+static inline void
+kcold_wait(struct kcold *kc, int side, int64_t n)
+{
+  while (__atomic_load_n(&kc->done[!side], __ATOMIC_ACQUIRE) < n)
+    sched_yield();
+}
+
+static inline void
+kcold_report(struct kcold *kc, int64_t hot_delta, int64_t count)
+{
+  int64_t hot = hot_delta / (count * 2), cold = kc->delta_ns / (count * 2);
+
+  if (kc->mode == KCOLD_FLUSH)
+    printf("cold mode: flush\n");
+  else
+    printf("cold mode: %s, %zu MB\n", kc->mode == KCOLD_POOL ? "pool" : "sweep",
+           kc->ws >> 20);
+  printf("cold average latency: %" PRId64 " ns\n", cold);
+  printf("hot vs cold: %" PRId64 " ns vs %" PRId64 " ns (%+.1f%%)\n", hot, cold,
+         hot ? 100.0 * (cold - hot) / hot : 0.0);
+}
+
+#endif //KCold_H
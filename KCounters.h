@@ -0,0 +1,198 @@
+#ifndef KCounters_H
+#define KCounters_H
+
+/*
+ * Hardware / software event counts over the timed loop (--counters).
+ *
+ * The counters are opened by the parent before fork() with inherit set, so
+ * the child gets its own copies; enable and disable on the parent's
+ * descriptors reach the child's too, and the child's counts are folded
+ * into the parent's when it exits. Reports are therefore taken after
+ * wait() and cover both sides of the benchmark. Counts are scaled by
+ * time_enabled / time_running when the PMU had to multiplex.
+ *
+ * Benchmarks that need per-side or per-phase values open the counters in
+ * each process after fork() instead (kcounters_open_self()) and read them
+ * with kcounters_read().
+ *
+ * Kernel mode is counted when perf_event_paranoid allows it (the copies in
+ * and out of the socket or pipe happen there), user mode only otherwise.
+ * Events the CPU or hypervisor does not expose are reported as n/a.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include "KUtils.h"
+
+#define KCOUNTERS_CACHE(cache, op, result) \
+  ((cache) | ((op) << 8) | ((result) << 16))
+
+struct kcounter_desc
+{
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+};
+
+static const struct kcounter_desc kcounter_table[] =
+{
+  { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { "dTLB-load-misses", PERF_TYPE_HW_CACHE,
+    KCOUNTERS_CACHE(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+                    PERF_COUNT_HW_CACHE_RESULT_MISS) },
+  { "dTLB-store-misses", PERF_TYPE_HW_CACHE,
+    KCOUNTERS_CACHE(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_WRITE,
+                    PERF_COUNT_HW_CACHE_RESULT_MISS) },
+  { "page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+  { "L1-dcache-load-misses", PERF_TYPE_HW_CACHE,
+    KCOUNTERS_CACHE(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+                    PERF_COUNT_HW_CACHE_RESULT_MISS) },
+#ifdef __aarch64__
+  /* no generic L2 event; ARMv8 common event L2D_CACHE_REFILL */
+  { "L2-dcache-refills", PERF_TYPE_RAW, 0x17 },
+#endif
+  { "LLC-load-misses", PERF_TYPE_HW_CACHE,
+    KCOUNTERS_CACHE(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ,
+                    PERF_COUNT_HW_CACHE_RESULT_MISS) },
+};
+
+#define KCOUNTERS_N (sizeof(kcounter_table) / sizeof(kcounter_table[0]))
+
+struct kcounters
+{
+  int fd[KCOUNTERS_N];
+  int user_only;
+};
+
+static inline int
+kcounters_open_one(const struct kcounter_desc *d, int inherit, int user_only)
+{
+  struct perf_event_attr pe;
+
+  memset(&pe, 0, sizeof(pe));
+  pe.type = d->type;
+  pe.size = sizeof(pe);
+  pe.config = d->config;
+  pe.disabled = 1;
+  pe.inherit = inherit;
+  pe.exclude_hv = 1;
+  pe.exclude_kernel = user_only;
+  pe.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                   PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return perf_event_open(&pe, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+static inline void
+kcounters_open_mode(struct kcounters *kc, int inherit)
+{
+  unsigned k;
+
+  kc->user_only = 0;
+  for (k = 0; k < KCOUNTERS_N; k++) {
+    kc->fd[k] = kcounters_open_one(&kcounter_table[k], inherit, kc->user_only);
+    if (kc->fd[k] == -1 && (errno == EACCES || errno == EPERM) &&
+        !kc->user_only) {
+      kc->user_only = 1;
+      kc->fd[k] = kcounters_open_one(&kcounter_table[k], inherit, 1);
+    }
+  }
+}
+
+/* Opens every event it can, inherited by children; call before fork(). */
+static inline void
+kcounters_open(struct kcounters *kc)
+{
+  kcounters_open_mode(kc, 1);
+}
+
+/* Opens every event it can for the calling process only. */
+static inline void
+kcounters_open_self(struct kcounters *kc)
+{
+  kcounters_open_mode(kc, 0);
+}
+
+/* Scaled value of counter k, or -1 when the event is not available. */
+static inline double
+kcounters_read(struct kcounters *kc, unsigned k)
+{
+  uint64_t v[3];
+
+  if (kc->fd[k] == -1 || read(kc->fd[k], v, sizeof(v)) != sizeof(v))
+    return -1;
+  return v[2] ? (double)v[0] * v[1] / v[2] : 0;
+}
+
+/* Index of the named counter in kcounter_table, or -1. */
+static inline int
+kcounters_find(const char *name)
+{
+  unsigned k;
+
+  for (k = 0; k < KCOUNTERS_N; k++)
+    if (strcmp(kcounter_table[k].name, name) == 0)
+      return k;
+  return -1;
+}
+
+static inline void
+kcounters_enable(struct kcounters *kc)
+{
+  unsigned k;
+
+  if (kc == NULL)
+    return;
+  for (k = 0; k < KCOUNTERS_N; k++) {
+    if (kc->fd[k] == -1)
+      continue;
+    ioctl(kc->fd[k], PERF_EVENT_IOC_RESET, 0);
+    ioctl(kc->fd[k], PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+static inline void
+kcounters_disable(struct kcounters *kc)
+{
+  unsigned k;
+
+  if (kc == NULL)
+    return;
+  for (k = 0; k < KCOUNTERS_N; k++)
+    if (kc->fd[k] != -1)
+      ioctl(kc->fd[k], PERF_EVENT_IOC_DISABLE, 0);
+}
+
+/*
+ * Prints every counter as a total and per operation; call after the child
+ * was reaped. unit names the operation ("roundtrip", "message").
+ */
+static inline void
+kcounters_report(struct kcounters *kc, int64_t ops, const char *unit)
+{
+  uint64_t v[3];
+  double scaled;
+  unsigned k;
+
+  printf("event counters (parent + child, %s mode):\n",
+         kc->user_only ? "user" : "user+kernel");
+  printf("  %-22s %16s %14s\n", "event", "total", unit);
+  for (k = 0; k < KCOUNTERS_N; k++) {
+    if (kc->fd[k] == -1 || read(kc->fd[k], v, sizeof(v)) != sizeof(v)) {
+      printf("  %-22s %16s %14s\n", kcounter_table[k].name, "n/a", "n/a");
+      continue;
+    }
+    scaled = v[2] ? (double)v[0] * v[1] / v[2] : 0;
+    printf("  %-22s %16.0f %14.2f%s\n", kcounter_table[k].name, scaled,
+           ops ? scaled / ops : 0.0,
+           v[2] && v[2] < v[1] ? "  (multiplexed)" : "");
+  }
+}
+
+#endif //KCounters_H
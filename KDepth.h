@@ -0,0 +1,237 @@
+#ifndef KDepth_H
+#define KDepth_H
+
+/*
+ * Pipelined requests (--depth).
+ *
+ * The latency loop keeps exactly one request in flight. With
+ * --depth=<n>[,<n>...] the benchmark runs one more pass per listed depth
+ * after it, of the same number of requests, in which the parent keeps up
+ * to <n> requests outstanding, as a pipelining client of a Redis-style
+ * protocol does. Every request carries its sequence number in its first
+ * 8 bytes, the child echoes the requests in order and the parent checks
+ * that the replies come back in sequence.
+ *
+ * Both sides batch at the socket layer: the parent writes every request
+ * the window allows in one send() and reads whatever replies are there in
+ * one recv(), the child reads what is queued and answers every complete
+ * request in one write(). The parent's socket is non-blocking and waits in
+ * poll(), so a deep window cannot deadlock on full socket buffers. For
+ * each depth the parent prints requests/s, MB/s, send and recv calls per
+ * request, and per-request latency from the send of a request to the
+ * arrival of its reply.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "KUtils.h"
+#include "KStats.h"
+
+#define KDEPTH_MAX_DEPTHS 16
+#define KDEPTH_MAX 65536
+
+struct kdepth
+{
+  int n;                          /* number of depths, 0: off */
+  int depth[KDEPTH_MAX_DEPTHS];
+  int max;
+  int size;
+  char *wbuf, *rbuf;              /* max * size each */
+  int64_t *t_send;                /* per window slot */
+  struct klat lat;
+};
+
+/*
+ * Parses --depth and allocates the buffers; call before fork(). Returns
+ * -1 with a message on a bad spec.
+ */
+static inline int
+kdepth_parse(struct kdepth *kd, int size, int64_t count)
+{
+  const char *p = kopts.depth;
+  char *end;
+  long d;
+
+  memset(kd, 0, sizeof(*kd));
+  if (p == NULL)
+    return 0;
+
+  while (*p) {
+    d = strtol(p, &end, 10);
+    if (end == p || d < 1 || d > KDEPTH_MAX || (*end && *end != ',') ||
+        kd->n == KDEPTH_MAX_DEPTHS) {
+      fprintf(stderr, "depth: bad list '%s' (up to %d depths of 1 to %d)\n",
+              kopts.depth, KDEPTH_MAX_DEPTHS, KDEPTH_MAX);
+      return -1;
+    }
+    kd->depth[kd->n++] = d;
+    if (d > kd->max)
+      kd->max = d;
+    p = *end ? end + 1 : end;
+  }
+  if (kopts.tstamp) {
+    fprintf(stderr, "depth: not with --tstamp\n");
+    return -1;
+  }
+  if (size < (int)sizeof(int64_t)) {
+    fprintf(stderr, "depth: needs a message size of at least %d octets\n",
+            (int)sizeof(int64_t));
+    return -1;
+  }
+
+  kd->size = size;
+  kd->wbuf = malloc((size_t)kd->max * size);
+  kd->rbuf = malloc((size_t)kd->max * size);
+  kd->t_send = malloc(kd->max * sizeof(int64_t));
+  if (kd->wbuf == NULL || kd->rbuf == NULL || kd->t_send == NULL) {
+    perror("malloc");
+    return -1;
+  }
+  memset(kd->wbuf, 0, (size_t)kd->max * size);
+  memset(kd->rbuf, 0, (size_t)kd->max * size);
+  return klat_init(&kd->lat, count);
+}
+
+/* Child: echoes count requests per depth, every complete one in order. */
+static inline int
+kdepth_child(struct kdepth *kd, int fd, int64_t count)
+{
+  size_t cap = (size_t)kd->max * kd->size, have;
+  int64_t done;
+  ssize_t len;
+  size_t whole;
+  int k;
+
+  for (k = 0; k < kd->n; k++) {
+    for (done = 0, have = 0; done < count;) {
+      len = read(fd, kd->rbuf + have, cap - have);
+      if (len <= 0) {
+        perror("read");
+        return -1;
+      }
+      have += len;
+      whole = have - have % kd->size;
+      if (whole == 0)
+        continue;
+      if (write(fd, kd->rbuf, whole) != (ssize_t)whole) {
+        perror("write");
+        return -1;
+      }
+      done += whole / kd->size;
+      memmove(kd->rbuf, kd->rbuf + whole, have - whole);
+      have -= whole;
+    }
+  }
+  return 0;
+}
+
+/* Parent: one pass of count requests with up to depth outstanding. */
+static inline int
+kdepth_pass(struct kdepth *kd, int fd, int64_t count, int depth,
+            int64_t *nsend, int64_t *nrecv)
+{
+  int64_t sent = 0, done = 0, seq, now;
+  size_t woff = 0, wlen = 0, have = 0, cap = (size_t)depth * kd->size;
+  struct pollfd pfd;
+  ssize_t len;
+  int64_t k;
+
+  kd->lat.n = 0;
+  while (done < count) {
+    /* stamp and queue every request the window allows */
+    if (woff == wlen) {
+      woff = wlen = 0;
+      now = kutils_now_ns();
+      for (; sent < count && sent - done < depth; sent++) {
+        memcpy(kd->wbuf + wlen, &sent, sizeof(sent));
+        kd->t_send[sent % depth] = now;
+        wlen += kd->size;
+      }
+    }
+    if (woff < wlen) {
+      len = send(fd, kd->wbuf + woff, wlen - woff, MSG_DONTWAIT);
+      if (len == -1 && errno != EAGAIN) {
+        perror("send");
+        return -1;
+      }
+      if (len > 0)
+        woff += len;
+      (*nsend)++;
+    }
+
+    len = recv(fd, kd->rbuf + have, cap - have, MSG_DONTWAIT);
+    (*nrecv)++;
+    if (len == 0 || (len == -1 && errno != EAGAIN)) {
+      perror("recv");
+      return -1;
+    }
+    if (len == -1) {
+      pfd.fd = fd;
+      pfd.events = POLLIN | (woff < wlen ? POLLOUT : 0);
+      if (poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+        perror("poll");
+        return -1;
+      }
+      continue;
+    }
+    have += len;
+    now = kutils_now_ns();
+    for (k = 0; (size_t)(k + 1) * kd->size <= have; k++, done++) {
+      memcpy(&seq, kd->rbuf + k * kd->size, sizeof(seq));
+      if (seq != done) {
+        fprintf(stderr, "depth: reply %" PRId64 " out of order, expected %"
+                PRId64 "\n", seq, done);
+        return -1;
+      }
+      klat_record(&kd->lat, now - kd->t_send[done % depth]);
+    }
+    memmove(kd->rbuf, kd->rbuf + k * kd->size, have - k * kd->size);
+    have -= k * kd->size;
+  }
+  return 0;
+}
+
+/* Parent: runs every depth and prints a row for each. */
+static inline int
+kdepth_parent(struct kdepth *kd, int fd, int64_t count)
+{
+  struct kstats_summary s[KDEPTH_MAX_DEPTHS];
+  int64_t t0, delta, nsend, nrecv;
+  char label[32];
+  int k;
+
+  if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1) {
+    perror("fcntl");
+    return -1;
+  }
+  printf("%8s %14s %10s %12s %12s\n", "depth", "requests/s", "MB/s",
+         "sends/req", "recvs/req");
+  for (k = 0; k < kd->n; k++) {
+    nsend = nrecv = 0;
+    t0 = kutils_now_ns();
+    if (kdepth_pass(kd, fd, count, kd->depth[k], &nsend, &nrecv) == -1)
+      return -1;
+    delta = kutils_now_ns() - t0;
+    printf("%8d %14.0f %10.1f %12.3f %12.3f\n", kd->depth[k],
+           count / (delta / 1e9), (double)count * kd->size / (delta / 1e3),
+           (double)nsend / count, (double)nrecv / count);
+    kstats_summarize(kd->lat.samples, kd->lat.n, &s[k]);
+  }
+
+  kstats_print_header("per request latency (ns)");
+  for (k = 0; k < kd->n; k++) {
+    snprintf(label, sizeof(label), "depth %d", kd->depth[k]);
+    kstats_print_row(label, &s[k]);
+  }
+  return 0;
+}
+
+#endif //KDepth_H
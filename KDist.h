@@ -0,0 +1,238 @@
+#ifndef KDist_H
+#define KDist_H
+
+/*
+ * Synthetic request sizes and arrivals (--sizes, --arrivals, --seed).
+ *
+ * Without a recorded trace, the replay pass of KTrace.h can run on a trace
+ * drawn from distributions instead. --sizes picks the request sizes:
+ *
+ *   fixed[:<n>]                 every request <n> octets (default: the
+ *                               message size)
+ *   uniform:<lo>:<hi>           uniform over lo..hi
+ *   bimodal:<a>:<b>:<p>         <a> with probability <p>%, <b> otherwise
+ *   lognormal:<median>:<sigma>  median * exp(sigma * N(0, 1)), the long
+ *                               tailed sizes of web and RPC payloads
+ *   zipf:<max>:<s>              size k in 1..max with weight 1 / k^s
+ *   cdf:<file>                  empirical CDF, "<size> <cumulative
+ *                               probability>" lines in ascending order
+ *
+ * and --arrivals the gaps between requests: fixed:<req/s> or
+ * poisson:<req/s> (exponential gaps of that mean). Without --arrivals the
+ * requests follow each other back to back.
+ *
+ * The trace has <roundtrip-count> requests and is drawn in full before
+ * fork() with splitmix64 generators seeded by --seed (default 1), so the
+ * same seed gives the same trace and no drawing happens during the pass.
+ * Sizes are clamped to what the transport carries. The realized sizes and
+ * gaps are printed (see ktrace_synth() in KTrace.h).
+ */
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KDIST_CDF_MAX 4096
+
+enum { KDIST_FIXED, KDIST_UNIFORM, KDIST_BIMODAL, KDIST_LOGNORMAL, KDIST_ZIPF,
+       KDIST_CDF, KDIST_EXP };
+
+struct kdist
+{
+  int kind;
+  double a, b, c;                 /* parameters of the spec */
+  double *cdf;                    /* zipf and cdf: cumulative weights */
+  uint32_t *val;                  /* cdf: size of each step */
+  int ncdf;
+  uint64_t rng;
+};
+
+static inline uint64_t
+kdist_next(struct kdist *kd)
+{
+  uint64_t z = (kd->rng += 0x9e3779b97f4a7c15ULL);
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/* Uniform in (0, 1). */
+static inline double
+kdist_uniform(struct kdist *kd)
+{
+  return ((kdist_next(kd) >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+/* First step whose cumulative weight reaches u. */
+static inline int
+kdist_search(const double *cdf, int n, double u)
+{
+  int lo = 0, hi = n - 1, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (cdf[mid] < u)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static inline int
+kdist_load_cdf(struct kdist *kd, const char *path)
+{
+  char line[256];
+  double size, p, last = 0;
+  FILE *f;
+
+  if ((f = fopen(path, "r")) == NULL) {
+    perror(path);
+    return -1;
+  }
+  kd->cdf = malloc(KDIST_CDF_MAX * sizeof(double));
+  kd->val = malloc(KDIST_CDF_MAX * sizeof(uint32_t));
+  if (kd->cdf == NULL || kd->val == NULL) {
+    perror("malloc");
+    fclose(f);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (line[0] == '#' || sscanf(line, "%lf %lf", &size, &p) != 2)
+      continue;
+    if (size < 1 || p < last || p > 1 || kd->ncdf == KDIST_CDF_MAX) {
+      fprintf(stderr, "sizes: %s: need up to %d \"<size> <cumulative "
+              "probability>\" lines, probabilities ascending to 1\n", path,
+              KDIST_CDF_MAX);
+      fclose(f);
+      return -1;
+    }
+    kd->val[kd->ncdf] = size;
+    kd->cdf[kd->ncdf++] = last = p;
+  }
+  fclose(f);
+  if (kd->ncdf == 0) {
+    fprintf(stderr, "sizes: %s holds no steps\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+/* Parses a --sizes spec; size is the message size for a bare "fixed". */
+static inline int
+kdist_parse(struct kdist *kd, const char *spec, int size)
+{
+  double a = 0, b = 0, c = 0, sum;
+  int k;
+
+  memset(kd, 0, sizeof(*kd));
+  if (spec == NULL || strcmp(spec, "fixed") == 0) {
+    kd->kind = KDIST_FIXED;
+    kd->a = size;
+  } else if (sscanf(spec, "fixed:%lf", &a) == 1 && a >= 1) {
+    kd->kind = KDIST_FIXED;
+    kd->a = a;
+  } else if (sscanf(spec, "uniform:%lf:%lf", &a, &b) == 2 && a >= 1 &&
+             b >= a) {
+    kd->kind = KDIST_UNIFORM;
+    kd->a = a;
+    kd->b = b;
+  } else if (sscanf(spec, "bimodal:%lf:%lf:%lf", &a, &b, &c) == 3 && a >= 1 &&
+             b >= 1 && c >= 0 && c <= 100) {
+    kd->kind = KDIST_BIMODAL;
+    kd->a = a;
+    kd->b = b;
+    kd->c = c / 100;
+  } else if (sscanf(spec, "lognormal:%lf:%lf", &a, &b) == 2 && a >= 1 &&
+             b >= 0) {
+    kd->kind = KDIST_LOGNORMAL;
+    kd->a = a;
+    kd->b = b;
+  } else if (sscanf(spec, "zipf:%lf:%lf", &a, &b) == 2 && a >= 1 &&
+             a <= 1 << 24 && b > 0) {
+    kd->kind = KDIST_ZIPF;
+    kd->ncdf = a;
+    if ((kd->cdf = malloc(kd->ncdf * sizeof(double))) == NULL) {
+      perror("malloc");
+      return -1;
+    }
+    for (k = 0, sum = 0; k < kd->ncdf; k++)
+      kd->cdf[k] = sum += pow(k + 1, -b);
+    for (k = 0; k < kd->ncdf; k++)
+      kd->cdf[k] /= sum;
+  } else if (strncmp(spec, "cdf:", 4) == 0) {
+    kd->kind = KDIST_CDF;
+    return kdist_load_cdf(kd, spec + 4);
+  } else {
+    fprintf(stderr, "sizes: fixed[:<n>], uniform:<lo>:<hi>, "
+            "bimodal:<a>:<b>:<p%%>, lognormal:<median>:<sigma>, "
+            "zipf:<max>:<s> or cdf:<file>\n");
+    return -1;
+  }
+  return 0;
+}
+
+static inline double
+kdist_draw(struct kdist *kd)
+{
+  double u, v;
+
+  switch (kd->kind) {
+  case KDIST_UNIFORM:
+    return kd->a + floor(kdist_uniform(kd) * (kd->b - kd->a + 1));
+  case KDIST_BIMODAL:
+    return kdist_uniform(kd) < kd->c ? kd->a : kd->b;
+  case KDIST_LOGNORMAL:
+    /* Box-Muller */
+    u = kdist_uniform(kd);
+    v = kdist_uniform(kd);
+    return kd->a * exp(kd->b * sqrt(-2 * log(u)) * cos(2 * M_PI * v));
+  case KDIST_ZIPF:
+    return kdist_search(kd->cdf, kd->ncdf, kdist_uniform(kd)) + 1;
+  case KDIST_CDF:
+    return kd->val[kdist_search(kd->cdf, kd->ncdf,
+                                kdist_uniform(kd) * kd->cdf[kd->ncdf - 1])];
+  case KDIST_EXP:
+    return -log(kdist_uniform(kd)) * kd->a;
+  default:
+    return kd->a;
+  }
+}
+
+/* Parses an --arrivals spec into a gap distribution in ns. */
+static inline int
+kdist_parse_arrivals(struct kdist *kd, const char *spec)
+{
+  double rate;
+
+  memset(kd, 0, sizeof(*kd));
+  if (sscanf(spec, "fixed:%lf", &rate) == 1 && rate > 0) {
+    kd->kind = KDIST_FIXED;
+  } else if (sscanf(spec, "poisson:%lf", &rate) == 1 && rate > 0) {
+    kd->kind = KDIST_EXP;
+  } else {
+    fprintf(stderr, "arrivals: fixed:<req/s> or poisson:<req/s>\n");
+    return -1;
+  }
+  kd->a = 1e9 / rate;
+  return 0;
+}
+
+static inline void
+kdist_seed(struct kdist *kd, uint64_t seed)
+{
+  kd->rng = seed;
+}
+
+static inline void
+kdist_free(struct kdist *kd)
+{
+  free(kd->cdf);
+  free(kd->val);
+}
+
+#endif //KDist_H
@@ -0,0 +1,654 @@
+#ifndef KEpoll_H
+#define KEpoll_H
+
+/*
+ * Reactor patterns of the epoll benchmarks (--epoll, --epoll-timeout,
+ * --epoll-busy).
+ *
+ *   classic   the original loops: wait for EPOLLOUT before every send and,
+ *             in tcp_lat_epoll_with_ack, flip the client's interest between
+ *             EPOLLIN and EPOLLOUT with EPOLL_CTL_MOD every round trip
+ *   et        EPOLLIN | EPOLLOUT | EPOLLET registered once; sends go out
+ *             directly, receives drain the socket until a short read
+ *   lt        EPOLLIN registered once, level triggered, sends go out
+ *             directly
+ *   oneshot   EPOLLIN | EPOLLONESHOT, re-armed with EPOLL_CTL_MOD after
+ *             every wakeup (the multi threaded server pattern)
+ *
+ * --epoll-timeout=<ns> waits with epoll_pwait2() and a nanosecond timeout
+ * instead of epoll_wait() (0 spins on the ready list). --epoll-busy=<us>
+ * sets busy polling on the epoll instance with EPIOCSPARAMS (6.9+); where
+ * the kernel lacks it the benchmark says so and goes on without.
+ *
+ * --reactor=<backend> swaps the readiness interface under the server loop:
+ * select, poll, ppoll, epoll (the default) or uring, a multishot
+ * IORING_OP_POLL_ADD per fd on a raw io_uring. The first three are level
+ * triggered, so they only go with classic and lt. --idle-fds=<n> adds n
+ * eventfds that never fire to the server's interest set, to show how the
+ * cost of a wait grows with the number of fds watched.
+ *
+ * Every wait, epoll and socket call of the loop goes through this file and
+ * is counted, so each side can print its syscalls per round trip.
+ */
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include "KUtils.h"
+
+#define KEPOLL_EVENTS 64
+
+#ifndef __NR_epoll_pwait2
+#define __NR_epoll_pwait2 441
+#endif
+
+/* struct epoll_params of <linux/eventpoll.h>, which not every libc has */
+struct kepoll_params
+{
+  uint32_t busy_poll_usecs;
+  uint16_t busy_poll_budget;
+  uint8_t prefer_busy_poll;
+  uint8_t pad;
+};
+
+#define KEPOLL_IOCSPARAMS _IOW(0x8A, 0x01, struct kepoll_params)
+#define KEPOLL_BUSY_BUDGET 8
+#define KEPOLL_URING_ENTRIES 4096
+
+typedef enum kepoll_mode_t
+{
+ KEPOLL_CLASSIC = 0,
+ KEPOLL_ET,
+ KEPOLL_LT,
+ KEPOLL_ONESHOT,
+ KEPOLL_NMODES
+}kepoll_mode;
+
+static inline const char *
+kepoll_name(int mode)
+{
+  static const char *names[KEPOLL_NMODES] = { "classic", "et", "lt", "oneshot" };
+
+  return names[mode];
+}
+
+typedef enum kepoll_backend_t
+{
+ KEPOLL_SELECT = 0,
+ KEPOLL_POLL,
+ KEPOLL_PPOLL,
+ KEPOLL_EPOLL,
+ KEPOLL_URING,
+ KEPOLL_NBACKENDS
+}kepoll_backend;
+
+static inline const char *
+kepoll_backend_name(int backend)
+{
+  static const char *names[KEPOLL_NBACKENDS] = { "select", "poll", "ppoll",
+                                                 "epoll", "uring" };
+
+  return names[backend];
+}
+
+/* The rings of the uring backend, mapped from the io_uring fd. */
+struct kepoll_uring
+{
+  int fd;
+  unsigned entries;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  unsigned pending;               /* queued, not submitted yet */
+};
+
+struct kepoll
+{
+  kepoll_mode mode;
+  kepoll_backend backend;
+  int nidle;                      /* --idle-fds */
+  int *fds, nfds;                 /* watched: idle ones first */
+  struct pollfd *pfds;            /* poll, ppoll */
+  struct kepoll_uring ring;
+  int64_t timeout_ns;             /* -1: epoll_wait() */
+  int busy_us;                    /* -1: not set */
+  int report;                     /* an --epoll option was given */
+  int efd;
+  uint32_t armed;                 /* interest of oneshot re-arms */
+  uint64_t nwait, nempty, nctl, nrecv, nagain, nsend, nother;
+  struct epoll_event events[KEPOLL_EVENTS];
+};
+
+/* Parses the --epoll options. Returns -1 with a message on a bad spec. */
+static inline int
+kepoll_parse(struct kepoll *ke)
+{
+  int m;
+
+  memset(ke, 0, sizeof(*ke));
+  ke->timeout_ns = kopts.epoll_timeout_ns;
+  ke->busy_us = kopts.epoll_busy_us;
+  ke->efd = -1;
+  ke->backend = KEPOLL_EPOLL;
+  ke->nidle = kopts.idle_fds;
+  ke->report = kopts.epoll != NULL || ke->timeout_ns >= 0 || ke->busy_us >= 0 ||
+               kopts.reactor != NULL || ke->nidle > 0;
+
+  if (kopts.epoll != NULL) {
+    for (m = 0; m < KEPOLL_NMODES; m++)
+      if (strcmp(kopts.epoll, kepoll_name(m)) == 0)
+        break;
+    if (m == KEPOLL_NMODES) {
+      fprintf(stderr, "epoll: bad mode '%s' (classic, et, lt, oneshot)\n",
+              kopts.epoll);
+      return -1;
+    }
+    ke->mode = (kepoll_mode)m;
+  }
+
+  if (kopts.reactor != NULL) {
+    for (m = 0; m < KEPOLL_NBACKENDS; m++)
+      if (strcmp(kopts.reactor, kepoll_backend_name(m)) == 0)
+        break;
+    if (m == KEPOLL_NBACKENDS) {
+      fprintf(stderr, "reactor: bad backend '%s' (select, poll, ppoll, epoll, "
+              "uring)\n", kopts.reactor);
+      return -1;
+    }
+    ke->backend = (kepoll_backend)m;
+  }
+  if (ke->nidle < 0) {
+    fprintf(stderr, "reactor: bad idle fd count %d\n", ke->nidle);
+    return -1;
+  }
+  if (ke->backend != KEPOLL_EPOLL &&
+      (ke->mode == KEPOLL_ET || ke->mode == KEPOLL_ONESHOT || ke->busy_us >= 0)) {
+    fprintf(stderr, "reactor: et, oneshot and --epoll-busy need the epoll "
+            "backend\n");
+    return -1;
+  }
+  if (ke->backend == KEPOLL_URING && ke->timeout_ns >= 0) {
+    fprintf(stderr, "reactor: no --epoll-timeout with the uring backend\n");
+    return -1;
+  }
+  return 0;
+}
+
+/* Leaves the epoll defaults; the reactor options only drive the server. */
+static inline void
+kepoll_plain(struct kepoll *ke)
+{
+  ke->backend = KEPOLL_EPOLL;
+  ke->nidle = 0;
+}
+
+static inline int
+kepoll_ctl(struct kepoll *ke, int op, int fd, uint32_t events)
+{
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.fd = fd;
+  ke->nctl++;
+  return epoll_ctl(ke->efd, op, fd, &ev);
+}
+
+static inline void
+kepoll_uring_setup(struct kepoll_uring *r, unsigned entries)
+{
+  struct io_uring_params p;
+  size_t sq_sz, cq_sz;
+  char *sq, *cq;
+
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_CLAMP;
+  if ((r->fd = syscall(__NR_io_uring_setup, entries, &p)) == -1) {
+    perror("io_uring_setup");
+    exit(EXIT_FAILURE);
+  }
+  r->entries = p.sq_entries;
+
+  sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    sq_sz = cq_sz = sq_sz > cq_sz ? sq_sz : cq_sz;
+  sq = (char *)mmap(NULL, sq_sz, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED) {
+    perror("mmap io_uring");
+    exit(EXIT_FAILURE);
+  }
+  cq = sq;
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+    cq = (char *)mmap(NULL, cq_sz, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+  r->sqes = (struct io_uring_sqe *)mmap(NULL, p.sq_entries *
+                                        sizeof(struct io_uring_sqe),
+                                        PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_POPULATE, r->fd,
+                                        IORING_OFF_SQES);
+  if (cq == MAP_FAILED || r->sqes == MAP_FAILED) {
+    perror("mmap io_uring");
+    exit(EXIT_FAILURE);
+  }
+
+  r->sq_head = (unsigned *)(sq + p.sq_off.head);
+  r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  r->sq_array = (unsigned *)(sq + p.sq_off.array);
+  r->cq_head = (unsigned *)(cq + p.cq_off.head);
+  r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+}
+
+static inline int
+kepoll_uring_enter(struct kepoll_uring *r, unsigned wait)
+{
+  int ret;
+
+  ret = syscall(__NR_io_uring_enter, r->fd, r->pending, wait,
+                wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  if (ret > 0)
+    r->pending -= ret;
+  return ret;
+}
+
+/* Queues a multishot poll for fd; submits first when the ring is full. */
+static inline void
+kepoll_uring_poll(struct kepoll_uring *r, int fd)
+{
+  struct io_uring_sqe *sqe;
+  unsigned tail, idx;
+
+  tail = *r->sq_tail;
+  if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) == r->entries &&
+      kepoll_uring_enter(r, 0) == -1) {
+    perror("io_uring_enter");
+    exit(EXIT_FAILURE);
+  }
+  idx = tail & *r->sq_mask;
+  sqe = &r->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = POLLIN | POLLRDHUP;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->user_data = fd;
+  r->sq_array[idx] = idx;
+  __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  r->pending++;
+}
+
+/*
+ * Creates the reactor and registers fd after the idle fds; classic is the
+ * interest set the benchmark used originally, the other modes pick their
+ * own. Exits on failure.
+ */
+static inline void
+kepoll_open(struct kepoll *ke, int fd, uint32_t classic)
+{
+  struct kepoll_params params;
+  struct rlimit rl;
+  uint32_t events;
+  int k;
+
+  if ((ke->fds = (int *)malloc((ke->nidle + 1) * sizeof(int))) == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  if (ke->nidle > 0 && getrlimit(RLIMIT_NOFILE, &rl) == 0 &&
+      rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+  for (k = 0; k < ke->nidle; k++) {
+    if ((ke->fds[k] = eventfd(0, EFD_NONBLOCK)) == -1) {
+      perror("eventfd for --idle-fds");
+      exit(EXIT_FAILURE);
+    }
+  }
+  ke->fds[ke->nidle] = fd;
+  ke->nfds = ke->nidle + 1;
+
+  switch (ke->backend) {
+  case KEPOLL_SELECT:
+    for (k = 0; k < ke->nfds; k++) {
+      if (ke->fds[k] >= FD_SETSIZE) {
+        fprintf(stderr, "reactor: fd %d does not fit select()'s FD_SETSIZE "
+                "of %d\n", ke->fds[k], FD_SETSIZE);
+        exit(EXIT_FAILURE);
+      }
+    }
+    return;
+  case KEPOLL_POLL:
+  case KEPOLL_PPOLL:
+    ke->pfds = (struct pollfd *)calloc(ke->nfds, sizeof(struct pollfd));
+    if (ke->pfds == NULL) {
+      perror("calloc");
+      exit(EXIT_FAILURE);
+    }
+    for (k = 0; k < ke->nfds; k++) {
+      ke->pfds[k].fd = ke->fds[k];
+      ke->pfds[k].events = POLLIN | POLLRDHUP;
+    }
+    return;
+  case KEPOLL_URING:
+    kepoll_uring_setup(&ke->ring, ke->nfds < KEPOLL_URING_ENTRIES ?
+                       ke->nfds : KEPOLL_URING_ENTRIES);
+    for (k = 0; k < ke->nfds; k++)
+      kepoll_uring_poll(&ke->ring, ke->fds[k]);
+    if (kepoll_uring_enter(&ke->ring, 0) == -1) {
+      perror("io_uring_enter");
+      exit(EXIT_FAILURE);
+    }
+    return;
+  default:
+    break;
+  }
+
+  if ((ke->efd = epoll_create1(0)) == -1) {
+    perror("epoll_create1");
+    exit(EXIT_FAILURE);
+  }
+  for (k = 0; k < ke->nidle; k++) {
+    if (kepoll_ctl(ke, EPOLL_CTL_ADD, ke->fds[k], EPOLLIN) == -1) {
+      perror("epoll_ctl EPOLL_CTL_ADD");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (ke->busy_us >= 0) {
+    memset(&params, 0, sizeof(params));
+    params.busy_poll_usecs = ke->busy_us;
+    params.busy_poll_budget = KEPOLL_BUSY_BUDGET;
+    params.prefer_busy_poll = 1;
+    if (ioctl(ke->efd, KEPOLL_IOCSPARAMS, &params) == -1) {
+      if (errno != ENOTTY && errno != EINVAL) {
+        perror("ioctl EPIOCSPARAMS");
+        exit(EXIT_FAILURE);
+      }
+      printf("epoll busy poll: EPIOCSPARAMS not supported by this kernel, "
+             "running without\n");
+      ke->busy_us = -1;
+    }
+  }
+
+  switch (ke->mode) {
+  case KEPOLL_ET:
+    events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    break;
+  case KEPOLL_LT:
+    events = EPOLLIN | EPOLLRDHUP;
+    break;
+  case KEPOLL_ONESHOT:
+    events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    break;
+  default:
+    events = classic;
+    break;
+  }
+  ke->armed = events;
+  if (kepoll_ctl(ke, EPOLL_CTL_ADD, fd, events) == -1) {
+    perror("epoll_ctl EPOLL_CTL_ADD");
+    exit(EXIT_FAILURE);
+  }
+  /* setup is not part of the loop */
+  ke->nctl = 0;
+}
+
+/*
+ * Waits for events; timeout_ms is what the benchmark used originally and
+ * is overridden by --epoll-timeout. Returns the number of events in
+ * ke->events, or -1.
+ */
+static inline int
+kepoll_wait_select(struct kepoll *ke, int timeout_ms)
+{
+  struct timeval tv, *tvp = NULL;
+  fd_set rfds;
+  int k, n, maxfd = 0;
+
+  FD_ZERO(&rfds);
+  for (k = 0; k < ke->nfds; k++) {
+    FD_SET(ke->fds[k], &rfds);
+    if (ke->fds[k] > maxfd)
+      maxfd = ke->fds[k];
+  }
+  if (ke->timeout_ns >= 0) {
+    tv.tv_sec = ke->timeout_ns / 1000000000;
+    tv.tv_usec = ke->timeout_ns % 1000000000 / 1000;
+    tvp = &tv;
+  } else if (timeout_ms >= 0) {
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = timeout_ms % 1000 * 1000;
+    tvp = &tv;
+  }
+  if ((n = select(maxfd + 1, &rfds, NULL, NULL, tvp)) <= 0)
+    return n;
+  for (k = 0, n = 0; k < ke->nfds && n < KEPOLL_EVENTS; k++) {
+    if (FD_ISSET(ke->fds[k], &rfds)) {
+      ke->events[n].events = EPOLLIN;
+      ke->events[n++].data.fd = ke->fds[k];
+    }
+  }
+  return n;
+}
+
+static inline int
+kepoll_wait_poll(struct kepoll *ke, int timeout_ms)
+{
+  struct timespec ts;
+  int k, n;
+
+  if (ke->backend == KEPOLL_POLL) {
+    if (ke->timeout_ns >= 0)
+      timeout_ms = (ke->timeout_ns + 999999) / 1000000;
+    n = poll(ke->pfds, ke->nfds, timeout_ms);
+  } else if (ke->timeout_ns >= 0 || timeout_ms >= 0) {
+    ts.tv_sec = ke->timeout_ns >= 0 ? ke->timeout_ns / 1000000000 :
+                timeout_ms / 1000;
+    ts.tv_nsec = ke->timeout_ns >= 0 ? ke->timeout_ns % 1000000000 :
+                 timeout_ms % 1000 * 1000000;
+    n = ppoll(ke->pfds, ke->nfds, &ts, NULL);
+  } else {
+    n = ppoll(ke->pfds, ke->nfds, NULL, NULL);
+  }
+  if (n <= 0)
+    return n;
+  /* poll and epoll share the bit values of the events */
+  for (k = 0, n = 0; k < ke->nfds && n < KEPOLL_EVENTS; k++) {
+    if (ke->pfds[k].revents) {
+      ke->events[n].events = ke->pfds[k].revents;
+      ke->events[n++].data.fd = ke->pfds[k].fd;
+    }
+  }
+  return n;
+}
+
+/* Reaps completions; a poll that ended (no IORING_CQE_F_MORE) is re-queued. */
+static inline int
+kepoll_wait_uring(struct kepoll *ke)
+{
+  struct kepoll_uring *r = &ke->ring;
+  struct io_uring_cqe *cqe;
+  unsigned head, tail;
+  int n = 0;
+
+  head = *r->cq_head;
+  tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+  if (head == tail || r->pending > 0) {
+    if (kepoll_uring_enter(r, head == tail) == -1)
+      return -1;
+    tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+  } else {
+    /* completions were waiting, no syscall needed */
+    ke->nwait--;
+  }
+  for (; head != tail && n < KEPOLL_EVENTS; head++) {
+    cqe = &r->cqes[head & *r->cq_mask];
+    ke->events[n].events = cqe->res < 0 ? EPOLLERR : (uint32_t)cqe->res;
+    ke->events[n++].data.fd = cqe->user_data;
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+      kepoll_uring_poll(r, cqe->user_data);
+  }
+  __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+  return n;
+}
+
+static inline int
+kepoll_wait(struct kepoll *ke, int timeout_ms)
+{
+  struct timespec ts;
+  int n;
+
+  ke->nwait++;
+  if (ke->backend == KEPOLL_SELECT) {
+    n = kepoll_wait_select(ke, timeout_ms);
+  } else if (ke->backend == KEPOLL_POLL || ke->backend == KEPOLL_PPOLL) {
+    n = kepoll_wait_poll(ke, timeout_ms);
+  } else if (ke->backend == KEPOLL_URING) {
+    n = kepoll_wait_uring(ke);
+  } else if (ke->timeout_ns < 0) {
+    n = epoll_wait(ke->efd, ke->events, KEPOLL_EVENTS, timeout_ms);
+  } else {
+    ts.tv_sec = ke->timeout_ns / 1000000000;
+    ts.tv_nsec = ke->timeout_ns % 1000000000;
+    n = syscall(__NR_epoll_pwait2, ke->efd, ke->events, KEPOLL_EVENTS, &ts,
+                NULL, 0);
+    if (n == -1 && errno == ENOSYS) {
+      fprintf(stderr, "epoll: epoll_pwait2() needs Linux 5.11\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (n == 0)
+    ke->nempty++;
+  return n;
+}
+
+/* Re-arms fd after a oneshot wakeup; a no-op in the other modes. */
+static inline void
+kepoll_rearm(struct kepoll *ke, int fd)
+{
+  if (ke->mode != KEPOLL_ONESHOT)
+    return;
+  if (kepoll_ctl(ke, EPOLL_CTL_MOD, fd, ke->armed) == -1) {
+    perror("epoll_ctl EPOLL_CTL_MOD");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static inline ssize_t
+kepoll_recv1(struct kepoll *ke, int fd, void *buf, size_t len)
+{
+  int flags = MSG_DONTWAIT;
+  ssize_t r;
+
+  /*
+   * The sockets are blocking. classic on epoll keeps the original blocking
+   * recv(); draining in the other modes and backends must not block.
+   */
+  if (ke->mode == KEPOLL_CLASSIC && ke->backend == KEPOLL_EPOLL)
+    flags = 0;
+  ke->nrecv++;
+  r = recv(fd, buf, len, flags);
+  if (r == -1 && errno == EAGAIN)
+    ke->nagain++;
+  return r;
+}
+
+/*
+ * Receives what a wakeup announced into buf. Edge triggered mode keeps
+ * reading until a short read, as no new edge comes for data left queued;
+ * the bytes of earlier reads are overwritten. Returns the bytes read, even
+ * if the read after them met EOF or an error (the next call reports it),
+ * else 0 on EOF, -1 on error (EAGAIN included).
+ */
+static inline ssize_t
+kepoll_recv(struct kepoll *ke, int fd, void *buf, size_t len)
+{
+  ssize_t r, total = 0;
+
+  for (;;) {
+    r = kepoll_recv1(ke, fd, buf, len);
+    if (r <= 0)
+      return total > 0 ? total : r;
+    total += r;
+    /* multishot polls fire on new data only, like an edge */
+    if ((ke->mode != KEPOLL_ET && ke->backend != KEPOLL_URING) ||
+        (size_t)r < len)
+      return total;
+  }
+}
+
+/* writev() of one buffer; waits for room on EAGAIN. */
+static inline ssize_t
+kepoll_send(struct kepoll *ke, int fd, struct iovec *iov)
+{
+  struct pollfd pfd;
+  ssize_t r;
+
+  for (;;) {
+    ke->nsend++;
+    r = writev(fd, iov, 1);
+    if (r != -1 || errno != EAGAIN || ke->mode == KEPOLL_CLASSIC)
+      return r;
+    if (ke->mode == KEPOLL_ET) {
+      kepoll_wait(ke, -1);
+      continue;
+    }
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+    ke->nother++;
+    poll(&pfd, 1, -1);
+  }
+}
+
+/* Counts a syscall the benchmark makes outside of this file. */
+static inline void
+kepoll_other(struct kepoll *ke)
+{
+  ke->nother++;
+}
+
+static inline void
+kepoll_report(struct kepoll *ke, const char *side, int64_t n, const char *per)
+{
+  double d = n > 0 ? (double)n : 1.0;
+
+  if (!ke->report)
+    return;
+  printf("%sepoll mode: %s", side, kepoll_name(ke->mode));
+  if (ke->backend != KEPOLL_EPOLL || ke->nidle > 0)
+    printf(", reactor %s, %d idle fds", kepoll_backend_name(ke->backend),
+           ke->nidle);
+  if (ke->timeout_ns >= 0)
+    printf(", epoll_pwait2 timeout %" PRId64 " ns", ke->timeout_ns);
+  if (ke->busy_us >= 0)
+    printf(", busy poll %d us", ke->busy_us);
+  printf("\n");
+  printf("%ssyscalls %s: %.2f wait (%.2f empty), %.2f epoll_ctl, "
+         "%.2f recv (%.2f EAGAIN), %.2f send, %.2f other, %.2f total\n", side,
+         per, ke->nwait / d, ke->nempty / d, ke->nctl / d, ke->nrecv / d,
+         ke->nagain / d, ke->nsend / d, ke->nother / d,
+         (ke->nwait + ke->nctl + ke->nrecv + ke->nsend + ke->nother) / d);
+}
+
+#endif //KEpoll_H
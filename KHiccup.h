@@ -0,0 +1,343 @@
+#ifndef KHiccup_H
+#define KHiccup_H
+
+/*
+ * Platform jitter meter (--hiccup).
+ *
+ * A meter is a process pinned to one CPU that spins reading
+ * CLOCK_MONOTONIC; any gap between two reads above the threshold means
+ * the CPU was taken away (SMI, timer or IPI handler, kernel housekeeping)
+ * and is logged with its timestamp and added to a histogram. The spec is
+ *
+ *   <cpu>[:<ns>]   one meter on an otherwise idle CPU, running for the
+ *                  whole timed loop
+ *   self[:<ns>]    meters on the parent and the child CPU, for half a
+ *                  second before and after the timed loop
+ *
+ * with a default threshold of 1000 ns. The parent stamps every round trip
+ * of the timed loop, so the report can tell how many of the slowest round
+ * trips (p99 and up) overlapped a hiccup seen by a concurrent meter.
+ * Meters write to a MAP_SHARED area set up before fork(). A <cpu> meter is
+ * forked by the parent and would inherit the --counters events, adding its
+ * spinning to the counts, so the two are not taken together.
+ */
+
+#include <inttypes.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "KUtils.h"
+#include "KStats.h"
+
+#define KHICCUP_SLOTS 4
+#define KHICCUP_LOG 4096
+#define KHICCUP_TOP 10
+#define KHICCUP_DEFAULT_NS 1000
+#define KHICCUP_SELF_NS 500000000LL
+
+struct khiccup_gap
+{
+  int64_t t;                      /* end of the gap */
+  int64_t gap;
+  int slot;
+};
+
+struct khiccup_slot
+{
+  int cpu;
+  const char *phase;              /* "before", "during", "after" */
+  int64_t t_begin, t_end;
+  int64_t n, max;
+  struct khist hist;
+};
+
+struct khiccup_shared
+{
+  volatile int stop;
+  int64_t nlog;
+  struct khiccup_slot slot[KHICCUP_SLOTS];
+  struct khiccup_gap log[KHICCUP_LOG];
+};
+
+struct khiccup
+{
+  int self;
+  int cpu;
+  int64_t threshold;
+  int nslots;
+  pid_t pid;
+  struct khiccup_shared *sh;
+  int64_t t0;                     /* start of the timed loop */
+  int64_t *rt_begin, *rt_end;     /* round trips of the timed loop */
+  int64_t nrt, cap;
+};
+
+/*
+ * Parses --hiccup and maps the shared area; call before fork(). Returns
+ * -1 with a message on a bad spec.
+ */
+static inline int
+khiccup_parse(struct khiccup *h, int64_t count)
+{
+  const char *spec = kopts.hiccup;
+  char *end;
+
+  memset(h, 0, sizeof(*h));
+  if (spec == NULL)
+    return 0;
+
+  h->threshold = KHICCUP_DEFAULT_NS;
+  if (strncmp(spec, "self", 4) == 0) {
+    h->self = 1;
+    end = (char *)spec + 4;
+  } else {
+    h->cpu = strtol(spec, &end, 10);
+    if (end == spec || h->cpu < 0) {
+      fprintf(stderr, "hiccup: bad spec '%s' (<cpu>[:<ns>], self[:<ns>])\n",
+              spec);
+      return -1;
+    }
+  }
+  if (*end == ':') {
+    spec = end + 1;
+    h->threshold = strtol(spec, &end, 10);
+    if (end == spec || h->threshold <= 0) {
+      fprintf(stderr, "hiccup: bad threshold '%s'\n", spec);
+      return -1;
+    }
+  }
+  if (*end) {
+    fprintf(stderr, "hiccup: bad spec '%s' (<cpu>[:<ns>], self[:<ns>])\n",
+            kopts.hiccup);
+    return -1;
+  }
+  if (!h->self && kopts.counters) {
+    fprintf(stderr, "hiccup: a <cpu> meter would be counted by --counters, "
+            "use self\n");
+    return -1;
+  }
+
+  h->sh = mmap(NULL, sizeof(*h->sh), PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (h->sh == MAP_FAILED) {
+    perror("mmap");
+    return -1;
+  }
+  h->rt_begin = malloc(count * sizeof(int64_t));
+  h->rt_end = malloc(count * sizeof(int64_t));
+  if (h->rt_begin == NULL || h->rt_end == NULL) {
+    perror("malloc");
+    return -1;
+  }
+  memset(h->rt_begin, 0, count * sizeof(int64_t));
+  memset(h->rt_end, 0, count * sizeof(int64_t));
+  h->cap = count;
+  return 0;
+}
+
+/* Body of a meter; spins until stop is set or until deadline (if > 0). */
+static inline void
+khiccup_spin(struct khiccup *h, int s, int64_t deadline)
+{
+  struct khiccup_slot *sl = &h->sh->slot[s];
+  int64_t prev, now, gap, k;
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  CPU_SET(sl->cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+    perror("sched_setaffinity of hiccup meter failed");
+    _exit(EXIT_FAILURE);
+  }
+
+  prev = sl->t_begin = kutils_now_ns();
+  while (!h->sh->stop) {
+    now = kutils_now_ns();
+    gap = now - prev;
+    prev = now;
+    if (gap > h->threshold) {
+      sl->n++;
+      if (gap > sl->max)
+        sl->max = gap;
+      khist_add(&sl->hist, gap);
+      k = __atomic_fetch_add(&h->sh->nlog, 1, __ATOMIC_RELAXED);
+      if (k < KHICCUP_LOG) {
+        h->sh->log[k].t = now;
+        h->sh->log[k].gap = gap;
+        h->sh->log[k].slot = s;
+      }
+    }
+    if (deadline > 0 && now >= deadline)
+      break;
+  }
+  sl->t_end = kutils_now_ns();
+  _exit(0);
+}
+
+/* Forks a meter on cpu for the given phase; duration 0 runs until stop. */
+static inline pid_t
+khiccup_fork(struct khiccup *h, int cpu, const char *phase, int64_t duration)
+{
+  int s = h->nslots++;
+  pid_t pid;
+
+  h->sh->slot[s].cpu = cpu;
+  h->sh->slot[s].phase = phase;
+  fflush(stdout);
+  pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0)
+    khiccup_spin(h, s, duration ? kutils_now_ns() + duration : 0);
+  return pid;
+}
+
+/* Runs the meters of self mode on both benchmark CPUs and waits for them. */
+static inline void
+khiccup_self(struct khiccup *h, int parentCPU, int childCPU, const char *phase)
+{
+  pid_t p, c = -1;
+
+  p = khiccup_fork(h, parentCPU, phase, KHICCUP_SELF_NS);
+  if (childCPU != parentCPU)
+    c = khiccup_fork(h, childCPU, phase, KHICCUP_SELF_NS);
+  waitpid(p, NULL, 0);
+  if (c != -1)
+    waitpid(c, NULL, 0);
+}
+
+/* Called by the parent right before the timed loop. */
+static inline void
+khiccup_begin(struct khiccup *h, int parentCPU, int childCPU)
+{
+  if (h == NULL)
+    return;
+  if (h->self) {
+    khiccup_self(h, parentCPU, childCPU, "before");
+  } else {
+    h->pid = khiccup_fork(h, h->cpu, "during", 0);
+    /* let the meter get going before the clock starts */
+    while (h->sh->slot[0].t_begin == 0)
+      sched_yield();
+  }
+  h->t0 = kutils_now_ns();
+}
+
+static inline void
+khiccup_rt(struct khiccup *h, int64_t begin, int64_t end)
+{
+  if (h != NULL && h->nrt < h->cap) {
+    h->rt_begin[h->nrt] = begin;
+    h->rt_end[h->nrt++] = end;
+  }
+}
+
+/* Called by the parent right after the timed loop. */
+static inline void
+khiccup_end(struct khiccup *h, int parentCPU, int childCPU)
+{
+  if (h == NULL)
+    return;
+  if (h->self) {
+    khiccup_self(h, parentCPU, childCPU, "after");
+  } else {
+    h->sh->stop = 1;
+    waitpid(h->pid, NULL, 0);
+  }
+}
+
+/* Whether round trip k overlapped a gap seen by a concurrent meter. */
+static inline int
+khiccup_overlaps(struct khiccup *h, int64_t k)
+{
+  int64_t n = h->sh->nlog < KHICCUP_LOG ? h->sh->nlog : KHICCUP_LOG, j;
+  struct khiccup_gap *g;
+
+  for (j = 0; j < n; j++) {
+    g = &h->sh->log[j];
+    if (strcmp(h->sh->slot[g->slot].phase, "during") == 0 &&
+        g->t - g->gap < h->rt_end[k] && g->t > h->rt_begin[k])
+      return 1;
+  }
+  return 0;
+}
+
+static inline void
+khiccup_report(struct khiccup *h, const char *label)
+{
+  struct khiccup_slot *sl;
+  struct khiccup_gap top[KHICCUP_TOP], *g;
+  const char *names[KHICCUP_SLOTS];
+  struct khist *hists[KHICCUP_SLOTS];
+  char name[KHICCUP_SLOTS][32];
+  int64_t n, j, k, *dur, p99, slow = 0, hit = 0;
+  int s, t, ntop = 0;
+  double secs;
+
+  printf("hiccup meter: threshold %" PRId64 " ns\n", h->threshold);
+  printf("%5s %-8s %10s %10s %12s %12s\n", "cpu", "phase", "spun ms",
+         "hiccups", "max ns", "hiccups/s");
+  for (s = 0; s < h->nslots; s++) {
+    sl = &h->sh->slot[s];
+    secs = (sl->t_end - sl->t_begin) / 1e9;
+    printf("%5d %-8s %10.1f %10" PRId64 " %12" PRId64 " %12.1f\n", sl->cpu,
+           sl->phase, secs * 1e3, sl->n, sl->max, secs > 0 ? sl->n / secs : 0.0);
+    snprintf(name[s], sizeof(name[s]), "cpu%d %s", sl->cpu, sl->phase);
+    names[s] = name[s];
+    hists[s] = &sl->hist;
+  }
+  khist_print_cols("hiccup histogram:", names, hists, h->nslots);
+
+  /* largest logged gaps, by insertion into a small sorted table */
+  n = h->sh->nlog < KHICCUP_LOG ? h->sh->nlog : KHICCUP_LOG;
+  for (j = 0; j < n; j++) {
+    g = &h->sh->log[j];
+    for (t = ntop; t > 0 && top[t - 1].gap < g->gap; t--)
+      if (t < KHICCUP_TOP)
+        top[t] = top[t - 1];
+    if (t < KHICCUP_TOP) {
+      top[t] = *g;
+      if (ntop < KHICCUP_TOP)
+        ntop++;
+    }
+  }
+  if (h->sh->nlog > KHICCUP_LOG)
+    printf("hiccup log full, %" PRId64 " hiccups not logged\n",
+           h->sh->nlog - KHICCUP_LOG);
+  if (ntop > 0)
+    printf("largest hiccups (us from the start of the timed loop):\n");
+  for (t = 0; t < ntop; t++)
+    printf("  %12.1f us  cpu%-4d %-8s %10" PRId64 " ns\n",
+           (top[t].t - h->t0) / 1e3, h->sh->slot[top[t].slot].cpu,
+           h->sh->slot[top[t].slot].phase, top[t].gap);
+
+  if (h->self || h->nrt == 0)
+    return;
+  if ((dur = malloc(h->nrt * sizeof(int64_t))) == NULL) {
+    perror("malloc");
+    return;
+  }
+  for (k = 0; k < h->nrt; k++)
+    dur[k] = h->rt_end[k] - h->rt_begin[k];
+  qsort(dur, h->nrt, sizeof(int64_t), kstats_cmp_i64);
+  p99 = kstats_percentile(dur, h->nrt, 99.0);
+  free(dur);
+  for (k = 0; k < h->nrt; k++) {
+    if (h->rt_end[k] - h->rt_begin[k] < p99)
+      continue;
+    slow++;
+    hit += khiccup_overlaps(h, k);
+  }
+  printf("%s >= p99 (%" PRId64 " ns): %" PRId64 ", %" PRId64
+         " overlapping a hiccup on cpu%d\n", label, p99, slow, hit, h->cpu);
+}
+
+#endif //KHiccup_H
@@ -0,0 +1,244 @@
+#ifndef KNuma_H
+#define KNuma_H
+
+/*
+ * NUMA placement of the message buffers (--numa, --numa-parent,
+ * --numa-child).
+ *
+ * A placement spec is one of
+ *
+ *   <node>     bind to that node
+ *   local      bind to the node of the CPU the side is pinned to
+ *   remote     bind to the nearest other node with memory (by SLIT distance)
+ *
+ * Each side replaces its buffer with a fresh anonymous mapping bound with
+ * mbind(MPOL_BIND, MPOL_MF_STRICT) and faults it in right away, so first
+ * touch cannot undo the binding. The mapping follows --buf; pages that
+ * strategy already faulted in are migrated by MPOL_MF_MOVE. mbind and
+ * move_pages are called through syscall() because the static build has no
+ * libnuma. move_pages() with a NULL node list then reports where every
+ * page actually landed.
+ */
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "KUtils.h"
+#include "KTopo.h"
+#include "KBuf.h"
+
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+#ifndef MPOL_MF_STRICT
+#define MPOL_MF_STRICT (1 << 0)
+#define MPOL_MF_MOVE   (1 << 1)
+#endif
+
+#define KNUMA_MAX_NODES 1024
+
+enum { KNUMA_PARENT = 0, KNUMA_CHILD = 1 };
+
+/* Nodes with memory as a 0/1 map of KNUMA_MAX_NODES entries. */
+static inline int
+knuma_mem_nodes(char *map)
+{
+  char list[1024];
+
+  if (ktopo_read_str("/sys/devices/system/node/has_memory", list,
+                     sizeof(list)) == -1 &&
+      ktopo_read_str("/sys/devices/system/node/online", list,
+                     sizeof(list)) == -1)
+    snprintf(list, sizeof(list), "0");
+  return ktopo_parse_list(list, map, KNUMA_MAX_NODES);
+}
+
+static inline int
+knuma_distance(int from, int to)
+{
+  char path[96];
+  FILE *f;
+  int d = -1, k;
+
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/distance", from);
+  if ((f = fopen(path, "r")) == NULL)
+    return -1;
+  for (k = 0; k <= to; k++)
+    if (fscanf(f, "%d", &d) != 1) {
+      d = -1;
+      break;
+    }
+  fclose(f);
+  return d;
+}
+
+/*
+ * Resolves a spec for a side pinned to cpu (-1: the CPU it runs on now).
+ * Returns the node, or -1 with a message.
+ */
+static inline int
+knuma_resolve(const char *spec, int cpu)
+{
+  char map[KNUMA_MAX_NODES];
+  int local, node, best = -1, bestd = 0, d;
+  char *end;
+
+  knuma_mem_nodes(map);
+
+  if (strcmp(spec, "local") != 0 && strcmp(spec, "remote") != 0) {
+    node = strtol(spec, &end, 10);
+    if (end == spec || *end || node < 0 || node >= KNUMA_MAX_NODES) {
+      fprintf(stderr, "numa: bad placement '%s' (<node>, local, remote)\n", spec);
+      return -1;
+    }
+    if (!map[node]) {
+      fprintf(stderr, "numa: node %d has no memory\n", node);
+      return -1;
+    }
+    return node;
+  }
+
+  if (cpu < 0)
+    cpu = sched_getcpu();
+  local = ktopo_node_of(cpu);
+  if (local < 0)
+    local = 0;
+  if (strcmp(spec, "local") == 0)
+    return local;
+
+  for (node = 0; node < KNUMA_MAX_NODES; node++) {
+    if (!map[node] || node == local)
+      continue;
+    d = knuma_distance(local, node);
+    if (best < 0 || (d >= 0 && d < bestd)) {
+      best = node;
+      bestd = d;
+    }
+  }
+  if (best < 0)
+    fprintf(stderr, "numa: no remote node with memory (cpu %d is on node %d)\n",
+            cpu, local);
+  return best;
+}
+
+/* Validates both specs before fork(), so a typo cannot strand the peer. */
+static inline int
+knuma_check(void)
+{
+  int side;
+
+  for (side = 0; side < 2; side++)
+    if (kopts.numa[side] != NULL && knuma_resolve(kopts.numa[side], -1) == -1)
+      return -1;
+  return 0;
+}
+
+/* Prints how many pages of [buf, buf + len) sit on which node. */
+static inline void
+knuma_report(const char *label, void *buf, size_t len)
+{
+  long psz = sysconf(_SC_PAGESIZE);
+  unsigned long npages = (len + psz - 1) / psz, k;
+  static int counts[KNUMA_MAX_NODES];
+  void **pages;
+  int *status, node, other = 0;
+
+  pages = malloc(npages * sizeof(void *));
+  status = malloc(npages * sizeof(int));
+  if (pages == NULL || status == NULL) {
+    perror("malloc");
+    goto out;
+  }
+  for (k = 0; k < npages; k++)
+    pages[k] = (char *)buf + k * psz;
+
+  if (syscall(__NR_move_pages, 0, npages, pages, NULL, status, 0) == -1) {
+    perror("move_pages");
+    goto out;
+  }
+
+  memset(counts, 0, sizeof(counts));
+  for (k = 0; k < npages; k++) {
+    if (status[k] >= 0 && status[k] < KNUMA_MAX_NODES)
+      counts[status[k]]++;
+    else
+      other++;
+  }
+  printf("%s placement:", label);
+  for (node = 0; node < KNUMA_MAX_NODES; node++)
+    if (counts[node])
+      printf(" node%d %d pages", node, counts[node]);
+  if (other)
+    printf(" unmapped %d pages", other);
+  printf("\n");
+
+out:
+  free(pages);
+  free(status);
+}
+
+/*
+ * Returns buf unchanged when no placement was asked for on this side,
+ * otherwise releases buf (from kbuf_alloc()) and returns a new buffer of
+ * len bytes bound to the requested node, reporting its placement. Exits
+ * on failure, like ksched_apply_side().
+ */
+static inline void *
+knuma_buffer(void *buf, size_t len, int side, int cpu)
+{
+  static const char *names[] = { "parent", "child" };
+  unsigned long mask[KNUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+  long psz = sysconf(_SC_PAGESIZE);
+  size_t maplen = (len + psz - 1) / psz * psz;
+  char label[96];
+  void *p;
+  int node;
+
+  if (kopts.numa[side] == NULL)
+    return buf;
+
+  if ((node = knuma_resolve(kopts.numa[side], cpu)) == -1)
+    exit(EXIT_FAILURE);
+
+  /* before the new one, --buf=hugetlb may only have pages for one */
+  kbuf_free(buf, len);
+
+  /* --buf strategies other than malloc give page aligned mappings */
+  if (kbuf_mode_get() > KBUF_MALLOC) {
+    maplen = kbuf_round(kbuf_mode_get(), len);
+    if ((p = kbuf_alloc(len)) == NULL)
+      exit(EXIT_FAILURE);
+  } else {
+    p = mmap(NULL, maplen, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      perror("mmap");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  memset(mask, 0, sizeof(mask));
+  mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+  if (syscall(__NR_mbind, p, maplen, MPOL_BIND, mask, 8 * sizeof(mask) + 1,
+              MPOL_MF_STRICT | MPOL_MF_MOVE) == -1) {
+    fprintf(stderr, "%s: mbind to node %d: %s\n", names[side], node,
+            strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  memset(p, 0, maplen);
+
+  snprintf(label, sizeof(label), "%s buffer (%s -> node %d, cpu %d on node %d)",
+           names[side], kopts.numa[side], node,
+           cpu < 0 ? sched_getcpu() : cpu,
+           ktopo_node_of(cpu < 0 ? sched_getcpu() : cpu));
+  knuma_report(label, p, maplen);
+  fflush(stdout);
+  return p;
+}
+
+#endif //KNuma_H
@@ -0,0 +1,192 @@
+#ifndef KPhase_H
+#define KPhase_H
+
+/*
+ * Syscall phase breakdown of ping-pong hops (--phases).
+ *
+ * Four points are stamped on CLOCK_MONOTONIC for every hop:
+ *
+ *   t_write_begin   sender, just before write()
+ *   t_write_end     sender, after write() returned
+ *   t_read_enter    receiver, when read() is entered
+ *   t_read_return   receiver, when read() returned the whole message
+ *
+ * The receiver waits for the message in poll() and only then enters
+ * read(), so read() never sleeps and the hop splits into
+ *
+ *   send            t_write_end - t_write_begin    write() syscall
+ *   transit+wakeup  t_read_enter - t_write_end     kernel hand-off and
+ *                                                  scheduling the receiver
+ *   recv            t_read_return - t_read_enter   read() syscall
+ *
+ * transit+wakeup can be slightly negative when the receiver is woken on
+ * another CPU before the sender is back from write().
+ *
+ * Each message carries a struct kphase_hdr with the hop sequence number
+ * and t_write_begin; the receiver records the sequence number so the report
+ * can flag messages that did not line up with the expected hop.
+ * The hop records live in a MAP_SHARED mapping set up before fork(), so the
+ * parent can report both directions once the child has exited.
+ */
+
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "KStats.h"
+#include "KUtils.h"
+
+struct kphase_hdr
+{
+  uint64_t seq;
+  int64_t t_write_begin;
+};
+
+struct kphase_hop
+{
+  int64_t t_write_begin;
+  int64_t t_write_end;
+  int64_t t_read_enter;
+  int64_t t_read_return;
+  uint64_t seq;           /* sequence number seen in the header */
+};
+
+/* hops[2 * i] is parent->child of round trip i, hops[2 * i + 1] the reply. */
+struct kphase
+{
+  struct kphase_hop *hops;
+  int64_t nhops;
+};
+
+static inline int
+kphase_init(struct kphase *ph, int64_t count, int size)
+{
+  size_t len = 2 * count * sizeof(struct kphase_hop);
+
+  if (size < (int)sizeof(struct kphase_hdr)) {
+    fprintf(stderr, "--phases needs a message size of at least %zu octets\n",
+            sizeof(struct kphase_hdr));
+    return -1;
+  }
+
+  ph->hops = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (ph->hops == MAP_FAILED) {
+    perror("mmap");
+    return -1;
+  }
+  ph->nhops = 2 * count;
+  return 0;
+}
+
+static inline void
+kphase_send_begin(struct kphase *ph, int64_t hop, char *buf)
+{
+  struct kphase_hdr hdr;
+
+  if (ph == NULL)
+    return;
+  hdr.seq = hop;
+  hdr.t_write_begin = kutils_now_ns();
+  memcpy(buf, &hdr, sizeof(hdr));
+  ph->hops[hop].t_write_begin = hdr.t_write_begin;
+}
+
+static inline void
+kphase_send_end(struct kphase *ph, int64_t hop)
+{
+  if (ph == NULL)
+    return;
+  ph->hops[hop].t_write_end = kutils_now_ns();
+}
+
+/* Blocks until fd is readable and returns the read() entry stamp. */
+static inline int64_t
+kphase_recv_begin(struct kphase *ph, int fd)
+{
+  struct pollfd pfd;
+
+  if (ph == NULL)
+    return 0;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  while (poll(&pfd, 1, -1) == -1)
+    ;
+  return kutils_now_ns();
+}
+
+static inline void
+kphase_recv_end(struct kphase *ph, int64_t hop, const char *buf,
+                int64_t t_read_enter)
+{
+  struct kphase_hdr hdr;
+
+  if (ph == NULL)
+    return;
+  ph->hops[hop].t_read_return = kutils_now_ns();
+  ph->hops[hop].t_read_enter = t_read_enter;
+  memcpy(&hdr, buf, sizeof(hdr));
+  ph->hops[hop].seq = hdr.seq;
+}
+
+static inline void
+kphase_report_dir(struct kphase *ph, const char *label, int64_t first,
+                  int64_t step, int64_t *tmp, int64_t n)
+{
+  static const char *names[] = { "send (write)", "transit+wakeup",
+                                 "recv (read)", "total" };
+  struct kstats_summary s[4];
+  struct kphase_hop *h;
+  int64_t c, i;
+
+  for (c = 0; c < 4; c++) {
+    for (i = 0; i < n; i++) {
+      h = &ph->hops[first + i * step];
+      switch (c) {
+      case 0: tmp[i] = h->t_write_end - h->t_write_begin; break;
+      case 1: tmp[i] = h->t_read_enter - h->t_write_end; break;
+      case 2: tmp[i] = h->t_read_return - h->t_read_enter; break;
+      default: tmp[i] = h->t_read_return - h->t_write_begin; break;
+      }
+    }
+    kstats_summarize(tmp, n, &s[c]);
+  }
+
+  printf("%s\n", label);
+  for (c = 0; c < 4; c++) {
+    char row[40];
+
+    snprintf(row, sizeof(row), "  %-15s %5.1f%%", names[c],
+             s[3].avg ? 100.0 * s[c].avg / s[3].avg : 0.0);
+    kstats_print_row(row, &s[c]);
+  }
+}
+
+/* Prints the stacked send / transit+wakeup / recv table for both directions. */
+static inline void
+kphase_report(struct kphase *ph, const char *transport)
+{
+  int64_t count = ph->nhops / 2;
+  int64_t i, bad = 0;
+  int64_t *tmp = malloc(ph->nhops * sizeof(int64_t));
+
+  if (tmp == NULL) {
+    perror("malloc");
+    return;
+  }
+
+  printf("syscall phase breakdown (%s), ns per hop:\n", transport);
+  kstats_print_header("  component       share");
+  kphase_report_dir(ph, "parent->child", 0, 2, tmp, count);
+  kphase_report_dir(ph, "child->parent", 1, 2, tmp, count);
+  kphase_report_dir(ph, "both directions", 0, 1, tmp, ph->nhops);
+  for (i = 0; i < ph->nhops; i++)
+    bad += ph->hops[i].seq != (uint64_t)i;
+  if (bad)
+    printf("WARNING: %" PRId64 " hops carried an unexpected header\n", bad);
+
+  free(tmp);
+}
+
+#endif //KPhase_H
@@ -0,0 +1,260 @@
+#ifndef KPlace_H
+#define KPlace_H
+
+/*
+ * Buffer placement explorer for the *_nonoverlap benchmarks (--placement).
+ *
+ * Every case gives, per side, the offset of the send (src) and receive
+ * (dst) pointer inside the side's message buffer. Offsets of the explorer
+ * cases are taken from a page aligned base, S is the message size (the
+ * larger of request and --response) and P is S rounded up to whole pages:
+ *
+ *   nonoverlap        the original experiment and the default: the parent
+ *                     sends and receives at buf + S, the child at buf
+ *   same              src = dst = 0
+ *   halves            src = 0, dst = S (disjoint halves of one buffer)
+ *   offset[:a:b:s]    src = dst = o for o = a, a + s, .. b
+ *                     (default 0:4095:256)
+ *   misalign[:a:b:s]  src = m, dst = P + 2048 + m for m = a .. b
+ *                     (default 0:63:8, 0 is the cache line aligned case)
+ *   alias4k           src = 0, dst = P: different pages, same address
+ *                     bits 0..11, so loads and stores 4K alias
+ *   pages             src = 0, dst = P + 2048: different pages, no 4K alias
+ *   all               every case above but nonoverlap
+ *
+ * Cases run back to back over the same connection, count round trips
+ * each. The parent times every case; with --counters each side counts its
+ * own events per case. Results go to a MAP_SHARED table set up before
+ * fork() and are printed by the parent once the child has exited.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "KUtils.h"
+#include "KCounters.h"
+
+#define KPLACE_PAGE 4096
+
+enum { KPLACE_PARENT = 0, KPLACE_CHILD = 1 };
+
+struct kplace_case
+{
+  char name[24];
+  size_t src[2];
+  size_t dst[2];
+};
+
+struct kplace_result
+{
+  int64_t delta_ns;
+  double ctr[2][KCOUNTERS_N];     /* -1: not counted */
+};
+
+struct kplace
+{
+  int n, cap;
+  struct kplace_case *cases;
+  struct kplace_result *res;      /* shared between parent and child */
+  size_t size;
+  size_t buflen;                  /* bytes to allocate, alignment included */
+  size_t align;                   /* 0 for the original experiment */
+  int64_t t0;
+};
+
+static inline int
+kplace_add(struct kplace *kp, const char *name, size_t src, size_t dst)
+{
+  struct kplace_case *c;
+  size_t end;
+
+  if (kp->n == kp->cap) {
+    kp->cap = kp->cap ? 2 * kp->cap : 16;
+    c = realloc(kp->cases, kp->cap * sizeof(*c));
+    if (c == NULL) {
+      perror("realloc");
+      return -1;
+    }
+    kp->cases = c;
+  }
+  c = &kp->cases[kp->n++];
+  snprintf(c->name, sizeof(c->name), "%s", name);
+  c->src[KPLACE_PARENT] = c->src[KPLACE_CHILD] = src;
+  c->dst[KPLACE_PARENT] = c->dst[KPLACE_CHILD] = dst;
+
+  end = (src > dst ? src : dst) + kp->size;
+  if (end > kp->buflen)
+    kp->buflen = end;
+  return 0;
+}
+
+/* offset[:a:b:s] and misalign[:a:b:s] */
+static inline int
+kplace_sweep(struct kplace *kp, const char *tok, const char *kind,
+             long a, long b, long s)
+{
+  size_t pages = (kp->size + KPLACE_PAGE - 1) / KPLACE_PAGE * KPLACE_PAGE;
+  const char *args = tok + strlen(kind);
+  char name[24];
+  long o;
+
+  if (*args == ':' && sscanf(args, ":%ld:%ld:%ld", &a, &b, &s) != 3) {
+    fprintf(stderr, "placement: %s takes <from>:<to>:<step>\n", kind);
+    return -1;
+  }
+  if (a < 0 || b < a || s <= 0) {
+    fprintf(stderr, "placement: bad %s range\n", kind);
+    return -1;
+  }
+  for (o = a; o <= b; o += s) {
+    snprintf(name, sizeof(name), "%s %ld", kind, o);
+    if (strcmp(kind, "offset") == 0) {
+      if (kplace_add(kp, name, o, o) == -1)
+        return -1;
+    } else if (kplace_add(kp, name, o, pages + 2048 + o) == -1) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Builds the case list from spec (NULL: the original experiment) and
+ * maps the result table. Call before fork().
+ */
+static inline int
+kplace_init(struct kplace *kp, const char *spec, size_t size)
+{
+  size_t pages = (size + KPLACE_PAGE - 1) / KPLACE_PAGE * KPLACE_PAGE;
+  char *list, *tok, *save;
+  int ret = 0, all;
+
+  memset(kp, 0, sizeof(*kp));
+  kp->size = size;
+
+  if (spec == NULL || strcmp(spec, "nonoverlap") == 0) {
+    if (kplace_add(kp, "nonoverlap", 0, 0) == -1)
+      return -1;
+    kp->cases[0].src[KPLACE_PARENT] = kp->cases[0].dst[KPLACE_PARENT] = size;
+    kp->buflen = 2 * size;
+  } else {
+    kp->align = KPLACE_PAGE;
+    if ((list = strdup(spec)) == NULL) {
+      perror("strdup");
+      return -1;
+    }
+    for (tok = strtok_r(list, ",", &save); tok != NULL && ret == 0;
+         tok = strtok_r(NULL, ",", &save)) {
+      all = strcmp(tok, "all") == 0;
+      if (all || strcmp(tok, "same") == 0)
+        ret |= kplace_add(kp, "same", 0, 0);
+      if (all || strcmp(tok, "halves") == 0)
+        ret |= kplace_add(kp, "halves", 0, size);
+      if (all || strncmp(tok, "offset", 6) == 0)
+        ret |= kplace_sweep(kp, all ? "offset" : tok, "offset", 0, 4095, 256);
+      if (all || strncmp(tok, "misalign", 8) == 0)
+        ret |= kplace_sweep(kp, all ? "misalign" : tok, "misalign", 0, 63, 8);
+      if (all || strcmp(tok, "alias4k") == 0)
+        ret |= kplace_add(kp, "alias4k", 0, pages);
+      if (all || strcmp(tok, "pages") == 0)
+        ret |= kplace_add(kp, "pages", 0, pages + 2048);
+      if (!all && strcmp(tok, "same") && strcmp(tok, "halves") &&
+          strncmp(tok, "offset", 6) && strncmp(tok, "misalign", 8) &&
+          strcmp(tok, "alias4k") && strcmp(tok, "pages")) {
+        fprintf(stderr, "placement: unknown case '%s' (nonoverlap, same, "
+                "halves, offset[:a:b:s], misalign[:a:b:s], alias4k, pages, "
+                "all)\n", tok);
+        ret = -1;
+      }
+    }
+    free(list);
+    if (ret != 0)
+      return -1;
+    kp->buflen += kp->align;
+  }
+
+  kp->res = mmap(NULL, kp->n * sizeof(struct kplace_result),
+                 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (kp->res == MAP_FAILED) {
+    perror("mmap");
+    return -1;
+  }
+  return 0;
+}
+
+/* Start of the offsets inside a buffer of kp->buflen bytes. */
+static inline char *
+kplace_base(struct kplace *kp, char *buf)
+{
+  if (kp->align == 0)
+    return buf;
+  return (char *)(((uintptr_t)buf + kp->align - 1) & ~(uintptr_t)(kp->align - 1));
+}
+
+static inline void
+kplace_begin(struct kplace *kp, struct kcounters *kc)
+{
+  kcounters_enable(kc);
+  kp->t0 = kutils_now_ns();
+}
+
+static inline void
+kplace_end(struct kplace *kp, int c, int side, struct kcounters *kc)
+{
+  int64_t t = kutils_now_ns();
+  unsigned k;
+
+  kcounters_disable(kc);
+  if (side == KPLACE_PARENT)
+    kp->res[c].delta_ns = t - kp->t0;
+  for (k = 0; k < KCOUNTERS_N; k++)
+    kp->res[c].ctr[side][k] = kc != NULL ? kcounters_read(kc, k) : -1;
+}
+
+/* Prints one row per case; counters are summed over both sides. */
+static inline void
+kplace_report(struct kplace *kp, int64_t count)
+{
+  static const char *names[] = { "L1-dcache-load-misses", "L2-dcache-refills",
+                                 "LLC-load-misses", "dTLB-load-misses" };
+  static const char *heads[] = { "L1D/rt", "L2D/rt", "LLC/rt", "dTLB/rt" };
+  struct kplace_case *c;
+  struct kplace_result *r;
+  char off[2][40];
+  double v;
+  int i, j, k, s;
+
+  printf("%-14s %-21s %-21s %10s", "placement", "parent src/dst",
+         "child src/dst", "avg ns");
+  if (kopts.counters)
+    for (j = 0; j < 4; j++)
+      if (kcounters_find(names[j]) >= 0)
+        printf(" %10s", heads[j]);
+  printf("\n");
+
+  for (i = 0; i < kp->n; i++) {
+    c = &kp->cases[i];
+    r = &kp->res[i];
+    for (s = 0; s < 2; s++)
+      snprintf(off[s], sizeof(off[s]), "%zu/%zu", c->src[s], c->dst[s]);
+    printf("%-14s %-21s %-21s %10" PRId64, c->name, off[0], off[1],
+           r->delta_ns / (count * 2));
+    if (kopts.counters) {
+      for (j = 0; j < 4; j++) {
+        if ((k = kcounters_find(names[j])) < 0)
+          continue;
+        if (r->ctr[0][k] < 0 || r->ctr[1][k] < 0) {
+          printf(" %10s", "n/a");
+          continue;
+        }
+        v = (r->ctr[0][k] + r->ctr[1][k]) / count;
+        printf(" %10.2f", v);
+      }
+    }
+    printf("\n");
+  }
+}
+
+#endif //KPlace_H
@@ -0,0 +1,232 @@
+#ifndef KPoll_H
+#define KPoll_H
+
+/*
+ * Receive strategies of the latency loops (--poll, --busy-poll).
+ *
+ *   block         plain blocking read(), the default
+ *   spin          non-blocking reads in a loop until data arrives
+ *                 (MSG_DONTWAIT on sockets, O_NONBLOCK on the pipe read end)
+ *   hybrid:<us>   spin for <us> microseconds, then block in poll()
+ *
+ * --busy-poll=<us> sets SO_BUSY_POLL (and SO_PREFER_BUSY_POLL where the
+ * kernel has it) on the sockets, so a blocking receive polls the device
+ * queue before it sleeps. Pipes ignore it.
+ *
+ * Spinning trades CPU for latency, so each side measures the CPU time it
+ * used over its timed loop (CLOCK_PROCESS_CPUTIME_ID) against wall time;
+ * the child hands its numbers over in a MAP_SHARED area and the parent
+ * prints both next to the latency.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "KUtils.h"
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
+enum { KPOLL_BLOCK = 0, KPOLL_SPIN, KPOLL_HYBRID };
+enum { KPOLL_PARENT = 0, KPOLL_CHILD = 1 };
+
+struct kpoll_usage
+{
+  int64_t cpu_ns[2];
+  int64_t wall_ns[2];
+};
+
+struct kpoll
+{
+  int mode;
+  int64_t spin_ns;                /* hybrid */
+  int busy_us;                    /* --busy-poll, -1: not set */
+  int sock;                       /* the receive fd is a socket */
+  int nonblock_fd;                /* pipe set O_NONBLOCK, -1: none */
+  int64_t cpu0, wall0;
+  struct kpoll_usage *use;        /* shared with the child */
+};
+
+static inline int64_t
+kpoll_cpu_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Parses --poll / --busy-poll and maps the usage area; call before
+ * fork(). Returns -1 with a message on a bad spec.
+ */
+static inline int
+kpoll_parse(struct kpoll *kp)
+{
+  const char *spec = kopts.poll;
+  char *end;
+  long us;
+
+  memset(kp, 0, sizeof(*kp));
+  kp->nonblock_fd = -1;
+  kp->busy_us = kopts.busy_poll_us;
+  if (spec == NULL || strcmp(spec, "block") == 0) {
+    kp->mode = KPOLL_BLOCK;
+  } else if (strcmp(spec, "spin") == 0) {
+    kp->mode = KPOLL_SPIN;
+  } else if (strncmp(spec, "hybrid:", 7) == 0) {
+    us = strtol(spec + 7, &end, 10);
+    if (end == spec + 7 || *end || us < 0) {
+      fprintf(stderr, "poll: bad spin time '%s'\n", spec + 7);
+      return -1;
+    }
+    kp->mode = KPOLL_HYBRID;
+    kp->spin_ns = us * 1000;
+  } else {
+    fprintf(stderr, "poll: bad mode '%s' (block, spin, hybrid:<us>)\n", spec);
+    return -1;
+  }
+  if (kp->mode != KPOLL_BLOCK && (kopts.phases || kopts.tstamp)) {
+    fprintf(stderr, "poll: --phases and --tstamp need blocking receives\n");
+    return -1;
+  }
+
+  if (kopts.poll == NULL && kp->busy_us < 0)
+    return 0;
+  kp->use = mmap(NULL, sizeof(*kp->use), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (kp->use == MAP_FAILED) {
+    perror("mmap");
+    return -1;
+  }
+  return 0;
+}
+
+/* Prepares the receive fd of one side. Exits on failure. */
+static inline void
+kpoll_setup(struct kpoll *kp, int fd)
+{
+  struct stat st;
+  int one = 1;
+
+  kp->sock = fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode);
+
+  kp->nonblock_fd = -1;
+  if (kp->mode != KPOLL_BLOCK && !kp->sock) {
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1) {
+      perror("fcntl");
+      exit(EXIT_FAILURE);
+    }
+    kp->nonblock_fd = fd;
+  }
+
+  if (kp->busy_us >= 0 && kp->sock) {
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &kp->busy_us,
+                   sizeof(kp->busy_us)) == -1) {
+      perror("setsockopt SO_BUSY_POLL (raising it needs CAP_NET_ADMIN)");
+      exit(EXIT_FAILURE);
+    }
+    /* 5.11+, not fatal on older kernels */
+    setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one));
+  }
+}
+
+static inline ssize_t
+kpoll_try(struct kpoll *kp, int fd, void *buf, size_t len)
+{
+  if (kp->sock)
+    return recv(fd, buf, len, MSG_DONTWAIT);
+  return read(fd, buf, len);
+}
+
+/* read() with the selected strategy. */
+static inline ssize_t
+kpoll_read(struct kpoll *kp, int fd, void *buf, size_t len)
+{
+  struct pollfd pfd;
+  int64_t deadline = 0;
+  ssize_t ret;
+
+  if (kp->mode == KPOLL_BLOCK)
+    return read(fd, buf, len);
+
+  if (kp->mode == KPOLL_HYBRID)
+    deadline = kutils_now_ns() + kp->spin_ns;
+  for (;;) {
+    ret = kpoll_try(kp, fd, buf, len);
+    if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+      return ret;
+    if (kp->mode == KPOLL_HYBRID && kutils_now_ns() >= deadline) {
+      pfd.fd = fd;
+      pfd.events = POLLIN;
+      if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+        return -1;
+    }
+  }
+}
+
+static inline void
+kpoll_begin(struct kpoll *kp)
+{
+  kp->wall0 = kutils_now_ns();
+  kp->cpu0 = kpoll_cpu_ns();
+}
+
+/*
+ * Ends the timed loop of one side. A pipe read end goes back to blocking
+ * reads for the passes that follow (--cold, --antagonist, --trace).
+ */
+static inline void
+kpoll_end(struct kpoll *kp, int side)
+{
+  int fd = kp->nonblock_fd;
+
+  if (fd >= 0 && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK) == -1) {
+    perror("fcntl");
+    exit(EXIT_FAILURE);
+  }
+  kp->nonblock_fd = -1;
+  if (kp->use == NULL)
+    return;
+  kp->use->cpu_ns[side] = kpoll_cpu_ns() - kp->cpu0;
+  kp->use->wall_ns[side] = kutils_now_ns() - kp->wall0;
+}
+
+/* Call after the child was reaped. */
+static inline void
+kpoll_report(struct kpoll *kp, int64_t count)
+{
+  static const char *names[] = { "parent", "child" };
+  int s;
+
+  if (kp->use == NULL)
+    return;
+  if (kp->mode == KPOLL_HYBRID)
+    printf("receive mode: hybrid, spin %" PRId64 " us", kp->spin_ns / 1000);
+  else
+    printf("receive mode: %s", kp->mode == KPOLL_SPIN ? "spin" : "block");
+  if (kp->busy_us >= 0)
+    printf(", SO_BUSY_POLL %d us", kp->busy_us);
+  printf("\n");
+  for (s = 0; s < 2; s++)
+    printf("%s cpu time: %.1f ms of %.1f ms (%.1f%%), %" PRId64
+           " ns per roundtrip\n", names[s], kp->use->cpu_ns[s] / 1e6,
+           kp->use->wall_ns[s] / 1e6,
+           kp->use->wall_ns[s] ? 100.0 * kp->use->cpu_ns[s] / kp->use->wall_ns[s]
+           : 0.0, kp->use->cpu_ns[s] / count);
+}
+
+#endif //KPoll_H
@@ -0,0 +1,184 @@
+#ifndef KPower_H
+#define KPower_H
+
+/*
+ * C-state / frequency control and reporting (--pmqos, --power).
+ *
+ * --pmqos=<us> writes the requested wakeup latency to /dev/cpu_dma_latency
+ * and holds the file open for the whole run; the kernel drops the request
+ * as soon as the descriptor is closed. 0 keeps the CPUs out of every idle
+ * state with a non-zero exit latency.
+ *
+ * --power snapshots cpufreq scaling_cur_freq and the cpuidle usage/time
+ * counters of the pinned CPUs before and after the timed loop and prints
+ * the deltas, so a result can be read against the power state it ran in.
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "KUtils.h"
+
+#define KPOWER_MAX_CPUS   2
+#define KPOWER_MAX_STATES 16
+
+struct kpower_snap
+{
+  long freq_khz;                        /* -1 without cpufreq */
+  uint64_t usage[KPOWER_MAX_STATES];
+  uint64_t time_us[KPOWER_MAX_STATES];
+};
+
+struct kpower_cpu
+{
+  int cpu;
+  int nstates;
+  char name[KPOWER_MAX_STATES][32];
+  struct kpower_snap before, after;
+};
+
+struct kpower
+{
+  int qos_fd;
+  int ncpu;
+  struct kpower_cpu cpus[KPOWER_MAX_CPUS];
+};
+
+static inline int
+kpower_read_str(const char *path, char *out, size_t len)
+{
+  FILE *f = fopen(path, "r");
+  char *nl;
+
+  if (f == NULL)
+    return -1;
+  if (fgets(out, len, f) == NULL) {
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+  if ((nl = strchr(out, '\n')) != NULL)
+    *nl = '\0';
+  return 0;
+}
+
+static inline long long
+kpower_read_ll(const char *path)
+{
+  char buf[64];
+
+  if (kpower_read_str(path, buf, sizeof(buf)) == -1)
+    return -1;
+  return atoll(buf);
+}
+
+static inline void
+kpower_snapshot(struct kpower_cpu *c, struct kpower_snap *s)
+{
+  char path[128];
+  int k;
+
+  snprintf(path, sizeof(path),
+           "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", c->cpu);
+  s->freq_khz = kpower_read_ll(path);
+
+  for (k = 0; k < c->nstates; k++) {
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/cpu/cpu%d/cpuidle/state%d/usage", c->cpu, k);
+    s->usage[k] = kpower_read_ll(path);
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/cpu/cpu%d/cpuidle/state%d/time", c->cpu, k);
+    s->time_us[k] = kpower_read_ll(path);
+  }
+}
+
+/*
+ * Takes the "before" snapshot of the given CPUs (duplicates are folded) and
+ * places the PM QoS request if one was asked for.
+ */
+static inline int
+kpower_begin(struct kpower *pw, const int *cpus, int n)
+{
+  struct kpower_cpu *c;
+  char path[128];
+  int32_t req;
+  int i, k;
+
+  memset(pw, 0, sizeof(*pw));
+  pw->qos_fd = -1;
+
+  if (kopts.pmqos_us >= 0) {
+    pw->qos_fd = open("/dev/cpu_dma_latency", O_WRONLY | O_CLOEXEC);
+    req = kopts.pmqos_us;
+    if (pw->qos_fd == -1 || write(pw->qos_fd, &req, sizeof(req)) != sizeof(req)) {
+      perror("pmqos: /dev/cpu_dma_latency");
+      return -1;
+    }
+  }
+
+  for (i = 0; i < n && pw->ncpu < KPOWER_MAX_CPUS; i++) {
+    if (pw->ncpu == 1 && pw->cpus[0].cpu == cpus[i])
+      continue;
+    c = &pw->cpus[pw->ncpu++];
+    c->cpu = cpus[i];
+    for (k = 0; k < KPOWER_MAX_STATES; k++) {
+      snprintf(path, sizeof(path),
+               "/sys/devices/system/cpu/cpu%d/cpuidle/state%d/name", c->cpu, k);
+      if (kpower_read_str(path, c->name[k], sizeof(c->name[k])) == -1)
+        break;
+    }
+    c->nstates = k;
+    kpower_snapshot(c, &c->before);
+  }
+  return 0;
+}
+
+/* Takes the "after" snapshot and drops the PM QoS request. */
+static inline void
+kpower_end(struct kpower *pw)
+{
+  int i;
+
+  for (i = 0; i < pw->ncpu; i++)
+    kpower_snapshot(&pw->cpus[i], &pw->cpus[i].after);
+  if (pw->qos_fd != -1) {
+    close(pw->qos_fd);
+    pw->qos_fd = -1;
+  }
+}
+
+static inline void
+kpower_report(const struct kpower *pw)
+{
+  const struct kpower_cpu *c;
+  int i, k;
+
+  if (kopts.pmqos_us >= 0)
+    printf("pm qos: cpu_dma_latency held at %d us\n", kopts.pmqos_us);
+  else
+    printf("pm qos: no request\n");
+
+  for (i = 0; i < pw->ncpu; i++) {
+    c = &pw->cpus[i];
+    if (c->before.freq_khz < 0)
+      printf("cpu%d: cpufreq not available\n", c->cpu);
+    else
+      printf("cpu%d: scaling_cur_freq %ld kHz before, %ld kHz after\n",
+             c->cpu, c->before.freq_khz, c->after.freq_khz);
+
+    if (c->nstates == 0) {
+      printf("cpu%d: cpuidle not available\n", c->cpu);
+      continue;
+    }
+    printf("cpu%d: %-16s %12s %14s\n", c->cpu, "idle state", "entries",
+           "residency us");
+    for (k = 0; k < c->nstates; k++)
+      printf("cpu%d: %-16s %12" PRIu64 " %14" PRIu64 "\n", c->cpu, c->name[k],
+             c->after.usage[k] - c->before.usage[k],
+             c->after.time_us[k] - c->before.time_us[k]);
+  }
+}
+
+#endif //KPower_H
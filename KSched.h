@@ -0,0 +1,198 @@
+#ifndef KSched_H
+#define KSched_H
+
+/*
+ * Scheduling policy and memory locking for the benchmark processes
+ * (--sched, --sched-parent, --sched-child, --mlock).
+ *
+ * A policy spec is one of
+ *
+ *   other                          SCHED_OTHER (the default)
+ *   fifo:<prio>                    SCHED_FIFO, priority 1..99
+ *   rr:<prio>                      SCHED_RR, priority 1..99
+ *   deadline:<runtime>:<period>    SCHED_DEADLINE, microseconds, the
+ *                                  relative deadline equals the period
+ *
+ * Each side applies its own policy right after pinning itself, since
+ * neither the policy of a deadline task nor mlockall() carries over fork().
+ * The kernel refuses SCHED_DEADLINE for tasks whose affinity is narrower
+ * than their root domain, so deadline runs need an exclusive cpuset with
+ * the benchmark CPU rather than sched_setaffinity() alone.
+ */
+
+#include <errno.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "KUtils.h"
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+
+/* glibc only grew a sched_setattr() wrapper in 2.41 */
+struct ksched_attr
+{
+  uint32_t size;
+  uint32_t sched_policy;
+  uint64_t sched_flags;
+  int32_t sched_nice;
+  uint32_t sched_priority;
+  uint64_t sched_runtime;
+  uint64_t sched_deadline;
+  uint64_t sched_period;
+};
+
+enum { KSCHED_PARENT = 0, KSCHED_CHILD = 1 };
+
+struct ksched_policy
+{
+  int policy;
+  int prio;
+  uint64_t runtime_ns;
+  uint64_t period_ns;
+};
+
+static inline int
+ksched_parse(const char *spec, struct ksched_policy *p)
+{
+  unsigned long long runtime, period;
+
+  memset(p, 0, sizeof(*p));
+  p->policy = SCHED_OTHER;
+  if (spec == NULL || strcmp(spec, "other") == 0)
+    return 0;
+
+  if (sscanf(spec, "fifo:%d", &p->prio) == 1)
+    p->policy = SCHED_FIFO;
+  else if (sscanf(spec, "rr:%d", &p->prio) == 1)
+    p->policy = SCHED_RR;
+  else if (sscanf(spec, "deadline:%llu:%llu", &runtime, &period) == 2) {
+    p->policy = SCHED_DEADLINE;
+    p->runtime_ns = runtime * 1000;
+    p->period_ns = period * 1000;
+    if (runtime == 0 || runtime > period) {
+      fprintf(stderr, "sched: deadline runtime must be in 1..period\n");
+      return -1;
+    }
+    return 0;
+  } else {
+    fprintf(stderr, "sched: bad policy '%s' (other, fifo:<prio>, rr:<prio>, "
+            "deadline:<runtime_us>:<period_us>)\n", spec);
+    return -1;
+  }
+
+  if (p->prio < 1 || p->prio > 99) {
+    fprintf(stderr, "sched: priority must be in 1..99\n");
+    return -1;
+  }
+  return 0;
+}
+
+static inline void
+ksched_describe(const struct ksched_policy *p, char *out, size_t len)
+{
+  switch (p->policy) {
+  case SCHED_FIFO:
+    snprintf(out, len, "SCHED_FIFO prio %d", p->prio);
+    break;
+  case SCHED_RR:
+    snprintf(out, len, "SCHED_RR prio %d", p->prio);
+    break;
+  case SCHED_DEADLINE:
+    snprintf(out, len, "SCHED_DEADLINE runtime %llu us period %llu us",
+             (unsigned long long)p->runtime_ns / 1000,
+             (unsigned long long)p->period_ns / 1000);
+    break;
+  default:
+    snprintf(out, len, "SCHED_OTHER");
+    break;
+  }
+}
+
+static inline int
+ksched_set(const struct ksched_policy *p)
+{
+  struct ksched_attr attr;
+  struct sched_param param;
+
+  if (p->policy != SCHED_DEADLINE) {
+    param.sched_priority = p->policy == SCHED_OTHER ? 0 : p->prio;
+    return sched_setscheduler(0, p->policy, &param);
+  }
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.sched_policy = SCHED_DEADLINE;
+  attr.sched_runtime = p->runtime_ns;
+  attr.sched_deadline = p->period_ns;
+  attr.sched_period = p->period_ns;
+  return syscall(__NR_sched_setattr, 0, &attr, 0);
+}
+
+/* Validates both specs before fork(), so a typo cannot strand the peer. */
+static inline int
+ksched_check(void)
+{
+  struct ksched_policy p;
+
+  if (ksched_parse(kopts.sched[KSCHED_PARENT], &p) == -1 ||
+      ksched_parse(kopts.sched[KSCHED_CHILD], &p) == -1)
+    return -1;
+  return 0;
+}
+
+/*
+ * Applies the policy requested for one side plus --mlock and reports what
+ * is in effect. Exits on failure: numbers taken under the wrong policy are
+ * worse than no numbers.
+ */
+static inline void
+ksched_apply_side(int side)
+{
+  static const char *names[] = { "parent", "child" };
+  struct ksched_policy p;
+  char desc[96];
+
+  if (ksched_parse(kopts.sched[side], &p) == -1)
+    exit(EXIT_FAILURE);
+
+#ifndef RT_SCHED
+  if (p.policy != SCHED_OTHER || kopts.mlock) {
+    fprintf(stderr, "%s: built without RT_SCHED, --sched/--mlock ignored\n",
+            names[side]);
+    p.policy = SCHED_OTHER;
+    kopts.mlock = 0;
+  }
+#endif
+
+  if (p.policy != SCHED_OTHER && ksched_set(&p) == -1) {
+    int err = errno;
+
+    ksched_describe(&p, desc, sizeof(desc));
+    fprintf(stderr, "%s: cannot switch to %s: %s\n", names[side], desc,
+            strerror(err));
+    if (p.policy == SCHED_DEADLINE && (err == EPERM || err == EBUSY))
+      fprintf(stderr, "%s: SCHED_DEADLINE needs CAP_SYS_NICE and an affinity "
+              "mask covering the whole root domain (use an exclusive cpuset)\n",
+              names[side]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (kopts.mlock && mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+    perror("mlockall");
+    exit(EXIT_FAILURE);
+  }
+
+  ksched_describe(&p, desc, sizeof(desc));
+  printf("%s scheduling policy: %s%s\n", names[side], desc,
+         kopts.mlock ? ", memory locked" : "");
+  fflush(stdout);
+}
+
+#endif //KSched_H
@@ -0,0 +1,330 @@
+#ifndef KSchedTrace_H
+#define KSchedTrace_H
+
+/*
+ * Scheduler wakeup latency collector (--schedtrace).
+ *
+ * Opens the sched:sched_wakeup and sched:sched_switch tracepoints through
+ * perf_event_open() on every online CPU, filtered in the kernel to the two
+ * benchmark tasks, and samples them (PERF_SAMPLE_TIME | PERF_SAMPLE_RAW)
+ * into per-CPU perf mmap rings. After the run the rings are merged by time
+ * and every wakeup of a benchmark task is paired with the next switch that
+ * puts it on a CPU, giving the runnable-but-not-running delay.
+ *
+ * Timestamps use CLOCK_MONOTONIC (use_clockid) like the benchmarks do.
+ * Needs tracefs mounted at /sys/kernel/tracing or /sys/kernel/debug/tracing
+ * and CAP_PERFMON / CAP_SYS_ADMIN or perf_event_paranoid <= -1.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "KStats.h"
+#include "KUtils.h"
+
+#define KSCHEDTRACE_BIG_PAGES   1024    /* data pages on the benchmark CPUs */
+#define KSCHEDTRACE_SMALL_PAGES 8       /* data pages everywhere else */
+
+enum { KSCHED_WAKEUP = 0, KSCHED_SWITCH = 1 };
+
+struct ksched_sample
+{
+  int64_t t;
+  int type;
+  int pid;                /* woken task, or task switched in */
+};
+
+struct kschedtrace
+{
+  int ncpu;
+  int *fds;               /* [cpu * 2 + KSCHED_WAKEUP/SWITCH] */
+  void **rings;
+  size_t *ring_len;
+  int pid_off[2];         /* offset of pid / next_pid in the raw record */
+  pid_t pids[2];
+  struct klat delay;      /* wakeup -> running, ns */
+  uint64_t lost;
+  uint64_t unmatched;
+};
+
+static inline int
+kschedtrace_read_event(const char *event, const char *field, int *id,
+                       int *offset)
+{
+  static const char *roots[] = { "/sys/kernel/tracing",
+                                 "/sys/kernel/debug/tracing" };
+  char path[256], line[512], needle[64];
+  FILE *f = NULL;
+  unsigned r;
+  char *p;
+
+  for (r = 0; r < sizeof(roots) / sizeof(roots[0]) && f == NULL; r++) {
+    snprintf(path, sizeof(path), "%s/events/sched/%s/format", roots[r], event);
+    f = fopen(path, "r");
+  }
+  if (f == NULL) {
+    fprintf(stderr, "schedtrace: no tracefs format for sched:%s\n", event);
+    return -1;
+  }
+
+  *id = -1;
+  *offset = -1;
+  snprintf(needle, sizeof(needle), " %s;", field);
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (strncmp(line, "ID:", 3) == 0)
+      *id = atoi(line + 3);
+    else if (strstr(line, needle) != NULL && (p = strstr(line, "offset:")) != NULL)
+      *offset = atoi(p + 7);
+  }
+  fclose(f);
+
+  return (*id < 0 || *offset < 0) ? -1 : 0;
+}
+
+static inline int
+kschedtrace_open_one(struct kschedtrace *st, int cpu, int type, int id,
+                     size_t pages)
+{
+  struct perf_event_attr pe;
+  char filter[128];
+  int fd;
+
+  memset(&pe, 0, sizeof(pe));
+  pe.type = PERF_TYPE_TRACEPOINT;
+  pe.size = sizeof(pe);
+  pe.config = id;
+  pe.sample_period = 1;
+  pe.sample_type = PERF_SAMPLE_TIME | PERF_SAMPLE_RAW;
+  pe.disabled = 1;
+  pe.use_clockid = 1;
+  pe.clockid = CLOCK_MONOTONIC;
+  pe.wakeup_events = 1 << 30;   /* nobody polls, the rings are read at the end */
+
+  fd = perf_event_open(&pe, -1, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+  if (fd == -1)
+    return errno == ENODEV ? 0 : -1;    /* offline CPU */
+
+  snprintf(filter, sizeof(filter), "%s == %d || %s == %d",
+           type == KSCHED_WAKEUP ? "pid" : "next_pid", st->pids[0],
+           type == KSCHED_WAKEUP ? "pid" : "next_pid", st->pids[1]);
+  if (ioctl(fd, PERF_EVENT_IOC_SET_FILTER, filter) == -1) {
+    perror("schedtrace: PERF_EVENT_IOC_SET_FILTER");
+    close(fd);
+    return -1;
+  }
+
+  st->ring_len[cpu * 2 + type] = (pages + 1) * sysconf(_SC_PAGESIZE);
+  st->rings[cpu * 2 + type] = mmap(NULL, st->ring_len[cpu * 2 + type],
+                                   PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (st->rings[cpu * 2 + type] == MAP_FAILED) {
+    perror("schedtrace: mmap");
+    st->rings[cpu * 2 + type] = NULL;
+    close(fd);
+    return -1;
+  }
+
+  st->fds[cpu * 2 + type] = fd;
+  return 0;
+}
+
+/*
+ * Opens the collector for tasks pid_a and pid_b, which run pinned on cpu_a
+ * and cpu_b; those CPUs get the large rings. Returns -1 if tracing is not
+ * available, in which case the benchmark should carry on without it.
+ */
+static inline int
+kschedtrace_open(struct kschedtrace *st, pid_t pid_a, pid_t pid_b,
+                 int cpu_a, int cpu_b, int64_t hops)
+{
+  int wake_id, switch_id, cpu;
+  size_t pages;
+
+  memset(st, 0, sizeof(*st));
+  st->pids[0] = pid_a;
+  st->pids[1] = pid_b;
+
+  if (kschedtrace_read_event("sched_wakeup", "pid", &wake_id,
+                             &st->pid_off[KSCHED_WAKEUP]) == -1 ||
+      kschedtrace_read_event("sched_switch", "next_pid", &switch_id,
+                             &st->pid_off[KSCHED_SWITCH]) == -1)
+    return -1;
+
+  st->ncpu = sysconf(_SC_NPROCESSORS_CONF);
+  st->fds = malloc(2 * st->ncpu * sizeof(int));
+  st->rings = calloc(2 * st->ncpu, sizeof(void *));
+  st->ring_len = calloc(2 * st->ncpu, sizeof(size_t));
+  if (st->fds == NULL || st->rings == NULL || st->ring_len == NULL ||
+      klat_init(&st->delay, 2 * hops) == -1)
+    return -1;
+
+  for (cpu = 0; cpu < 2 * st->ncpu; cpu++)
+    st->fds[cpu] = -1;
+
+  for (cpu = 0; cpu < st->ncpu; cpu++) {
+    pages = (cpu == cpu_a || cpu == cpu_b) ? KSCHEDTRACE_BIG_PAGES
+                                           : KSCHEDTRACE_SMALL_PAGES;
+    if (kschedtrace_open_one(st, cpu, KSCHED_WAKEUP, wake_id, pages) == -1 ||
+        kschedtrace_open_one(st, cpu, KSCHED_SWITCH, switch_id, pages) == -1) {
+      fprintf(stderr, "schedtrace: cannot open sched tracepoints on cpu %d: %s\n",
+              cpu, strerror(errno));
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static inline void
+kschedtrace_ioctl(struct kschedtrace *st, unsigned long req)
+{
+  int k;
+
+  for (k = 0; k < 2 * st->ncpu; k++)
+    if (st->fds[k] != -1)
+      ioctl(st->fds[k], req, 0);
+}
+
+static inline void
+kschedtrace_enable(struct kschedtrace *st)
+{
+  kschedtrace_ioctl(st, PERF_EVENT_IOC_RESET);
+  kschedtrace_ioctl(st, PERF_EVENT_IOC_ENABLE);
+}
+
+static inline void
+kschedtrace_disable(struct kschedtrace *st)
+{
+  kschedtrace_ioctl(st, PERF_EVENT_IOC_DISABLE);
+}
+
+/* Copies len bytes at offset off out of the ring data area, handling wrap. */
+static inline void
+kschedtrace_ring_copy(const char *data, uint64_t size, uint64_t off,
+                      void *dst, size_t len)
+{
+  uint64_t start = off & (size - 1);
+  size_t first = len < size - start ? len : size - start;
+
+  memcpy(dst, data + start, first);
+  memcpy((char *)dst + first, data, len - first);
+}
+
+static inline int64_t
+kschedtrace_drain(struct kschedtrace *st, int k, int type,
+                  struct ksched_sample *out, int64_t n, int64_t cap)
+{
+  struct perf_event_mmap_page *meta = st->rings[k];
+  const char *data = (const char *)meta + sysconf(_SC_PAGESIZE);
+  uint64_t size = st->ring_len[k] - sysconf(_SC_PAGESIZE);
+  uint64_t head = meta->data_head, tail = meta->data_tail;
+  struct perf_event_header hdr;
+  char rec[512];
+  uint64_t t, lost[2];
+  uint32_t raw_size;
+  int32_t pid;
+
+  __sync_synchronize();
+  while (tail < head) {
+    kschedtrace_ring_copy(data, size, tail, &hdr, sizeof(hdr));
+    if (hdr.size > sizeof(rec))
+      break;
+    kschedtrace_ring_copy(data, size, tail, rec, hdr.size);
+    tail += hdr.size;
+
+    if (hdr.type == PERF_RECORD_LOST) {
+      memcpy(lost, rec + sizeof(hdr), sizeof(lost));
+      st->lost += lost[1];
+      continue;
+    }
+    if (hdr.type != PERF_RECORD_SAMPLE || n >= cap)
+      continue;
+
+    /* u64 time; u32 size; char raw[size] */
+    memcpy(&t, rec + sizeof(hdr), sizeof(t));
+    memcpy(&raw_size, rec + sizeof(hdr) + 8, sizeof(raw_size));
+    if ((uint32_t)st->pid_off[type] + sizeof(pid) > raw_size)
+      continue;
+    memcpy(&pid, rec + sizeof(hdr) + 12 + st->pid_off[type], sizeof(pid));
+
+    out[n].t = t;
+    out[n].type = type;
+    out[n].pid = pid;
+    n++;
+  }
+  meta->data_tail = tail;
+  return n;
+}
+
+static inline int
+kschedtrace_cmp(const void *a, const void *b)
+{
+  const struct ksched_sample *x = a, *y = b;
+
+  if (x->t != y->t)
+    return (x->t > y->t) - (x->t < y->t);
+  return x->type - y->type;     /* a wakeup sorts before a same-time switch */
+}
+
+/* Merges the rings and pairs every wakeup with the following switch-in. */
+static inline void
+kschedtrace_collect(struct kschedtrace *st)
+{
+  struct ksched_sample *s;
+  int64_t n = 0, cap = 0, i, pending[2] = { 0, 0 };
+  int k, w;
+
+  for (k = 0; k < 2 * st->ncpu; k++)
+    if (st->rings[k] != NULL)
+      cap += st->ring_len[k] / 32;    /* a sample record is > 32 bytes */
+
+  s = malloc(cap * sizeof(*s));
+  if (s == NULL) {
+    perror("malloc");
+    return;
+  }
+
+  for (k = 0; k < 2 * st->ncpu; k++)
+    if (st->rings[k] != NULL)
+      n = kschedtrace_drain(st, k, k & 1, s, n, cap);
+  qsort(s, n, sizeof(*s), kschedtrace_cmp);
+
+  for (i = 0; i < n; i++) {
+    w = s[i].pid == st->pids[0] ? 0 : (s[i].pid == st->pids[1] ? 1 : -1);
+    if (w < 0)
+      continue;
+    if (s[i].type == KSCHED_WAKEUP) {
+      if (!pending[w])
+        pending[w] = s[i].t;
+    } else if (pending[w]) {
+      klat_record(&st->delay, s[i].t - pending[w]);
+      pending[w] = 0;
+    } else {
+      st->unmatched++;    /* switched in after a preemption, no wakeup */
+    }
+  }
+  free(s);
+}
+
+/* Prints the wakeup->run delays next to the benchmark's own latencies. */
+static inline void
+kschedtrace_report(struct kschedtrace *st, struct klat *ipc,
+                   const char *ipc_label)
+{
+  struct khist h_ipc, h_delay;
+  struct khist *h[2] = { &h_ipc, &h_delay };
+  const char *names[2] = { ipc_label, "wakeup->run" };
+
+  klat_fill_hist(ipc, &h_ipc);
+  klat_fill_hist(&st->delay, &h_delay);
+  khist_print_cols("latency histogram:", names, h, 2);
+
+  klat_report(&st->delay, "wakeup->run");
+  printf("schedtrace: %" PRId64 " wakeups paired, %" PRIu64
+         " switch-ins without wakeup, %" PRIu64 " records lost\n",
+         st->delay.n, st->unmatched, st->lost);
+}
+
+#endif //KSchedTrace_H
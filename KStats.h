@@ -0,0 +1,259 @@
+#ifndef KStats_H
+#define KStats_H
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Latency sample summaries. Samples are signed nanosecond deltas so that
+ * components derived from two different CPUs (which may come out slightly
+ * negative) can be summarised without clamping.
+ */
+struct kstats_summary
+{
+  int64_t n;
+  int64_t min;
+  int64_t max;
+  int64_t avg;
+  int64_t p50;
+  int64_t p90;
+  int64_t p99;
+  int64_t p999;
+};
+
+static inline int
+kstats_cmp_i64(const void *a, const void *b)
+{
+  int64_t x = *(const int64_t *)a;
+  int64_t y = *(const int64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+/* p in [0, 100]; sorted must be in ascending order. */
+static inline int64_t
+kstats_percentile(const int64_t *sorted, int64_t n, double p)
+{
+  int64_t idx;
+
+  if (n == 0)
+    return 0;
+  idx = (int64_t)(p / 100.0 * (double)(n - 1) + 0.5);
+  return sorted[idx];
+}
+
+/* Sorts samples in place. */
+static inline void
+kstats_summarize(int64_t *samples, int64_t n, struct kstats_summary *s)
+{
+  int64_t i, sum = 0;
+
+  memset(s, 0, sizeof(*s));
+  s->n = n;
+  if (n == 0)
+    return;
+
+  qsort(samples, n, sizeof(int64_t), kstats_cmp_i64);
+  for (i = 0; i < n; i++)
+    sum += samples[i];
+
+  s->min = samples[0];
+  s->max = samples[n - 1];
+  s->avg = sum / n;
+  s->p50 = kstats_percentile(samples, n, 50.0);
+  s->p90 = kstats_percentile(samples, n, 90.0);
+  s->p99 = kstats_percentile(samples, n, 99.0);
+  s->p999 = kstats_percentile(samples, n, 99.9);
+}
+
+static inline void
+kstats_print_header(const char *label)
+{
+  printf("%-24s %10s %10s %10s %10s %10s %10s %10s\n", label,
+         "min", "avg", "p50", "p90", "p99", "p99.9", "max");
+}
+
+static inline void
+kstats_print_row(const char *label, const struct kstats_summary *s)
+{
+  printf("%-24s %10" PRId64 " %10" PRId64 " %10" PRId64 " %10" PRId64
+         " %10" PRId64 " %10" PRId64 " %10" PRId64 "\n", label,
+         s->min, s->avg, s->p50, s->p90, s->p99, s->p999, s->max);
+}
+
+/*
+ * Log-linear histogram: every power of two is split into KHIST_SUB linear
+ * sub-buckets, which keeps the relative bucket width under 25% from 1 ns up
+ * to 2^63 ns in a fixed 2 KB table.
+ */
+#define KHIST_SUB_BITS 2
+#define KHIST_SUB (1 << KHIST_SUB_BITS)
+#define KHIST_BUCKETS (64 * KHIST_SUB)
+
+struct khist
+{
+  uint64_t bucket[KHIST_BUCKETS];
+  uint64_t n;
+};
+
+static inline int
+khist_index(int64_t v)
+{
+  int msb;
+
+  if (v < KHIST_SUB)
+    return v < 0 ? 0 : (int)v;
+  msb = 63 - __builtin_clzll((uint64_t)v);
+  return (msb - KHIST_SUB_BITS + 1) * KHIST_SUB +
+         (int)((v >> (msb - KHIST_SUB_BITS)) & (KHIST_SUB - 1));
+}
+
+/* Lowest value that lands in bucket idx. */
+static inline int64_t
+khist_floor(int idx)
+{
+  int msb;
+
+  if (idx < KHIST_SUB)
+    return idx;
+  msb = idx / KHIST_SUB + KHIST_SUB_BITS - 1;
+  return ((int64_t)1 << msb) +
+         ((int64_t)(idx % KHIST_SUB) << (msb - KHIST_SUB_BITS));
+}
+
+static inline void
+khist_add(struct khist *h, int64_t v)
+{
+  h->bucket[khist_index(v)]++;
+  h->n++;
+}
+
+static inline void
+khist_merge(struct khist *dst, const struct khist *src)
+{
+  int b;
+
+  for (b = 0; b < KHIST_BUCKETS; b++)
+    dst->bucket[b] += src->bucket[b];
+  dst->n += src->n;
+}
+
+/* Lowest value of the bucket holding percentile p, for when no samples are kept. */
+static inline int64_t
+khist_percentile(const struct khist *h, double p)
+{
+  uint64_t rank, seen = 0;
+  int b;
+
+  if (h->n == 0)
+    return 0;
+  rank = (uint64_t)(p / 100.0 * (double)(h->n - 1) + 0.5);
+  for (b = 0; b < KHIST_BUCKETS; b++) {
+    seen += h->bucket[b];
+    if (seen > rank)
+      return khist_floor(b);
+  }
+  return khist_floor(KHIST_BUCKETS - 1);
+}
+
+/*
+ * Prints histograms that share the bucket layout side by side, one column
+ * of counts per histogram. Empty rows are skipped.
+ */
+static inline void
+khist_print_cols(const char *title, const char **names,
+                 struct khist **h, int nh)
+{
+  int b, k, lo = KHIST_BUCKETS, hi = -1;
+
+  for (k = 0; k < nh; k++)
+    for (b = 0; b < KHIST_BUCKETS; b++)
+      if (h[k]->bucket[b]) {
+        lo = b < lo ? b : lo;
+        hi = b > hi ? b : hi;
+      }
+
+  printf("%s\n%24s", title, "bucket (ns)");
+  for (k = 0; k < nh; k++)
+    printf(" %18s", names[k]);
+  printf("\n");
+
+  for (b = lo; b <= hi; b++) {
+    for (k = 0; k < nh && !h[k]->bucket[b]; k++)
+      ;
+    if (k == nh)
+      continue;
+    printf("%11" PRId64 " - %10" PRId64, khist_floor(b),
+           khist_floor(b + 1) - 1);
+    for (k = 0; k < nh; k++)
+      printf(" %10" PRIu64 " %6.2f%%", h[k]->bucket[b],
+             h[k]->n ? 100.0 * h[k]->bucket[b] / h[k]->n : 0.0);
+    printf("\n");
+  }
+}
+
+/* Per operation latency samples, e.g. every round trip of a benchmark. */
+struct klat
+{
+  int64_t *samples;
+  int64_t n;
+  int64_t cap;
+};
+
+static inline int
+klat_init(struct klat *l, int64_t cap)
+{
+  l->samples = malloc(cap * sizeof(int64_t));
+  if (l->samples == NULL) {
+    perror("malloc");
+    return -1;
+  }
+  /* fault the pages in now rather than inside the timed loop */
+  memset(l->samples, 0, cap * sizeof(int64_t));
+  l->n = 0;
+  l->cap = cap;
+  return 0;
+}
+
+static inline void
+klat_record(struct klat *l, int64_t v)
+{
+  if (l != NULL && l->n < l->cap)
+    l->samples[l->n++] = v;
+}
+
+static inline void
+klat_fill_hist(const struct klat *l, struct khist *h)
+{
+  int64_t i;
+
+  memset(h, 0, sizeof(*h));
+  for (i = 0; i < l->n; i++)
+    khist_add(h, l->samples[i]);
+}
+
+/* Prints percentiles; the samples are left sorted. */
+static inline void
+klat_report(struct klat *l, const char *label)
+{
+  struct kstats_summary s;
+
+  kstats_summarize(l->samples, l->n, &s);
+  kstats_print_header("latency (ns)");
+  kstats_print_row(label, &s);
+}
+
+static inline void
+klat_print_hist(const struct klat *l, const char *label)
+{
+  struct khist h;
+  struct khist *hp = &h;
+
+  klat_fill_hist(l, &h);
+  khist_print_cols("latency histogram:", &label, &hp, 1);
+}
+
+#endif //KStats_H
@@ -0,0 +1,145 @@
+#ifndef KStream_H
+#define KStream_H
+
+/*
+ * Large messages (--chunk).
+ *
+ * A pipe or a unix socket hands a reader whatever is queued, at most the
+ * pipe or socket buffer (64 KiB by default), and a writer may be cut short
+ * by a signal, so one read() or write() per message only works for small
+ * messages. The benchmarks move a message with the loops below, which
+ * carry on after a partial transfer until the whole message is through,
+ * and stop on end of file or an error.
+ *
+ * With --chunk=<bytes> a message goes out and comes in as readv() and
+ * writev() calls over <bytes> sized pieces of the buffer, up to IOV_MAX
+ * pieces a call, the way a blob store hands a scatter list of its pages to
+ * the kernel. Messages of KSTREAM_LARGE octets and more, or any size with
+ * --chunk, also print the throughput of the latency loop in MB/s next to
+ * the per message latency.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "KUtils.h"
+#include "KPoll.h"
+
+#define KSTREAM_LARGE 65536
+#define KSTREAM_IOV 1024          /* IOV_MAX on Linux */
+
+/* Fills iov with chunk sized pieces of buf; returns the count. */
+static inline int
+kstream_iov(struct iovec *iov, char *buf, size_t len, size_t chunk)
+{
+  int n;
+
+  for (n = 0; len > 0 && n < KSTREAM_IOV; n++) {
+    iov[n].iov_base = buf;
+    iov[n].iov_len = len < chunk ? len : chunk;
+    buf += iov[n].iov_len;
+    len -= iov[n].iov_len;
+  }
+  return n;
+}
+
+/* One read() or readv() of up to len octets. */
+static inline ssize_t
+kstream_read_some(int fd, char *buf, size_t len)
+{
+  struct iovec iov[KSTREAM_IOV];
+
+  if (kopts.chunk <= 0)
+    return read(fd, buf, len);
+  return readv(fd, iov, kstream_iov(iov, buf, len, kopts.chunk));
+}
+
+/* Reads len octets; returns len, or what came before end of file or -1. */
+static inline ssize_t
+kstream_read(int fd, void *buf, size_t len)
+{
+  size_t sofar;
+  ssize_t ret;
+
+  for (sofar = 0; sofar < len; sofar += ret) {
+    ret = kstream_read_some(fd, (char *)buf + sofar, len - sofar);
+    if (ret == -1 && errno == EINTR) {
+      ret = 0;
+      continue;
+    }
+    if (ret <= 0)
+      return ret == 0 ? (ssize_t)sofar : -1;
+  }
+  return len;
+}
+
+/* Writes len octets; returns len or -1. */
+static inline ssize_t
+kstream_write(int fd, const void *buf, size_t len)
+{
+  struct iovec iov[KSTREAM_IOV];
+  size_t sofar;
+  ssize_t ret;
+  char *p;
+
+  for (sofar = 0; sofar < len; sofar += ret) {
+    p = (char *)buf + sofar;
+    if (kopts.chunk <= 0)
+      ret = write(fd, p, len - sofar);
+    else
+      ret = writev(fd, iov, kstream_iov(iov, p, len - sofar, kopts.chunk));
+    if (ret == -1 && errno == EINTR) {
+      ret = 0;
+      continue;
+    }
+    if (ret <= 0)
+      return -1;
+  }
+  return len;
+}
+
+/*
+ * kstream_read() through the --poll receive strategy: the blocking default
+ * reads the message as above, the polling ones loop on kpoll_read().
+ */
+static inline ssize_t
+kstream_recv(struct kpoll *kp, int fd, void *buf, size_t len)
+{
+  size_t sofar;
+  ssize_t ret;
+
+  if (kp->mode == KPOLL_BLOCK)
+    return kstream_read(fd, buf, len);
+  for (sofar = 0; sofar < len; sofar += ret) {
+    ret = kpoll_read(kp, fd, (char *)buf + sofar, len - sofar);
+    if (ret <= 0)
+      return ret == 0 ? (ssize_t)sofar : -1;
+  }
+  return len;
+}
+
+/* Refuses a bad --chunk. */
+static inline int
+kstream_check(void)
+{
+  if (kopts.chunk < 0) {
+    fprintf(stderr, "chunk: bad size %d\n", kopts.chunk);
+    return -1;
+  }
+  return 0;
+}
+
+/* Throughput of a latency loop of count round trips of size + resp octets. */
+static inline void
+kstream_report(int64_t delta_ns, int64_t count, int size, int resp)
+{
+  if (size < KSTREAM_LARGE && resp < KSTREAM_LARGE && kopts.chunk <= 0)
+    return;
+  printf("average throughput: %.1f MB/s\n",
+         (double)count * (size + resp) / (delta_ns / 1e3));
+}
+
+#endif //KStream_H
@@ -0,0 +1,105 @@
+#ifndef KSweep_H
+#define KSweep_H
+
+/*
+ * Benchmark runner of the sweep tools (topo_sweep, size_sweep).
+ *
+ * The benchmark binaries are looked up next to the running tool with the
+ * same suffix, so binaries/topo_sweep.aarch64.elf runs
+ * binaries/pipe_lat.aarch64.elf. Each run is a fork() and exec() of the
+ * benchmark with its stdout on a pipe; the output is passed through,
+ * indented, and its "average latency: N ns" line is picked up.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct ksweep
+{
+  char dir[256];                  /* "binaries/" */
+  char suffix[64];                /* ".aarch64.elf" */
+};
+
+/* Splits argv[0] of the tool called name into directory and suffix. */
+static inline void
+ksweep_init(struct ksweep *ks, const char *argv0, const char *name)
+{
+  const char *p;
+
+  p = strrchr(argv0, '/');
+  snprintf(ks->dir, sizeof(ks->dir), "%.*s", p ? (int)(p - argv0 + 1) : 0,
+           argv0);
+  p = strstr(p ? p : argv0, name);
+  snprintf(ks->suffix, sizeof(ks->suffix), "%s", p ? p + strlen(name) : "");
+  if (!ks->dir[0])
+    snprintf(ks->dir, sizeof(ks->dir), "./");
+}
+
+/* Path of the sibling benchmark bench; a name with a '/' is taken as is. */
+static inline void
+ksweep_path(struct ksweep *ks, const char *bench, char *path, size_t len)
+{
+  if (strchr(bench, '/') != NULL)
+    snprintf(path, len, "%s", bench);
+  else
+    snprintf(path, len, "%s%s%s", ks->dir, bench, ks->suffix);
+}
+
+/*
+ * Runs argv (argv[0] is the path, NULL terminated) and returns its average
+ * latency in ns, or -1. The benchmark output is passed through.
+ */
+static inline long
+ksweep_run(char *const argv[])
+{
+  char line[256];
+  int fds[2], status;
+  long avg = -1;
+  pid_t pid;
+  FILE *f;
+  char *m;
+
+  if (pipe(fds) == -1) {
+    perror("pipe");
+    return -1;
+  }
+
+  fflush(stdout);
+  pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    return -1;
+  }
+  if (!pid) {
+    dup2(fds[1], 1);
+    close(fds[0]);
+    close(fds[1]);
+    execv(argv[0], argv);
+    perror(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  close(fds[1]);
+  f = fdopen(fds[0], "r");
+  while (fgets(line, sizeof(line), f) != NULL) {
+    printf("    %s", line);
+    /*
+     * "average latency: N ns", tcp_lat prefixes it with "Clock "; other
+     * passes print their own ("cold average latency: ..."), skip those
+     */
+    m = strncmp(line, "Clock ", 6) == 0 ? line + 6 : line;
+    if (strncmp(m, "average latency: ", 17) == 0)
+      sscanf(m, "average latency: %li ns", &avg);
+  }
+  fclose(f);
+
+  if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0)
+    return -1;
+  return avg;
+}
+
+#endif //KSweep_H
@@ -0,0 +1,285 @@
+#ifndef KThreads_H
+#define KThreads_H
+
+/*
+ * Thread mode of the pipe / unix / tcp / udp benchmarks (--threads).
+ *
+ * Instead of fork()ing, both ends run as threads of one process: the main
+ * thread takes the parent's role and a pthread the child's, each pinned
+ * with pthread_setaffinity_np() to the CPU the parent or child would have
+ * used. A context switch between them does not switch mm, which is the
+ * case of in-process pipelines that talk over pipes and socketpairs.
+ *
+ * The transport is set up by the main thread before the second thread is
+ * started (tcp connects to a listener on an ephemeral loopback port, udp
+ * connects two bound loopback sockets to each other). Each thread then
+ * allocates its own buffer with the --buf strategy, applies its --sched
+ * and --numa settings and waits on a barrier, so the parent starts the
+ * clock only once both sides are ready. --counters counts both threads.
+ * Options that depend on a second process are refused.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "KUtils.h"
+#include "KSched.h"
+#include "KBuf.h"
+#include "KCounters.h"
+#include "KNuma.h"
+
+enum { KTHREADS_PIPE, KTHREADS_UNIX, KTHREADS_TCP, KTHREADS_UDP };
+enum { KTHREADS_LAT, KTHREADS_THR };
+enum { KTHREADS_PARENT = 0, KTHREADS_CHILD = 1 };
+
+struct kthreads
+{
+  int transport;
+  int mode;
+  int size;
+  int64_t count;
+  int cpu[2];                     /* -1: not pinned */
+  int rfd[2], wfd[2];             /* per side */
+  pthread_barrier_t ready;
+};
+
+#define kthreads_die(msg) do { perror(msg); exit(EXIT_FAILURE); } while (0)
+
+/* Refuses the options that need a second process. */
+static inline int
+kthreads_check(void)
+{
+  if (kopts.phases || kopts.tstamp || kopts.hist || kopts.schedtrace ||
+      kopts.power || kopts.place || kopts.cold || kopts.antagonist ||
+      kopts.hiccup || kopts.poll || kopts.busy_poll_us >= 0 ||
+      kopts.depth || kopts.trace || kopts.trace_loop || kopts.sizes ||
+      kopts.arrivals || kopts.chunk) {
+    fprintf(stderr, "threads: only --buf, --sched, --mlock, --numa and "
+            "--counters are supported in thread mode\n");
+    return -1;
+  }
+  return 0;
+}
+
+static inline void
+kthreads_read_full(int fd, char *buf, int size)
+{
+  ssize_t len;
+  int sofar;
+
+  for (sofar = 0; sofar < size; sofar += len) {
+    len = read(fd, buf + sofar, size - sofar);
+    if (len <= 0)
+      kthreads_die("read");
+  }
+}
+
+static inline void
+kthreads_write(int fd, char *buf, int size)
+{
+  if (write(fd, buf, size) != size)
+    kthreads_die("write");
+}
+
+/* Loopback socket bound to an ephemeral port; returns the fd. */
+static inline int
+kthreads_bound(int type, struct sockaddr_in *addr)
+{
+  socklen_t len = sizeof(*addr);
+  int fd;
+
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if ((fd = socket(AF_INET, type, 0)) == -1)
+    kthreads_die("socket");
+  if (bind(fd, (struct sockaddr *)addr, sizeof(*addr)) == -1)
+    kthreads_die("bind");
+  if (getsockname(fd, (struct sockaddr *)addr, &len) == -1)
+    kthreads_die("getsockname");
+  return fd;
+}
+
+static inline void
+kthreads_setup(struct kthreads *kt)
+{
+  struct sockaddr_in a, b;
+  int p[2], q[2], lfd;
+
+  switch (kt->transport) {
+  case KTHREADS_PIPE:
+    if (pipe(p) == -1 || pipe(q) == -1)
+      kthreads_die("pipe");
+    kt->wfd[KTHREADS_PARENT] = p[1];
+    kt->rfd[KTHREADS_CHILD] = p[0];
+    kt->wfd[KTHREADS_CHILD] = q[1];
+    kt->rfd[KTHREADS_PARENT] = q[0];
+    break;
+  case KTHREADS_UNIX:
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, p) == -1)
+      kthreads_die("socketpair");
+    kt->rfd[KTHREADS_PARENT] = kt->wfd[KTHREADS_PARENT] = p[0];
+    kt->rfd[KTHREADS_CHILD] = kt->wfd[KTHREADS_CHILD] = p[1];
+    break;
+  case KTHREADS_TCP:
+    lfd = kthreads_bound(SOCK_STREAM, &a);
+    if (listen(lfd, 1) == -1)
+      kthreads_die("listen");
+    if ((p[0] = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+      kthreads_die("socket");
+    if (connect(p[0], (struct sockaddr *)&a, sizeof(a)) == -1)
+      kthreads_die("connect");
+    if ((p[1] = accept(lfd, NULL, NULL)) == -1)
+      kthreads_die("accept");
+    close(lfd);
+    kt->rfd[KTHREADS_PARENT] = kt->wfd[KTHREADS_PARENT] = p[0];
+    kt->rfd[KTHREADS_CHILD] = kt->wfd[KTHREADS_CHILD] = p[1];
+    break;
+  default:
+    p[0] = kthreads_bound(SOCK_DGRAM, &a);
+    p[1] = kthreads_bound(SOCK_DGRAM, &b);
+    if (connect(p[0], (struct sockaddr *)&b, sizeof(b)) == -1 ||
+        connect(p[1], (struct sockaddr *)&a, sizeof(a)) == -1)
+      kthreads_die("connect");
+    kt->rfd[KTHREADS_PARENT] = kt->wfd[KTHREADS_PARENT] = p[0];
+    kt->rfd[KTHREADS_CHILD] = kt->wfd[KTHREADS_CHILD] = p[1];
+    break;
+  }
+}
+
+/* Pins the calling thread and sets up its buffer; returns the buffer. */
+static inline char *
+kthreads_side(struct kthreads *kt, int side)
+{
+  static const char *names[] = { "parent", "child" };
+  cpu_set_t set;
+  char *buf;
+  int err;
+
+  if (kt->cpu[side] >= 0) {
+    CPU_ZERO(&set);
+    CPU_SET(kt->cpu[side], &set);
+    if ((err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0) {
+      fprintf(stderr, "pthread_setaffinity_np of %s failed: %s\n", names[side],
+              strerror(err));
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (kt->mode == KTHREADS_LAT)
+    ksched_apply_side(side == KTHREADS_PARENT ? KSCHED_PARENT : KSCHED_CHILD);
+
+  if ((buf = kbuf_alloc(kt->size)) == NULL)
+    kthreads_die("kbuf_alloc");
+  memset(buf, 0, kt->size);
+  return knuma_buffer(buf, kt->size, side == KTHREADS_PARENT ? KNUMA_PARENT :
+                      KNUMA_CHILD, kt->cpu[side]);
+}
+
+static inline void *
+kthreads_child(void *arg)
+{
+  struct kthreads *kt = arg;
+  char *buf = kthreads_side(kt, KTHREADS_CHILD);
+  int fd = kt->rfd[KTHREADS_CHILD];
+  int64_t i;
+
+  pthread_barrier_wait(&kt->ready);
+  for (i = 0; i < kt->count; i++) {
+    if (kt->transport == KTHREADS_UDP) {
+      if (read(fd, buf, kt->size) != kt->size)
+        kthreads_die("read");
+    } else {
+      kthreads_read_full(fd, buf, kt->size);
+    }
+    if (kt->mode == KTHREADS_LAT)
+      kthreads_write(kt->wfd[KTHREADS_CHILD], buf, kt->size);
+  }
+  return NULL;
+}
+
+/*
+ * Runs the benchmark with both ends as threads and prints the same
+ * results as the fork()ed version. Returns the exit status for main().
+ */
+static inline int
+kthreads_run(int transport, int mode, int size, int64_t count,
+             int parentCPU, int childCPU)
+{
+  struct kthreads kt;
+  struct kcounters counters, *kc = NULL;
+  pthread_t child;
+  int64_t t0, delta, i;
+  char *buf;
+  int err;
+
+  if (kthreads_check() == -1)
+    return 1;
+  if (transport == KTHREADS_UDP && mode == KTHREADS_THR) {
+    fprintf(stderr, "threads: no udp throughput mode\n");
+    return 1;
+  }
+
+  memset(&kt, 0, sizeof(kt));
+  kt.transport = transport;
+  kt.mode = mode;
+  kt.size = size;
+  kt.count = count;
+  kt.cpu[KTHREADS_PARENT] = parentCPU;
+  kt.cpu[KTHREADS_CHILD] = childCPU;
+  kthreads_setup(&kt);
+  pthread_barrier_init(&kt.ready, NULL, 2);
+
+  printf("thread mode\n");
+  if (kopts.counters) {
+    kcounters_open(&counters);
+    kc = &counters;
+  }
+
+  if ((err = pthread_create(&child, NULL, kthreads_child, &kt)) != 0) {
+    fprintf(stderr, "pthread_create: %s\n", strerror(err));
+    return 1;
+  }
+  buf = kthreads_side(&kt, KTHREADS_PARENT);
+  pthread_barrier_wait(&kt.ready);
+
+  t0 = kutils_now_ns();
+  kcounters_enable(kc);
+  for (i = 0; i < count; i++) {
+    kthreads_write(kt.wfd[KTHREADS_PARENT], buf, size);
+    if (mode != KTHREADS_LAT)
+      continue;
+    if (transport == KTHREADS_UDP) {
+      if (read(kt.rfd[KTHREADS_PARENT], buf, size) != size)
+        kthreads_die("read");
+    } else {
+      kthreads_read_full(kt.rfd[KTHREADS_PARENT], buf, size);
+    }
+  }
+  kcounters_disable(kc);
+  delta = kutils_now_ns() - t0;
+
+  if (mode == KTHREADS_LAT) {
+    printf("average latency: %li ns\n", delta / (count * 2));
+  } else {
+    delta /= 1000;
+    printf("average throughput: %li msg/s\n", (count * 1000000) / delta);
+    printf("average throughput: %li Mb/s\n",
+           (((count * 1000000) / delta) * size * 8) / 1000000);
+  }
+
+  pthread_join(child, NULL);
+  if (kc != NULL)
+    kcounters_report(kc, count, mode == KTHREADS_LAT ? "per roundtrip" :
+                     "per message");
+  return 0;
+}
+
+#endif //KThreads_H
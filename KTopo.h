@@ -0,0 +1,261 @@
+#ifndef KTopo_H
+#define KTopo_H
+
+/*
+ * CPU topology from /sys/devices/system/cpu.
+ *
+ * Every online CPU gets a key per level: the first CPU of its SMT sibling
+ * list (core), of its cluster, of the CPUs sharing its last level cache,
+ * plus its package and NUMA node ids. Two CPUs share a level when the keys
+ * match, which is all the placement sweep needs to pick representative
+ * pairs. Missing sysfs files (older kernels, no cluster level) read as -1.
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct ktopo_cpu
+{
+  int cpu;
+  int core;               /* first CPU of thread_siblings_list */
+  int cluster;            /* first CPU of cluster_cpus_list */
+  int llc;                /* first CPU sharing the last level cache */
+  int llc_level;
+  int package;            /* physical_package_id */
+  int node;               /* NUMA node */
+};
+
+struct ktopo
+{
+  int n;
+  struct ktopo_cpu *cpus;
+};
+
+typedef enum ktopo_rel_t
+{
+ KTOPO_SAME_CPU = 0,
+ KTOPO_SMT,
+ KTOPO_SAME_LLC,
+ KTOPO_CROSS_LLC,
+ KTOPO_CROSS_SOCKET,
+ KTOPO_NREL
+}ktopo_rel;
+
+static inline const char *
+ktopo_rel_name(ktopo_rel rel)
+{
+  static const char *names[KTOPO_NREL] =
+  {
+    "same cpu", "smt sibling", "same llc", "cross llc", "cross socket",
+  };
+
+  return names[rel];
+}
+
+static inline int
+ktopo_read_first(const char *path)
+{
+  FILE *f = fopen(path, "r");
+  int v = -1;
+
+  if (f == NULL)
+    return -1;
+  if (fscanf(f, "%d", &v) != 1)
+    v = -1;
+  fclose(f);
+  return v;
+}
+
+static inline int
+ktopo_read_str(const char *path, char *out, size_t len)
+{
+  FILE *f = fopen(path, "r");
+
+  if (f == NULL)
+    return -1;
+  if (fgets(out, len, f) == NULL) {
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+  return 0;
+}
+
+/* Expands a sysfs cpu list ("0-3,8,10-11") into a 0/1 map of max entries. */
+static inline int
+ktopo_parse_list(const char *list, char *map, int max)
+{
+  const char *p = list;
+  char *end;
+  long lo, hi, c;
+  int n = 0;
+
+  memset(map, 0, max);
+  while (*p) {
+    lo = strtol(p, &end, 10);
+    if (end == p)
+      break;
+    hi = lo;
+    if (*end == '-')
+      hi = strtol(end + 1, &end, 10);
+    for (c = lo; c <= hi && c < max; c++) {
+      map[c] = 1;
+      n++;
+    }
+    p = *end == ',' ? end + 1 : end;
+    if (*p == '\n')
+      break;
+  }
+  return n;
+}
+
+/* NUMA node of a CPU, from its cpuN/nodeM link; -1 without NUMA support. */
+static inline int
+ktopo_node_of(int cpu)
+{
+  char path[64];
+  struct dirent *de;
+  int node = -1;
+  DIR *d;
+
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+  if ((d = opendir(path)) == NULL)
+    return -1;
+  while ((de = readdir(d)) != NULL)
+    if (strncmp(de->d_name, "node", 4) == 0 &&
+        de->d_name[4] >= '0' && de->d_name[4] <= '9')
+      node = atoi(de->d_name + 4);
+  closedir(d);
+  return node;
+}
+
+static inline void
+ktopo_read_cpu(struct ktopo_cpu *c)
+{
+  char path[160], type[32];
+  int idx, level;
+
+  c->core = c->cluster = c->llc = c->package = c->node = -1;
+  c->llc_level = 0;
+
+#define KTOPO_PATH(fmt, ...) \
+  (snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/" fmt, \
+            c->cpu, ##__VA_ARGS__), path)
+
+  c->core = ktopo_read_first(KTOPO_PATH("topology/thread_siblings_list"));
+  c->cluster = ktopo_read_first(KTOPO_PATH("topology/cluster_cpus_list"));
+  c->package = ktopo_read_first(KTOPO_PATH("topology/physical_package_id"));
+
+  for (idx = 0; ; idx++) {
+    level = ktopo_read_first(KTOPO_PATH("cache/index%d/level", idx));
+    if (level < 0)
+      break;
+    if (ktopo_read_str(KTOPO_PATH("cache/index%d/type", idx), type,
+                       sizeof(type)) == 0 && strncmp(type, "Instruction", 11) == 0)
+      continue;
+    if (level >= c->llc_level) {
+      c->llc_level = level;
+      c->llc = ktopo_read_first(KTOPO_PATH("cache/index%d/shared_cpu_list", idx));
+    }
+  }
+
+#undef KTOPO_PATH
+
+  c->node = ktopo_node_of(c->cpu);
+
+  /* no SMT / cache information: every CPU is its own core */
+  if (c->core < 0)
+    c->core = c->cpu;
+}
+
+static inline int
+ktopo_discover(struct ktopo *t)
+{
+  char list[4096], *map;
+  int max = 8192, c;
+
+  t->n = 0;
+  t->cpus = NULL;
+  if (ktopo_read_str("/sys/devices/system/cpu/online", list, sizeof(list)) == -1) {
+    perror("/sys/devices/system/cpu/online");
+    return -1;
+  }
+
+  map = malloc(max);
+  t->cpus = calloc(max, sizeof(struct ktopo_cpu));
+  if (map == NULL || t->cpus == NULL) {
+    perror("malloc");
+    free(map);
+    return -1;
+  }
+
+  ktopo_parse_list(list, map, max);
+  for (c = 0; c < max; c++) {
+    if (!map[c])
+      continue;
+    t->cpus[t->n].cpu = c;
+    ktopo_read_cpu(&t->cpus[t->n]);
+    t->n++;
+  }
+  free(map);
+  return 0;
+}
+
+static inline const struct ktopo_cpu *
+ktopo_find(const struct ktopo *t, int cpu)
+{
+  int i;
+
+  for (i = 0; i < t->n; i++)
+    if (t->cpus[i].cpu == cpu)
+      return &t->cpus[i];
+  return NULL;
+}
+
+static inline ktopo_rel
+ktopo_relation(const struct ktopo_cpu *a, const struct ktopo_cpu *b)
+{
+  if (a->cpu == b->cpu)
+    return KTOPO_SAME_CPU;
+  if (a->core == b->core)
+    return KTOPO_SMT;
+  if (a->llc >= 0 && a->llc == b->llc)
+    return KTOPO_SAME_LLC;
+  if (a->package == b->package)
+    return KTOPO_CROSS_LLC;
+  return KTOPO_CROSS_SOCKET;
+}
+
+/* Returns the first CPU that has relation rel to base, or -1. */
+static inline int
+ktopo_pick(const struct ktopo *t, int base, ktopo_rel rel)
+{
+  const struct ktopo_cpu *b = ktopo_find(t, base);
+  int i;
+
+  if (b == NULL)
+    return -1;
+  for (i = 0; i < t->n; i++)
+    if (ktopo_relation(b, &t->cpus[i]) == rel)
+      return t->cpus[i].cpu;
+  return -1;
+}
+
+static inline void
+ktopo_print(const struct ktopo *t)
+{
+  const struct ktopo_cpu *c;
+  int i;
+
+  printf("%5s %6s %8s %6s %8s %5s\n", "cpu", "core", "cluster", "llc",
+         "package", "node");
+  for (i = 0; i < t->n; i++) {
+    c = &t->cpus[i];
+    printf("%5d %6d %8d %4d/L%d %8d %5d\n", c->cpu, c->core, c->cluster,
+           c->llc, c->llc_level, c->package, c->node);
+  }
+}
+
+#endif //KTopo_H
@@ -0,0 +1,561 @@
+#ifndef KTrace_H
+#define KTrace_H
+
+/*
+ * Trace replay (--trace, --trace-loop).
+ *
+ * The latency loop sends one fixed size message back to back. With
+ * --trace=<file> the benchmark runs one more pass after it that replays a
+ * recorded trace instead: request i is <size> octets, the child answers it
+ * with <response> octets (0: echo <size>) and it is sent <gap> ns after
+ * request i - 1.
+ *
+ * A trace is a binary file of a 16 octet header ("KTRACE1\n" and the
+ * record count as a native uint64_t) followed by one struct ktrace_rec per
+ * request, and is mmap()ed before fork() so both sides walk the same
+ * records. A file ending in .csv holds "<gap ns>,<size>[,<response>]"
+ * lines ('#' starts a comment); it is converted once to <file>.ktrace,
+ * which is reused as long as it is newer than the CSV. Without a file,
+ * --sizes and --arrivals draw a trace of <roundtrip-count> requests from
+ * distributions instead (KDist.h).
+ *
+ * --trace-loop=closed (the default) sends a request once the previous
+ * reply is in and its gap has passed since the previous send, the client
+ * of an RPC library. --trace-loop=open sends every request at its time in
+ * the trace whether or not replies are outstanding, the arrivals of many
+ * independent clients; latency is then counted from the scheduled send
+ * time, so a backlog is charged to the requests queued behind it, and the
+ * lag of the actual sends behind the schedule is reported as well.
+ *
+ * The parent's fds are non-blocking and it waits in ppoll() for replies,
+ * room to write or the next send time. Buffers for the largest request and
+ * reply are allocated and touched before the pass. Latency is reported per
+ * power of two bucket of the larger of request and reply size.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include "KUtils.h"
+#include "KStats.h"
+#include "KDist.h"
+
+#define KTRACE_MAGIC "KTRACE1\n"
+#define KTRACE_DGRAM_MAX 65507
+#define KTRACE_TIMEOUT_MS 1000          /* a datagram is lost */
+#define KTRACE_BUCKETS 32
+
+struct ktrace_rec
+{
+  uint64_t gap_ns;                /* since the previous request */
+  uint32_t size;                  /* request octets */
+  uint32_t response;              /* reply octets, 0: size */
+};
+
+struct ktrace
+{
+  const char *path;
+  int open;                       /* open loop */
+  int dgram;                      /* one message per read */
+  int64_t n;                      /* records, 0: off */
+  const struct ktrace_rec *rec;   /* mmap()ed */
+  int64_t span_ns;                /* sum of the gaps */
+  int64_t max_gap_ns;
+  char *wbuf, *rbuf;
+  size_t wcap, rcap;
+  int64_t *t_send, *lat, *lag;    /* per request, lat -1: lost */
+  int64_t lost;
+};
+
+static inline uint32_t
+ktrace_resp(const struct ktrace_rec *r)
+{
+  return r->response ? r->response : r->size;
+}
+
+/* Converts the CSV trace csv to the binary trace bin. */
+static inline int
+ktrace_convert(const char *csv, const char *bin)
+{
+  struct ktrace_rec r;
+  char line[256], *p;
+  uint64_t n = 0;
+  unsigned long long gap;
+  unsigned size, resp;
+  FILE *in, *out;
+  int f, lineno = 0;
+
+  if ((in = fopen(csv, "r")) == NULL) {
+    perror(csv);
+    return -1;
+  }
+  if ((out = fopen(bin, "w")) == NULL) {
+    perror(bin);
+    fclose(in);
+    return -1;
+  }
+  fwrite(KTRACE_MAGIC, 8, 1, out);
+  fwrite(&n, sizeof(n), 1, out);
+
+  while (fgets(line, sizeof(line), in) != NULL) {
+    lineno++;
+    if ((p = strchr(line, '#')) != NULL)
+      *p = '\0';
+    resp = 0;
+    f = sscanf(line, "%llu,%u,%u", &gap, &size, &resp);
+    if (f <= 0)
+      continue;                   /* blank, comment or header line */
+    if (f < 2 || size == 0) {
+      fprintf(stderr, "trace: %s:%d: expected <gap ns>,<size>[,<response>]\n",
+              csv, lineno);
+      goto fail;
+    }
+    r.gap_ns = gap;
+    r.size = size;
+    r.response = resp;
+    fwrite(&r, sizeof(r), 1, out);
+    n++;
+  }
+
+  fseek(out, 8, SEEK_SET);
+  fwrite(&n, sizeof(n), 1, out);
+  if (ferror(out) || fclose(out) != 0) {
+    perror(bin);
+    fclose(in);
+    unlink(bin);
+    return -1;
+  }
+  fclose(in);
+  printf("trace: converted %s to %s, %" PRIu64 " requests\n", csv, bin, n);
+  return 0;
+
+fail:
+  fclose(in);
+  fclose(out);
+  unlink(bin);
+  return -1;
+}
+
+/* mmap()s the binary trace path; returns -1 with a message. */
+static inline int
+ktrace_map(struct ktrace *kt, const char *path)
+{
+  struct stat st;
+  uint64_t n;
+  char *map;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+    perror(path);
+    return -1;
+  }
+  if (st.st_size < 16) {
+    fprintf(stderr, "trace: %s is not a trace\n", path);
+    return -1;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror("mmap");
+    return -1;
+  }
+  memcpy(&n, map + 8, sizeof(n));
+  if (memcmp(map, KTRACE_MAGIC, 8) != 0 ||
+      (uint64_t)st.st_size != 16 + n * sizeof(struct ktrace_rec) || n == 0) {
+    fprintf(stderr, "trace: %s is not a trace or holds no requests\n", path);
+    return -1;
+  }
+  kt->rec = (const struct ktrace_rec *)(map + 16);
+  kt->n = n;
+  return 0;
+}
+
+/*
+ * Draws n requests from --sizes and --arrivals, sizes clamped to lo..hi,
+ * and prints the realized distributions.
+ */
+static inline int
+ktrace_synth(struct ktrace *kt, int size, int64_t n, uint32_t lo, uint32_t hi)
+{
+  struct kdist sizes, gaps;
+  struct kstats_summary s;
+  struct ktrace_rec *rec;
+  int64_t i, *tmp;
+  double d;
+
+  if (kdist_parse(&sizes, kopts.sizes, size) == -1 ||
+      (kopts.arrivals != NULL &&
+       kdist_parse_arrivals(&gaps, kopts.arrivals) == -1))
+    return -1;
+  kdist_seed(&sizes, kopts.seed);
+  kdist_seed(&gaps, ~kopts.seed);
+
+  rec = malloc(n * sizeof(*rec));
+  tmp = malloc(n * sizeof(int64_t));
+  if (rec == NULL || tmp == NULL) {
+    perror("malloc");
+    return -1;
+  }
+  for (i = 0; i < n; i++) {
+    d = kdist_draw(&sizes);
+    rec[i].size = d < lo ? lo : d > hi ? hi : (uint32_t)d;
+    rec[i].response = kopts.response;
+    rec[i].gap_ns = kopts.arrivals != NULL ? kdist_draw(&gaps) : 0;
+  }
+  kt->rec = rec;
+  kt->n = n;
+
+  printf("synthetic trace: sizes %s, arrivals %s, seed %" PRIu64 "\n",
+         kopts.sizes ? kopts.sizes : "fixed",
+         kopts.arrivals ? kopts.arrivals : "back to back", kopts.seed);
+  kstats_print_header("drawn");
+  for (i = 0; i < n; i++)
+    tmp[i] = rec[i].size;
+  kstats_summarize(tmp, n, &s);
+  kstats_print_row("size (octets)", &s);
+  if (kopts.arrivals != NULL) {
+    for (i = 0; i < n; i++)
+      tmp[i] = rec[i].gap_ns;
+    kstats_summarize(tmp, n, &s);
+    kstats_print_row("gap (ns)", &s);
+  }
+  fflush(stdout);                 /* before fork() */
+  free(tmp);
+  kdist_free(&sizes);
+  return 0;
+}
+
+/*
+ * Parses --trace, --trace-loop, --sizes and --arrivals, loads or draws
+ * the trace and allocates the buffers; call before fork(). size and count
+ * are the benchmark's, dgram is set for datagram transports. Returns -1
+ * with a message.
+ */
+static inline int
+ktrace_parse(struct ktrace *kt, int size, int64_t count, int dgram)
+{
+  struct stat sc, sb;
+  char bin[512];
+  const char *path;
+  size_t len;
+  int64_t i;
+
+  memset(kt, 0, sizeof(*kt));
+  kt->dgram = dgram;
+  if (kopts.trace_loop != NULL && strcmp(kopts.trace_loop, "closed") != 0) {
+    if (strcmp(kopts.trace_loop, "open") != 0) {
+      fprintf(stderr, "trace-loop: closed or open\n");
+      return -1;
+    }
+    kt->open = 1;
+  }
+  /* thread mode refuses these in kthreads_check(), draw nothing for it */
+  if ((kopts.trace == NULL && kopts.sizes == NULL && kopts.arrivals == NULL) ||
+      kopts.threads)
+    return 0;
+
+  if (kopts.trace == NULL) {
+    if (ktrace_synth(kt, size, count, dgram ? 8 : 1,
+                     dgram ? KTRACE_DGRAM_MAX : 0xffffffffu) == -1)
+      return -1;
+    kt->path = "synthetic";
+    goto loaded;
+  }
+  if (kopts.sizes != NULL || kopts.arrivals != NULL) {
+    fprintf(stderr, "trace: --sizes and --arrivals draw a trace, not with "
+            "--trace\n");
+    return -1;
+  }
+
+  path = kopts.trace;
+  len = strlen(path);
+  if (len > 4 && strcmp(path + len - 4, ".csv") == 0) {
+    snprintf(bin, sizeof(bin), "%s.ktrace", path);
+    if (stat(path, &sc) == -1) {
+      perror(path);
+      return -1;
+    }
+    if ((stat(bin, &sb) == -1 || sb.st_mtime < sc.st_mtime) &&
+        ktrace_convert(path, bin) == -1)
+      return -1;
+    path = bin;
+  }
+  if (ktrace_map(kt, path) == -1)
+    return -1;
+  kt->path = kopts.trace;
+
+loaded:
+  for (i = 0; i < kt->n; i++) {
+    if (kt->rec[i].size == 0 ||
+        (dgram && (kt->rec[i].size > KTRACE_DGRAM_MAX ||
+                   ktrace_resp(&kt->rec[i]) > KTRACE_DGRAM_MAX ||
+                   kt->rec[i].size < 8 || ktrace_resp(&kt->rec[i]) < 8))) {
+      fprintf(stderr, "trace: request %" PRId64 " has a bad size (8 to %d "
+              "octets over udp)\n", i, KTRACE_DGRAM_MAX);
+      return -1;
+    }
+    if (kt->rec[i].size > kt->wcap)
+      kt->wcap = kt->rec[i].size;
+    if (ktrace_resp(&kt->rec[i]) > kt->rcap)
+      kt->rcap = ktrace_resp(&kt->rec[i]);
+    if (i > 0)
+      kt->span_ns += kt->rec[i].gap_ns;
+    if (i > 0 && (int64_t)kt->rec[i].gap_ns > kt->max_gap_ns)
+      kt->max_gap_ns = kt->rec[i].gap_ns;
+  }
+  if (kt->wcap > kt->rcap)
+    kt->rcap = kt->wcap;          /* the child reads into rbuf too */
+
+  kt->wbuf = malloc(kt->wcap);
+  kt->rbuf = malloc(kt->rcap);
+  kt->t_send = malloc(kt->n * sizeof(int64_t));
+  kt->lat = malloc(kt->n * sizeof(int64_t));
+  kt->lag = malloc(kt->n * sizeof(int64_t));
+  if (kt->wbuf == NULL || kt->rbuf == NULL || kt->t_send == NULL ||
+      kt->lat == NULL || kt->lag == NULL) {
+    perror("malloc");
+    return -1;
+  }
+  memset(kt->wbuf, 0, kt->wcap);
+  memset(kt->rbuf, 0, kt->rcap);
+  memset(kt->t_send, 0, kt->n * sizeof(int64_t));
+  memset(kt->lat, 0, kt->n * sizeof(int64_t));
+  memset(kt->lag, 0, kt->n * sizeof(int64_t));
+  return 0;
+}
+
+/*
+ * Child: answers every request of the trace in order. A datagram names
+ * its request in its first 8 octets, so lost requests are skipped; the
+ * child stops after the last one or once no request came for longer than
+ * the longest gap of the trace and the parent's reply timeout.
+ */
+static inline int
+ktrace_child(struct ktrace *kt, int rfd, int wfd)
+{
+  struct timeval tv;
+  uint32_t size, resp, sofar;
+  ssize_t len;
+  int64_t i;
+
+  tv.tv_sec = kt->max_gap_ns / 1000000000 + 2 * KTRACE_TIMEOUT_MS / 1000;
+  tv.tv_usec = 0;
+  if (kt->dgram &&
+      setsockopt(rfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1) {
+    perror("setsockopt");
+    return -1;
+  }
+
+  for (i = 0; i < kt->n; i++) {
+    if (kt->dgram) {
+      len = read(rfd, kt->rbuf, kt->rcap);
+      if (len == -1 && errno == EAGAIN)
+        return 0;
+      memcpy(&i, kt->rbuf, sizeof(i));
+      if (len < (ssize_t)sizeof(i) || i < 0 || i >= kt->n ||
+          len != kt->rec[i].size) {
+        fprintf(stderr, "trace: bad request datagram\n");
+        return -1;
+      }
+    } else {
+      size = kt->rec[i].size;
+      for (sofar = 0; sofar < size; sofar += len) {
+        len = read(rfd, kt->rbuf + sofar, size - sofar);
+        if (len <= 0) {
+          perror("trace: read");
+          return -1;
+        }
+      }
+    }
+    resp = ktrace_resp(&kt->rec[i]);
+    if (write(wfd, kt->rbuf, resp) != resp) {
+      perror("trace: write");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Parent: replays the trace once; fills t_send, lat and lag. */
+static inline int
+ktrace_pass(struct ktrace *kt, int wfd, int rfd)
+{
+  int64_t sent = 0, done = 0, t0, now, due, next_at = 0, wait, seq;
+  size_t woff = 0, wlen = 0, p, take, need;
+  struct pollfd pfd[2];
+  struct timespec ts, *tsp;
+  ssize_t len;
+  int npfd, ret;
+
+  need = ktrace_resp(&kt->rec[0]);
+  t0 = kutils_now_ns();
+  while (done < kt->n) {
+    /* start the next request once it is due */
+    due = -1;
+    if (woff == wlen && sent < kt->n) {
+      if (kt->open)
+        due = t0 + next_at;
+      else if (sent == done)
+        due = sent == 0 ? t0 : kt->t_send[sent - 1] + kt->rec[sent].gap_ns;
+      now = kutils_now_ns();
+      if (due >= 0 && due <= now) {
+        kt->t_send[sent] = kt->open ? due : now;
+        kt->lag[sent] = now - due;
+        if (kt->dgram)
+          memcpy(kt->wbuf, &sent, sizeof(sent));
+        woff = 0;
+        wlen = kt->rec[sent].size;
+        if (++sent < kt->n)
+          next_at += kt->rec[sent].gap_ns;
+        due = -1;
+      }
+    }
+    if (woff < wlen) {
+      len = write(wfd, kt->wbuf + woff, wlen - woff);
+      if (len == -1 && errno != EAGAIN) {
+        perror("trace: write");
+        return -1;
+      }
+      if (len > 0)
+        woff += len;
+    }
+
+    len = read(rfd, kt->rbuf, kt->rcap);
+    if (len == 0 || (len == -1 && errno != EAGAIN)) {
+      perror("trace: read");
+      return -1;
+    }
+    if (len > 0) {
+      now = kutils_now_ns();
+      if (kt->dgram) {
+        memcpy(&seq, kt->rbuf, sizeof(seq));
+        if (len < (ssize_t)sizeof(seq) || seq < done || seq >= sent ||
+            len != ktrace_resp(&kt->rec[seq])) {
+          fprintf(stderr, "trace: bad reply datagram\n");
+          return -1;
+        }
+        /* replies come back in order, the ones skipped are lost */
+        for (; done < seq; done++, kt->lost++)
+          kt->lat[done] = -1;
+        need = len;
+      }
+      /* a stream read may end, span or complete several replies */
+      for (p = 0; p < (size_t)len && done < kt->n; p += take) {
+        take = (size_t)len - p < need ? (size_t)len - p : need;
+        need -= take;
+        if (need > 0)
+          continue;
+        kt->lat[done] = now - kt->t_send[done];
+        if (++done < kt->n)
+          need = ktrace_resp(&kt->rec[done]);
+      }
+      continue;
+    }
+
+    /* nothing to read: wait for a reply, room to write or the next send */
+    pfd[0].fd = rfd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = wfd;
+    pfd[1].events = POLLOUT;
+    npfd = woff < wlen ? 2 : 1;
+    tsp = NULL;
+    if (due >= 0) {
+      wait = due - kutils_now_ns();
+      if (wait <= 0)
+        continue;
+      ts.tv_sec = wait / 1000000000;
+      ts.tv_nsec = wait % 1000000000;
+      tsp = &ts;
+    } else if (kt->dgram) {
+      ts.tv_sec = KTRACE_TIMEOUT_MS / 1000;
+      ts.tv_nsec = 0;
+      tsp = &ts;
+    }
+    ret = ppoll(pfd, npfd, tsp, NULL);
+    if (ret == -1 && errno != EINTR) {
+      perror("ppoll");
+      return -1;
+    }
+    /* no datagram for the timeout: what is outstanding is lost */
+    for (; ret == 0 && due < 0 && done < sent; done++, kt->lost++)
+      kt->lat[done] = -1;
+  }
+  return 0;
+}
+
+/* Parent: runs the replay pass and prints latency by size bucket. */
+static inline int
+ktrace_parent(struct ktrace *kt, int wfd, int rfd)
+{
+  struct kstats_summary s;
+  int64_t t0, delta, i, k, *tmp;
+  uint32_t big;
+  int b, bucket;
+  char label[32];
+
+  if (fcntl(wfd, F_SETFL, fcntl(wfd, F_GETFL) | O_NONBLOCK) == -1 ||
+      fcntl(rfd, F_SETFL, fcntl(rfd, F_GETFL) | O_NONBLOCK) == -1) {
+    perror("fcntl");
+    return -1;
+  }
+
+  t0 = kutils_now_ns();
+  if (ktrace_pass(kt, wfd, rfd) == -1)
+    return -1;
+  delta = kutils_now_ns() - t0;
+
+  printf("trace %s: %" PRId64 " requests, %s loop\n", kt->path, kt->n,
+         kt->open ? "open" : "closed");
+  if (kt->span_ns > 0)
+    printf("trace rate: %.0f req/s, ", kt->n / (kt->span_ns / 1e9));
+  printf("replayed: %.0f req/s\n", kt->n / (delta / 1e9));
+  if (kt->dgram)
+    printf("lost: %" PRId64 " requests\n", kt->lost);
+
+  if ((tmp = malloc(kt->n * sizeof(int64_t))) == NULL) {
+    perror("malloc");
+    return -1;
+  }
+  kstats_print_header("trace latency (ns)");
+  for (b = 0; b < KTRACE_BUCKETS; b++) {
+    for (i = 0, k = 0; i < kt->n; i++) {
+      big = kt->rec[i].size > ktrace_resp(&kt->rec[i]) ? kt->rec[i].size :
+            ktrace_resp(&kt->rec[i]);
+      for (bucket = 0; big > 1; big >>= 1)
+        bucket++;
+      if (bucket == b && kt->lat[i] >= 0)
+        tmp[k++] = kt->lat[i];
+    }
+    if (k == 0)
+      continue;
+    kstats_summarize(tmp, k, &s);
+    snprintf(label, sizeof(label), "%u-%u octets", 1u << b,
+             b == 31 ? 0xffffffffu : (2u << b) - 1);
+    kstats_print_row(label, &s);
+  }
+  for (i = 0, k = 0; i < kt->n; i++)
+    if (kt->lat[i] >= 0)
+      tmp[k++] = kt->lat[i];
+  kstats_summarize(tmp, k, &s);
+  kstats_print_row("all", &s);
+  if (kt->open) {
+    memcpy(tmp, kt->lag, kt->n * sizeof(int64_t));
+    kstats_summarize(tmp, kt->n, &s);
+    kstats_print_row("send lag", &s);
+  }
+  free(tmp);
+  return 0;
+}
+
+#endif //KTrace_H
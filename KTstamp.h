@@ -0,0 +1,273 @@
+#ifndef KTstamp_H
+#define KTstamp_H
+
+/*
+ * Kernel software timestamps for socket benchmarks (--tstamp).
+ *
+ * SO_TIMESTAMPING is enabled with TX_SOFTWARE / RX_SOFTWARE plus OPT_ID and
+ * OPT_TSONLY, which gives four stamps per message, all on CLOCK_REALTIME:
+ *
+ *   t_send   sender, before write()/sendto()
+ *   t_tx     kernel, skb handed to the (loopback) device, read back from
+ *            the sender's error queue
+ *   t_rx     kernel, skb entering the receive path, delivered as a
+ *            SCM_TIMESTAMPING cmsg by recvmsg()
+ *   t_recv   receiver, after the whole message was returned
+ *
+ * t_rx - t_send is time spent in the kernel network stack, t_recv - t_rx is
+ * protocol delivery plus waiting for the receiving task to be scheduled and
+ * copy the data out. Only hops with all four stamps are reported.
+ *
+ * As in KPhase.h, hops[2 * i] is parent->child and hops[2 * i + 1] the
+ * reply, kept in a MAP_SHARED mapping set up before fork().
+ */
+
+#include <errno.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include "KStats.h"
+
+#ifndef SO_TIMESTAMPING
+#define SO_TIMESTAMPING 37
+#endif
+
+#define KTSTAMP_FLAGS (SOF_TIMESTAMPING_TX_SOFTWARE |   \
+                       SOF_TIMESTAMPING_RX_SOFTWARE |   \
+                       SOF_TIMESTAMPING_SOFTWARE |      \
+                       SOF_TIMESTAMPING_OPT_ID |        \
+                       SOF_TIMESTAMPING_OPT_TSONLY)
+
+struct ktstamp_hop
+{
+  int64_t t_send;
+  int64_t t_tx;
+  int64_t t_rx;
+  int64_t t_recv;
+};
+
+struct ktstamp
+{
+  struct ktstamp_hop *hops;
+  int64_t nhops;
+  int dir;                /* 0 in the parent, 1 in the child */
+  int64_t tx_seen;        /* TX stamps drained by this process */
+};
+
+static inline int64_t
+ktstamp_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline int
+ktstamp_init(struct ktstamp *ts, int64_t count)
+{
+  size_t len = 2 * count * sizeof(struct ktstamp_hop);
+
+  ts->hops = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (ts->hops == MAP_FAILED) {
+    perror("mmap");
+    return -1;
+  }
+  ts->nhops = 2 * count;
+  ts->dir = 0;
+  ts->tx_seen = 0;
+  return 0;
+}
+
+/* Called on every socket that sends or receives; dir tells which side. */
+static inline int
+ktstamp_enable(struct ktstamp *ts, int fd, int dir)
+{
+  int flags = KTSTAMP_FLAGS;
+
+  if (ts == NULL)
+    return 0;
+  ts->dir = dir;
+  if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == -1) {
+    perror("setsockopt SO_TIMESTAMPING");
+    return -1;
+  }
+  return 0;
+}
+
+static inline const struct scm_timestamping *
+ktstamp_find_cmsg(struct msghdr *msg)
+{
+  struct cmsghdr *cm;
+
+  for (cm = CMSG_FIRSTHDR(msg); cm != NULL; cm = CMSG_NXTHDR(msg, cm)) {
+    if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_TIMESTAMPING)
+      return (const struct scm_timestamping *)CMSG_DATA(cm);
+  }
+  return NULL;
+}
+
+static inline void
+ktstamp_send_begin(struct ktstamp *ts, int64_t hop)
+{
+  if (ts == NULL)
+    return;
+  ts->hops[hop].t_send = ktstamp_now();
+}
+
+/*
+ * Drains TX stamps from the error queue. Stamps come back in send order, so
+ * the n-th one of this process belongs to hop 2 * n + dir. With wait set,
+ * keeps polling until every sent message has its stamp (or 100 ms pass).
+ */
+static inline void
+ktstamp_drain_tx(struct ktstamp *ts, int fd, int wait)
+{
+  char control[256];
+  struct msghdr msg;
+  struct pollfd pfd;
+  const struct scm_timestamping *tss;
+
+  if (ts == NULL)
+    return;
+
+  for (;;) {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+      if (errno == EINTR)
+        continue;
+      if (!wait || ts->tx_seen >= ts->nhops / 2)
+        return;
+      pfd.fd = fd;
+      pfd.events = 0;         /* POLLERR is always reported */
+      if (poll(&pfd, 1, 100) <= 0)
+        return;
+      continue;
+    }
+
+    tss = ktstamp_find_cmsg(&msg);
+    if (tss != NULL && 2 * ts->tx_seen + ts->dir < ts->nhops) {
+      ts->hops[2 * ts->tx_seen + ts->dir].t_tx =
+          (int64_t)tss->ts[0].tv_sec * 1000000000 + tss->ts[0].tv_nsec;
+      ts->tx_seen++;
+    }
+  }
+}
+
+/*
+ * recvfrom() that also picks up the RX software stamp of the message. Falls
+ * back to a plain recvfrom() when timestamping is off.
+ */
+static inline ssize_t
+ktstamp_recvfrom(struct ktstamp *ts, int fd, void *buf, size_t len,
+                 struct sockaddr *addr, socklen_t *addrlen, int64_t hop)
+{
+  char control[256];
+  struct msghdr msg;
+  struct iovec iov;
+  const struct scm_timestamping *tss;
+  ssize_t ret;
+
+  if (ts == NULL)
+    return recvfrom(fd, buf, len, 0, addr, addrlen);
+
+  iov.iov_base = buf;
+  iov.iov_len = len;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = addr;
+  msg.msg_namelen = addrlen ? *addrlen : 0;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  ret = recvmsg(fd, &msg, 0);
+  if (ret == -1)
+    return ret;
+  if (addrlen)
+    *addrlen = msg.msg_namelen;
+
+  tss = ktstamp_find_cmsg(&msg);
+  if (tss != NULL)
+    ts->hops[hop].t_rx =
+        (int64_t)tss->ts[0].tv_sec * 1000000000 + tss->ts[0].tv_nsec;
+  return ret;
+}
+
+static inline void
+ktstamp_recv_end(struct ktstamp *ts, int64_t hop)
+{
+  if (ts == NULL)
+    return;
+  ts->hops[hop].t_recv = ktstamp_now();
+}
+
+static inline void
+ktstamp_report_dir(struct ktstamp *ts, const char *label, int64_t first,
+                   int64_t step, int64_t *tmp, int64_t n)
+{
+  static const char *names[] = { "tx stack", "device+rx irq",
+                                 "rx delivery+sched", "total" };
+  struct kstats_summary s[4];
+  struct ktstamp_hop *h;
+  int64_t c, i, m;
+
+  for (c = 0; c < 4; c++) {
+    for (i = 0, m = 0; i < n; i++) {
+      h = &ts->hops[first + i * step];
+      if (!h->t_send || !h->t_tx || !h->t_rx || !h->t_recv)
+        continue;
+      switch (c) {
+      case 0: tmp[m++] = h->t_tx - h->t_send; break;
+      case 1: tmp[m++] = h->t_rx - h->t_tx; break;
+      case 2: tmp[m++] = h->t_recv - h->t_rx; break;
+      default: tmp[m++] = h->t_recv - h->t_send; break;
+      }
+    }
+    kstats_summarize(tmp, m, &s[c]);
+  }
+
+  printf("%s (%" PRId64 " of %" PRId64 " hops stamped)\n", label, s[3].n, n);
+  for (c = 0; c < 4; c++) {
+    char row[40];
+
+    snprintf(row, sizeof(row), "  %-17s %5.1f%%", names[c],
+             s[3].avg ? 100.0 * s[c].avg / s[3].avg : 0.0);
+    kstats_print_row(row, &s[c]);
+  }
+  if (s[3].avg)
+    printf("  in kernel stack %.1f%%, waiting for receiver %.1f%%\n",
+           100.0 * (s[0].avg + s[1].avg) / s[3].avg,
+           100.0 * s[2].avg / s[3].avg);
+}
+
+static inline void
+ktstamp_report(struct ktstamp *ts, const char *transport)
+{
+  int64_t *tmp = malloc(ts->nhops * sizeof(int64_t));
+
+  if (tmp == NULL) {
+    perror("malloc");
+    return;
+  }
+
+  printf("kernel software timestamps (%s), ns per hop:\n", transport);
+  kstats_print_header("  component         share");
+  ktstamp_report_dir(ts, "parent->child", 0, 2, tmp, ts->nhops / 2);
+  ktstamp_report_dir(ts, "child->parent", 1, 2, tmp, ts->nhops / 2);
+  ktstamp_report_dir(ts, "both directions", 0, 1, tmp, ts->nhops);
+
+  free(tmp);
+}
+
+#endif //KTstamp_H
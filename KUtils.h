@@ -1,6 +1,7 @@
 #ifndef KUtils_H
 #define KUtils_H
 
+#include <getopt.h>
 #include <inttypes.h>
 #include <linux/perf_event.h>
 #include <sched.h>
@@ -8,6 +9,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
 #include <unistd.h>
 #include <asm/unistd.h>
 
@@ -39,6 +42,422 @@ using get_time = chrono::steady_clock;
 #define DEBUG(x) do {} while (0)
 #endif
 
+/* CLOCK_MONOTONIC is system wide, so stamps taken by the parent and the
+ * child of a benchmark can be compared directly. */
+static inline int64_t
+kutils_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Optional runtime switches shared by the benchmarks. They are given as
+ * --long-options anywhere on the command line; the positional arguments
+ * of each benchmark start at the index returned by kopts_parse(). Every
+ * benchmark passes the KOPT_* groups it honours, anything else is refused.
+ */
+typedef enum kopt_group_t
+{
+ KOPT_PHASES = 1 << 0,
+ KOPT_TSTAMP = 1 << 1,
+ KOPT_HIST = 1 << 2,
+ KOPT_SCHEDTRACE = 1 << 3,
+ KOPT_SCHED = 1 << 4,
+ KOPT_POWER = 1 << 5,
+ KOPT_NUMA = 1 << 6,
+ KOPT_BUF = 1 << 7,
+ KOPT_COUNTERS = 1 << 8,
+ KOPT_PLACE = 1 << 9,
+ KOPT_COLD = 1 << 10,
+ KOPT_ANTAG = 1 << 11,
+ KOPT_HICCUP = 1 << 12,
+ KOPT_THREADS = 1 << 13,
+ KOPT_POLL = 1 << 14,
+ KOPT_EPOLL = 1 << 15,
+ KOPT_SERVER = 1 << 16,
+ KOPT_CORO = 1 << 17,
+ KOPT_DEPTH = 1 << 18,
+ KOPT_RESPONSE = 1 << 19,
+ KOPT_TRACE = 1 << 20,
+ KOPT_STREAM = 1 << 21,
+}kopt_group;
+
+enum kopt_id
+{
+ KOPT_ID_PHASES = 256,
+ KOPT_ID_TSTAMP,
+ KOPT_ID_HIST,
+ KOPT_ID_SCHEDTRACE,
+ KOPT_ID_SCHED,
+ KOPT_ID_SCHED_PARENT,
+ KOPT_ID_SCHED_CHILD,
+ KOPT_ID_MLOCK,
+ KOPT_ID_PMQOS,
+ KOPT_ID_POWER,
+ KOPT_ID_NUMA,
+ KOPT_ID_NUMA_PARENT,
+ KOPT_ID_NUMA_CHILD,
+ KOPT_ID_BUF,
+ KOPT_ID_COUNTERS,
+ KOPT_ID_PLACE,
+ KOPT_ID_COLD,
+ KOPT_ID_ANTAG,
+ KOPT_ID_HICCUP,
+ KOPT_ID_THREADS,
+ KOPT_ID_POLL,
+ KOPT_ID_BUSY_POLL,
+ KOPT_ID_EPOLL,
+ KOPT_ID_EPOLL_TIMEOUT,
+ KOPT_ID_EPOLL_BUSY,
+ KOPT_ID_REACTOR,
+ KOPT_ID_IDLE_FDS,
+ KOPT_ID_SERVER,
+ KOPT_ID_HANDLER,
+ KOPT_ID_REPLY,
+ KOPT_ID_EXECUTOR,
+ KOPT_ID_FRAMES,
+ KOPT_ID_DEPTH,
+ KOPT_ID_RESPONSE,
+ KOPT_ID_TRACE,
+ KOPT_ID_TRACE_LOOP,
+ KOPT_ID_SIZES,
+ KOPT_ID_ARRIVALS,
+ KOPT_ID_SEED,
+ KOPT_ID_CHUNK,
+};
+
+struct kopts
+{
+  int phases;             /* --phases: per hop syscall phase breakdown */
+  int tstamp;             /* --tstamp: SO_TIMESTAMPING kernel stamps */
+  int hist;               /* --hist: per round trip latency histogram */
+  int schedtrace;         /* --schedtrace: sched wakeup->run delays */
+  const char *sched[2];   /* --sched-parent / --sched-child policy specs */
+  int mlock;              /* --mlock: mlockall() on both sides */
+  int pmqos_us;           /* --pmqos: cpu_dma_latency request, -1 = none */
+  int power;              /* --power: cpufreq / cpuidle report */
+  const char *numa[2];    /* --numa-parent / --numa-child buffer placement */
+  const char *buf;        /* --buf: buffer allocation strategy */
+  int counters;           /* --counters: perf event counts of the loop */
+  const char *place;      /* --placement: buffer placement cases */
+  const char *cold;       /* --cold: cold cache loop mode */
+  const char *antagonist; /* --antagonist: noisy neighbour workers */
+  const char *hiccup;     /* --hiccup: jitter meter cpu and threshold */
+  int threads;            /* --threads: both ends as threads of one process */
+  const char *poll;       /* --poll: receive strategy */
+  int busy_poll_us;       /* --busy-poll: SO_BUSY_POLL, -1 = none */
+  const char *epoll;      /* --epoll: reactor pattern */
+  int64_t epoll_timeout_ns; /* --epoll-timeout: epoll_pwait2, -1 = none */
+  int epoll_busy_us;      /* --epoll-busy: EPIOCSPARAMS, -1 = none */
+  const char *reactor;    /* --reactor: readiness backend of the server */
+  int idle_fds;           /* --idle-fds: idle fds in the interest set */
+  const char *server;     /* --server: c10k_lat server architecture */
+  const char *handler;    /* --handler: synthetic request cost and skew */
+  const char *reply;      /* --reply: who writes a steal reply */
+  const char *executor;   /* --executor: coroutine executor backend */
+  const char *frames;     /* --frames: coroutine frame allocator */
+  const char *depth;      /* --depth: pipelined request windows */
+  int response;           /* --response: reply size, 0 = message size */
+  const char *trace;      /* --trace: request trace to replay */
+  const char *trace_loop; /* --trace-loop: closed or open loop replay */
+  const char *sizes;      /* --sizes: synthetic request size distribution */
+  const char *arrivals;   /* --arrivals: synthetic arrival process */
+  uint64_t seed;          /* --seed: of the synthetic trace */
+  int chunk;              /* --chunk: readv/writev piece size, 0 = none */
+};
+
+static struct kopts kopts;
+
+struct kopt_desc
+{
+  struct option opt;
+  kopt_group group;
+  const char *help;
+};
+
+static const struct kopt_desc kopt_table[] =
+{
+  { { "phases", no_argument, NULL, KOPT_ID_PHASES }, KOPT_PHASES,
+    "time send / transit+wakeup / receive of every hop" },
+  { { "tstamp", no_argument, NULL, KOPT_ID_TSTAMP }, KOPT_TSTAMP,
+    "split each hop into kernel stack and receiver wait (SO_TIMESTAMPING)" },
+  { { "hist", no_argument, NULL, KOPT_ID_HIST }, KOPT_HIST,
+    "record every round trip, print percentiles and a histogram" },
+  { { "schedtrace", no_argument, NULL, KOPT_ID_SCHEDTRACE }, KOPT_SCHEDTRACE,
+    "histogram of sched_wakeup -> sched_switch delays (implies --hist)" },
+  { { "sched", required_argument, NULL, KOPT_ID_SCHED }, KOPT_SCHED,
+    "policy of both sides: other, fifo:<prio>, rr:<prio>, deadline:<runtime_us>:<period_us>" },
+  { { "sched-parent", required_argument, NULL, KOPT_ID_SCHED_PARENT }, KOPT_SCHED,
+    "policy of the parent only" },
+  { { "sched-child", required_argument, NULL, KOPT_ID_SCHED_CHILD }, KOPT_SCHED,
+    "policy of the child only" },
+  { { "mlock", no_argument, NULL, KOPT_ID_MLOCK }, KOPT_SCHED,
+    "mlockall(MCL_CURRENT | MCL_FUTURE) on both sides" },
+  { { "pmqos", required_argument, NULL, KOPT_ID_PMQOS }, KOPT_POWER,
+    "hold /dev/cpu_dma_latency at <us> during the run (implies --power)" },
+  { { "power", no_argument, NULL, KOPT_ID_POWER }, KOPT_POWER,
+    "report cpufreq and cpuidle residency of the pinned CPUs" },
+  { { "numa", required_argument, NULL, KOPT_ID_NUMA }, KOPT_NUMA,
+    "bind the buffers of both sides to <node>, local or remote" },
+  { { "numa-parent", required_argument, NULL, KOPT_ID_NUMA_PARENT }, KOPT_NUMA,
+    "buffer placement of the parent only" },
+  { { "numa-child", required_argument, NULL, KOPT_ID_NUMA_CHILD }, KOPT_NUMA,
+    "buffer placement of the child only" },
+  { { "buf", required_argument, NULL, KOPT_ID_BUF }, KOPT_BUF,
+    "buffer allocation: malloc, populate, thp, hugetlb, hugetlb-1g, mlock" },
+  { { "counters", no_argument, NULL, KOPT_ID_COUNTERS }, KOPT_COUNTERS,
+    "count cycles, instructions, TLB and cache misses, page faults of the loop" },
+  { { "placement", required_argument, NULL, KOPT_ID_PLACE }, KOPT_PLACE,
+    "src/dst buffer cases: same, halves, offset[:a:b:s], misalign[:a:b:s], alias4k, pages, all" },
+  { { "cold", required_argument, NULL, KOPT_ID_COLD }, KOPT_COLD,
+    "second, cold cache loop: pool[:<MB>], sweep[:<MB>] or flush" },
+  { { "antagonist", required_argument, NULL, KOPT_ID_ANTAG }, KOPT_ANTAG,
+    "quiet vs loaded passes with <kind>[:<MB>]@<cpus>[+...] workers: stream, llc, syscall, fork" },
+  { { "hiccup", required_argument, NULL, KOPT_ID_HICCUP }, KOPT_HICCUP,
+    "jitter meter: <cpu>[:<ns>] during the loop, self[:<ns>] before and after" },
+  { { "threads", no_argument, NULL, KOPT_ID_THREADS }, KOPT_THREADS,
+    "run both ends as pinned threads of one process instead of fork()ing" },
+  { { "poll", required_argument, NULL, KOPT_ID_POLL }, KOPT_POLL,
+    "receive with block, spin (non-blocking reads) or hybrid:<us> spin then block" },
+  { { "busy-poll", required_argument, NULL, KOPT_ID_BUSY_POLL }, KOPT_POLL,
+    "set SO_BUSY_POLL to <us> (and SO_PREFER_BUSY_POLL) on the sockets" },
+  { { "epoll", required_argument, NULL, KOPT_ID_EPOLL }, KOPT_EPOLL,
+    "reactor pattern: classic, et, lt or oneshot; prints syscalls per round trip" },
+  { { "epoll-timeout", required_argument, NULL, KOPT_ID_EPOLL_TIMEOUT }, KOPT_EPOLL,
+    "wait with epoll_pwait2() and a <ns> timeout" },
+  { { "epoll-busy", required_argument, NULL, KOPT_ID_EPOLL_BUSY }, KOPT_EPOLL,
+    "busy poll the epoll instance for <us> (EPIOCSPARAMS)" },
+  { { "reactor", required_argument, NULL, KOPT_ID_REACTOR }, KOPT_EPOLL,
+    "server readiness backend: select, poll, ppoll, epoll or uring (multishot poll)" },
+  { { "idle-fds", required_argument, NULL, KOPT_ID_IDLE_FDS }, KOPT_EPOLL,
+    "add <n> idle eventfds to the server's interest set" },
+  { { "server", required_argument, NULL, KOPT_ID_SERVER }, KOPT_SERVER,
+    "single, reuseport:<cpus>, reuseport-cbpf:<cpus>, handoff:<cpus> or steal:<cpus>" },
+  { { "handler", required_argument, NULL, KOPT_ID_HANDLER }, KOPT_SERVER,
+    "spin <ns>[:<skew %>] per request; skew % of steal requests go to worker 0" },
+  { { "reply", required_argument, NULL, KOPT_ID_REPLY }, KOPT_SERVER,
+    "steal replies are written by the worker or the io thread" },
+  { { "executor", required_argument, NULL, KOPT_ID_EXECUTOR }, KOPT_CORO,
+    "coroutine executor: epoll (readiness) or uring (IORING_OP_RECV)" },
+  { { "frames", required_argument, NULL, KOPT_ID_FRAMES }, KOPT_CORO,
+    "coroutine frames from a pool or the heap" },
+  { { "depth", required_argument, NULL, KOPT_ID_DEPTH }, KOPT_DEPTH,
+    "extra passes keeping <n>[,<n>...] requests in flight, replies in order" },
+  { { "response", required_argument, NULL, KOPT_ID_RESPONSE }, KOPT_RESPONSE,
+    "reply with <bytes> octets instead of echoing the message size" },
+  { { "trace", required_argument, NULL, KOPT_ID_TRACE }, KOPT_TRACE,
+    "extra pass replaying the sizes and gaps of a trace (binary or .csv)" },
+  { { "trace-loop", required_argument, NULL, KOPT_ID_TRACE_LOOP }, KOPT_TRACE,
+    "closed (wait for each reply) or open (send on the trace's clock)" },
+  { { "sizes", required_argument, NULL, KOPT_ID_SIZES }, KOPT_TRACE,
+    "replay synthetic sizes: fixed, uniform, bimodal, lognormal, zipf or cdf" },
+  { { "arrivals", required_argument, NULL, KOPT_ID_ARRIVALS }, KOPT_TRACE,
+    "synthetic arrivals: fixed:<req/s> or poisson:<req/s>" },
+  { { "seed", required_argument, NULL, KOPT_ID_SEED }, KOPT_TRACE,
+    "seed of the synthetic trace (default 1)" },
+  { { "chunk", required_argument, NULL, KOPT_ID_CHUNK }, KOPT_STREAM,
+    "move messages with readv/writev over <bytes> sized pieces" },
+};
+
+#define KOPT_COUNT (sizeof(kopt_table) / sizeof(kopt_table[0]))
+
+static inline void
+kopts_usage(unsigned supported)
+{
+  unsigned k;
+
+  for (k = 0; k < KOPT_COUNT; k++) {
+    if (!(kopt_table[k].group & supported))
+      continue;
+    printf("  --%s%s\t%s\n", kopt_table[k].opt.name,
+           kopt_table[k].opt.has_arg == required_argument ? "=<v>" : "",
+           kopt_table[k].help);
+  }
+}
+
+/* Returns the index of the first positional argument, or -1 on error. */
+static inline int
+kopts_parse(int argc, char *argv[], unsigned supported)
+{
+  struct option longopts[KOPT_COUNT + 1];
+  unsigned k;
+  int c, idx;
+
+  memset(&kopts, 0, sizeof(kopts));
+  kopts.pmqos_us = -1;
+  kopts.busy_poll_us = -1;
+  kopts.epoll_timeout_ns = -1;
+  kopts.epoll_busy_us = -1;
+  kopts.seed = 1;
+  memset(longopts, 0, sizeof(longopts));
+  for (k = 0; k < KOPT_COUNT; k++)
+    longopts[k] = kopt_table[k].opt;
+
+  while ((c = getopt_long(argc, argv, "", longopts, &idx)) != -1) {
+    if (c == '?')
+      return -1;
+    if (!(kopt_table[idx].group & supported)) {
+      fprintf(stderr, "%s: --%s is not supported by this benchmark\n",
+              argv[0], kopt_table[idx].opt.name);
+      return -1;
+    }
+
+    switch (c) {
+    case KOPT_ID_PHASES:
+      kopts.phases = 1;
+      break;
+    case KOPT_ID_TSTAMP:
+      kopts.tstamp = 1;
+      break;
+    case KOPT_ID_HIST:
+      kopts.hist = 1;
+      break;
+    case KOPT_ID_SCHEDTRACE:
+      kopts.schedtrace = 1;
+      kopts.hist = 1;
+      break;
+    case KOPT_ID_SCHED:
+      kopts.sched[0] = kopts.sched[1] = optarg;
+      break;
+    case KOPT_ID_SCHED_PARENT:
+      kopts.sched[0] = optarg;
+      break;
+    case KOPT_ID_SCHED_CHILD:
+      kopts.sched[1] = optarg;
+      break;
+    case KOPT_ID_MLOCK:
+      kopts.mlock = 1;
+      break;
+    case KOPT_ID_PMQOS:
+      kopts.pmqos_us = atoi(optarg);
+      kopts.power = 1;
+      break;
+    case KOPT_ID_POWER:
+      kopts.power = 1;
+      break;
+    case KOPT_ID_NUMA:
+      kopts.numa[0] = kopts.numa[1] = optarg;
+      break;
+    case KOPT_ID_NUMA_PARENT:
+      kopts.numa[0] = optarg;
+      break;
+    case KOPT_ID_NUMA_CHILD:
+      kopts.numa[1] = optarg;
+      break;
+    case KOPT_ID_BUF:
+      kopts.buf = optarg;
+      break;
+    case KOPT_ID_COUNTERS:
+      kopts.counters = 1;
+      break;
+    case KOPT_ID_PLACE:
+      kopts.place = optarg;
+      break;
+    case KOPT_ID_COLD:
+      kopts.cold = optarg;
+      break;
+    case KOPT_ID_ANTAG:
+      kopts.antagonist = optarg;
+      break;
+    case KOPT_ID_HICCUP:
+      kopts.hiccup = optarg;
+      break;
+    case KOPT_ID_THREADS:
+      kopts.threads = 1;
+      break;
+    case KOPT_ID_POLL:
+      kopts.poll = optarg;
+      break;
+    case KOPT_ID_BUSY_POLL:
+      kopts.busy_poll_us = atoi(optarg);
+      break;
+    case KOPT_ID_EPOLL:
+      kopts.epoll = optarg;
+      break;
+    case KOPT_ID_EPOLL_TIMEOUT:
+      kopts.epoll_timeout_ns = atoll(optarg);
+      break;
+    case KOPT_ID_EPOLL_BUSY:
+      kopts.epoll_busy_us = atoi(optarg);
+      break;
+    case KOPT_ID_REACTOR:
+      kopts.reactor = optarg;
+      break;
+    case KOPT_ID_IDLE_FDS:
+      kopts.idle_fds = atoi(optarg);
+      break;
+    case KOPT_ID_SERVER:
+      kopts.server = optarg;
+      break;
+    case KOPT_ID_HANDLER:
+      kopts.handler = optarg;
+      break;
+    case KOPT_ID_REPLY:
+      kopts.reply = optarg;
+      break;
+    case KOPT_ID_EXECUTOR:
+      kopts.executor = optarg;
+      break;
+    case KOPT_ID_FRAMES:
+      kopts.frames = optarg;
+      break;
+    case KOPT_ID_DEPTH:
+      kopts.depth = optarg;
+      break;
+    case KOPT_ID_RESPONSE:
+      kopts.response = atoi(optarg);
+      break;
+    case KOPT_ID_TRACE:
+      kopts.trace = optarg;
+      break;
+    case KOPT_ID_TRACE_LOOP:
+      kopts.trace_loop = optarg;
+      break;
+    case KOPT_ID_SIZES:
+      kopts.sizes = optarg;
+      break;
+    case KOPT_ID_ARRIVALS:
+      kopts.arrivals = optarg;
+      break;
+    case KOPT_ID_SEED:
+      kopts.seed = strtoull(optarg, NULL, 0);
+      break;
+    case KOPT_ID_CHUNK:
+      kopts.chunk = atoi(optarg);
+      break;
+    }
+  }
+
+  return optind;
+}
+
+/*
+ * Reply size of a ping-pong benchmark (--response): the request size
+ * unless given. The passes that echo the request back are refused when the
+ * sizes differ; returns -1 with a message then.
+ */
+static inline int
+kopts_response(int size)
+{
+  if (kopts.response < 0) {
+    fprintf(stderr, "response: bad size %d\n", kopts.response);
+    return -1;
+  }
+  if (kopts.response == 0 || kopts.response == size)
+    return size;
+  if (kopts.phases || kopts.tstamp || kopts.cold || kopts.antagonist ||
+      kopts.threads || kopts.depth) {
+    fprintf(stderr, "response: --phases, --tstamp, --cold, --antagonist, "
+            "--threads and --depth need the request size\n");
+    return -1;
+  }
+  return kopts.response;
+}
+
+/* Builds in the --sched / --mlock support of KSched.h */
 #define RT_SCHED
 #ifdef ANGEL
 #include "./disk/angel-utils/libangel/include/angel.h"
@@ -68,9 +487,19 @@ static inline void workload_ckpt_end()
 #include "rtl_wave.h"
 #endif
 
+static inline long
+perf_event_open(struct perf_event_attr *hw_event, pid_t pid,
+               int cpu, int group_fd, unsigned long flags)
+{
+   int ret;
+
+   ret = syscall(__NR_perf_event_open, hw_event, pid, cpu,
+                  group_fd, flags);
+   return ret;
+}
+
 //#define PERF_INSTRUMENT
 #ifdef PERF_INSTRUMENT
-#include <sys/ioctl.h>
 
 typedef enum enable_perf_events_t
 {
@@ -86,17 +515,6 @@ static int fdC =  -1;
 static int fdTI = -1;
 static int fdTC = -1;
 
-static long
-perf_event_open(struct perf_event_attr *hw_event, pid_t pid,
-               int cpu, int group_fd, unsigned long flags)
-{
-   int ret;
-
-   ret = syscall(__NR_perf_event_open, hw_event, pid, cpu,
-                  group_fd, flags);
-   return ret;
-}
-
 static void
 perf_event_init(enable_perf_events flag)
 {
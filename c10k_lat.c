@@ -0,0 +1,1226 @@
+/*
+    Measure a server holding many concurrent loopback connections
+
+    A single threaded epoll server (the child, pinned to <server cpu>) holds
+    <connections> TCP or AF_UNIX connections opened by a client of
+    <client threads> threads spread over <client cpus>. <active %> of the
+    connections run closed loop request / response exchanges of
+    <request size> bytes with <think us> between a response and the next
+    request; the others stay connected and idle, as the keep-alive
+    connections of a proxy do.
+
+    Once every connection is up the client runs for <seconds> and reports
+    requests/s, latency percentiles, the server's memory per connection and
+    the batch sizes of the server's epoll_wait() calls. TCP client sockets
+    are bound to 127.0.N.1 source addresses (IP_BIND_ADDRESS_NO_PORT) so
+    more connections than ephemeral ports can be opened.
+
+    --server picks the server architecture:
+
+      single                  one reactor accepts and serves (the default)
+      reuseport:<cpus>        one reactor thread per CPU, each with its own
+                              SO_REUSEPORT listener and epoll (tcp only)
+      reuseport-cbpf:<cpus>   the same, with an SO_ATTACH_REUSEPORT_CBPF
+                              program steering a connection to the reactor
+                              on the CPU that handled its SYN
+      handoff:<cpus>          one acceptor on <server cpu> hands connections
+                              to one worker reactor per CPU through a
+                              single producer / single consumer ring and an
+                              eventfd wakeup
+      steal:<cpus>            one epoll I/O thread on <server cpu> reads the
+                              requests and pushes them onto per-worker
+                              Chase-Lev deques; a worker per CPU takes from
+                              its own deque and steals from the others when
+                              it runs dry
+
+    --handler=<ns>[:<skew %>] spins <ns> per request before the reply, in
+    the reactor or the worker. With steal, the I/O thread deals requests
+    round robin except for <skew %> of them, which all go to worker 0.
+    --reply=worker|io picks who writes a steal reply: the worker itself
+    (the default) or the I/O thread, woken through an eventfd.
+*/
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <linux/filter.h>
+#include <linux/futex.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "KUtils.h"
+#include "KSched.h"
+#include "KStats.h"
+#include "KTopo.h"
+
+#ifndef IP_BIND_ADDRESS_NO_PORT
+#define IP_BIND_ADDRESS_NO_PORT 24
+#endif
+#ifndef __NR_epoll_pwait2
+#define __NR_epoll_pwait2 441
+#endif
+
+#define errExit(msg)	do { perror(msg); exit(EXIT_FAILURE); \
+							  } while (0)
+
+#define C10K_EVENTS 1024
+#define C10K_BATCH_BUCKETS 12   /* 1, 2-3, ... 1024+ */
+#define C10K_PER_SRC 16384      /* connections per TCP source address */
+#define C10K_MAX_CPUS 1024
+#define C10K_MAX_REACTORS 64
+#define C10K_RING 4096
+#define C10K_FD_SLACK (64 + 4 * C10K_MAX_REACTORS) /* listeners, epoll, eventfds */
+
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
+enum { C10K_SINGLE, C10K_REUSEPORT, C10K_REUSEPORT_CBPF, C10K_HANDOFF,
+       C10K_STEAL };
+
+static const char *c10k_arch_names[] = { "single", "reuseport", "reuseport-cbpf",
+                                         "handoff", "steal" };
+
+/* Per reactor counters, written by the server, read by the client. */
+struct c10k_rstat
+{
+  int cpu;
+  int64_t conns, requests, steals;
+  uint64_t nwait, nevents;
+  uint64_t batch[C10K_BATCH_BUCKETS];
+};
+
+struct c10k_shared
+{
+  volatile int ready;
+  volatile int64_t accepted;
+  int nreactors;
+  struct c10k_rstat r[C10K_MAX_REACTORS];
+  struct c10k_rstat io;           /* steal: the I/O thread */
+};
+
+/* Accepted fds from the acceptor to one worker: one producer, one consumer. */
+struct c10k_ring
+{
+  int fd[C10K_RING];
+  uint32_t head, tail;
+};
+
+struct c10k_reactor
+{
+  pthread_t tid;
+  int lfd;                        /* -1: handoff worker */
+  int evfd;                       /* handoff: ring has fds */
+  struct c10k_ring ring;
+  struct c10k_rstat *st;
+};
+
+/*
+ * Chase-Lev deque of request fds. The I/O thread is the owner and only
+ * pushes at the bottom; the workers take from the top, their own deque
+ * first. A connection has at most one request in flight, so a deque of
+ * RLIMIT_NOFILE entries never fills and never has to grow.
+ */
+struct c10k_deque
+{
+  int64_t top __attribute__((aligned(64)));
+  int64_t bottom __attribute__((aligned(64)));
+  int64_t mask;
+  int *fd;
+};
+
+struct c10k_worker
+{
+  pthread_t tid;
+  int id;
+  struct c10k_deque dq;
+  struct c10k_ring done;          /* --reply=io: replies for the I/O thread */
+  struct c10k_rstat *st;
+};
+
+struct c10k_conn
+{
+  int fd;
+  int got;
+  int64_t t_send;
+};
+
+struct c10k_thread
+{
+  pthread_t tid;
+  int id;
+  int cpu;                        /* -1: not pinned */
+  int64_t first, n;               /* global index and number of connections */
+  struct c10k_conn *conns;
+  int64_t *fifo;                  /* connections thinking, in send order */
+  int64_t *due;
+  int64_t requests;
+  int64_t lat_min, lat_max, lat_sum;
+  struct khist hist;
+};
+
+static int unixsock, size, think_us;
+static double active_ratio;
+static struct sockaddr_storage server_addr;
+static socklen_t server_len;
+static pthread_barrier_t up, go;
+static volatile int64_t t_end;
+static struct c10k_shared *sh;
+static int *got;                  /* server: request bytes so far, per fd */
+static int64_t handler_ns;
+static int skew_pct, reply_io;
+static struct c10k_worker *workers;
+static int nworkers, done_fd;
+static char **reqbuf;             /* steal: request of each fd */
+static int work_seq, sleepers;    /* steal: futex of idle workers */
+
+static int64_t c10k_meminfo_kb(const char *key)
+{
+  char line[256];
+  int64_t v = -1;
+  FILE *f;
+
+  if ((f = fopen("/proc/meminfo", "r")) == NULL)
+    return -1;
+  while (fgets(line, sizeof(line), f) != NULL)
+    if (strncmp(line, key, strlen(key)) == 0)
+      sscanf(line + strlen(key), ": %" SCNd64, &v);
+  fclose(f);
+  return v;
+}
+
+static int64_t c10k_rss_kb(pid_t pid)
+{
+  char path[64], line[256];
+  int64_t v = -1;
+  FILE *f;
+
+  snprintf(path, sizeof(path), "/proc/%d/status", pid);
+  if ((f = fopen(path, "r")) == NULL)
+    return -1;
+  while (fgets(line, sizeof(line), f) != NULL)
+    if (strncmp(line, "VmRSS:", 6) == 0)
+      sscanf(line + 6, "%" SCNd64, &v);
+  fclose(f);
+  return v;
+}
+
+/* Pages of TCP socket buffers, from the "TCP:" line of /proc/net/sockstat. */
+static int64_t c10k_tcp_mem_pages(void)
+{
+  char line[256], *m;
+  int64_t v = -1;
+  FILE *f;
+
+  if ((f = fopen("/proc/net/sockstat", "r")) == NULL)
+    return -1;
+  while (fgets(line, sizeof(line), f) != NULL)
+    if (strncmp(line, "TCP:", 4) == 0 && (m = strstr(line, " mem ")) != NULL)
+      sscanf(m + 5, "%" SCNd64, &v);
+  fclose(f);
+  return v;
+}
+
+static void c10k_pin(int cpu, const char *who)
+{
+  cpu_set_t set;
+
+  if (cpu < 0)
+    return;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+    fprintf(stderr, "sched_setaffinity of %s failed: %s\n", who,
+            strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* Writes all of buf to a non-blocking socket. */
+static void c10k_write(int fd, char *buf, int len)
+{
+  ssize_t w;
+  int sofar;
+
+  for (sofar = 0; sofar < len; sofar += w) {
+    w = write(fd, buf + sofar, len - sofar);
+    if (w == -1 && errno == EAGAIN) {
+      w = 0;
+      sched_yield();
+    } else if (w <= 0) {
+      errExit("write");
+    }
+  }
+}
+
+static void c10k_register(int efd, int fd, struct c10k_rstat *st)
+{
+  struct epoll_event ev;
+
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  if (epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev) == -1)
+    errExit("epoll_ctl");
+  st->conns++;
+  __atomic_add_fetch(&sh->accepted, 1, __ATOMIC_RELEASE);
+}
+
+/* Takes the fds the acceptor queued for this worker. */
+static void c10k_ring_drain(struct c10k_reactor *r, int efd)
+{
+  uint64_t v;
+  uint32_t h, t;
+
+  if (read(r->evfd, &v, sizeof(v)) == -1 && errno != EAGAIN)
+    errExit("read eventfd");
+  h = r->ring.head;
+  t = __atomic_load_n(&r->ring.tail, __ATOMIC_ACQUIRE);
+  for (; h != t; h++)
+    c10k_register(efd, r->ring.fd[h % C10K_RING], r->st);
+  __atomic_store_n(&r->ring.head, h, __ATOMIC_RELEASE);
+}
+
+/* epoll_wait() that records the batch size. */
+static int c10k_epoll_wait(int efd, struct epoll_event *events,
+                           struct c10k_rstat *st)
+{
+  int n, b;
+
+  while ((n = epoll_wait(efd, events, C10K_EVENTS, -1)) == -1)
+    if (errno != EINTR)
+      errExit("epoll_wait");
+  st->nwait++;
+  st->nevents += n;
+  for (b = 0; b < C10K_BATCH_BUCKETS - 1 && (1 << (b + 1)) <= n; b++)
+    ;
+  st->batch[b]++;
+  return n;
+}
+
+/* The synthetic handler: spins for --handler ns. */
+static void c10k_handle(void)
+{
+  int64_t end;
+
+  if (handler_ns <= 0)
+    return;
+  end = kutils_now_ns() + handler_ns;
+  while (kutils_now_ns() < end)
+    ;
+}
+
+static void *c10k_reactor(void *arg)
+{
+  struct c10k_reactor *r = arg;
+  struct c10k_rstat *st = r->st;
+  struct epoll_event ev, *events;
+  int efd, n, j, fd, cfd;
+  ssize_t len;
+  char *buf;
+
+  c10k_pin(st->cpu, "server reactor");
+  events = calloc(C10K_EVENTS, sizeof(*events));
+  buf = malloc(size);
+  if (events == NULL || buf == NULL)
+    errExit("malloc");
+
+  if ((efd = epoll_create1(0)) == -1)
+    errExit("epoll_create1");
+  ev.events = EPOLLIN;
+  ev.data.fd = r->lfd >= 0 ? r->lfd : r->evfd;
+  if (epoll_ctl(efd, EPOLL_CTL_ADD, ev.data.fd, &ev) == -1)
+    errExit("epoll_ctl");
+  if (r->lfd >= 0)
+    fcntl(r->lfd, F_SETFL, O_NONBLOCK);
+
+  for (;;) {
+    n = c10k_epoll_wait(efd, events, st);
+    for (j = 0; j < n; j++) {
+      fd = events[j].data.fd;
+      if (fd == r->lfd) {
+        while ((cfd = accept4(r->lfd, NULL, NULL, SOCK_NONBLOCK)) != -1)
+          c10k_register(efd, cfd, st);
+        if (errno != EAGAIN)
+          errExit("accept4");
+        continue;
+      }
+      if (fd == r->evfd) {
+        c10k_ring_drain(r, efd);
+        continue;
+      }
+      len = read(fd, buf, size - got[fd]);
+      if (len <= 0) {
+        if (len == -1 && errno == EAGAIN)
+          continue;
+        close(fd);
+        continue;
+      }
+      got[fd] += len;
+      if (got[fd] == size) {
+        got[fd] = 0;
+        c10k_handle();
+        c10k_write(fd, buf, size);
+        st->requests++;
+      }
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Blocking accept loop handing connections to the workers. The worker is
+ * picked pseudo-randomly like a reuseport hash would: round robin lines up
+ * with the evenly spread active connections and leaves workers idle.
+ */
+static void c10k_acceptor(int lfd, struct c10k_reactor *r, int n)
+{
+  uint64_t one = 1, x = 88172645463325252ULL;
+  uint32_t t;
+  int cfd, k;
+
+  for (;;) {
+    if ((cfd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK)) == -1) {
+      if (errno == EINTR)
+        continue;
+      errExit("accept4");
+    }
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    k = x % n;
+    t = r[k].ring.tail;
+    while (t - __atomic_load_n(&r[k].ring.head, __ATOMIC_ACQUIRE) == C10K_RING)
+      sched_yield();
+    r[k].ring.fd[t % C10K_RING] = cfd;
+    __atomic_store_n(&r[k].ring.tail, t + 1, __ATOMIC_RELEASE);
+    if (write(r[k].evfd, &one, sizeof(one)) != sizeof(one))
+      errExit("write eventfd");
+  }
+}
+
+static void c10k_deque_push(struct c10k_deque *d, int fd)
+{
+  int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+
+  d->fd[b & d->mask] = fd;
+  __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+}
+
+/* Returns the fd at the top, or -1 when empty or lost to another thief. */
+static int c10k_deque_steal(struct c10k_deque *d)
+{
+  int64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+  int64_t b;
+  int fd;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+  if (t >= b)
+    return -1;
+  fd = d->fd[t & d->mask];
+  if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST,
+                                   __ATOMIC_RELAXED))
+    return -1;
+  return fd;
+}
+
+static int c10k_futex(int *addr, int op, int val)
+{
+  return syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+/* Next request for worker w: its own deque, then the others in turn. */
+static int c10k_take(struct c10k_worker *w)
+{
+  int k, fd;
+
+  if ((fd = c10k_deque_steal(&w->dq)) != -1)
+    return fd;
+  for (k = 1; k < nworkers; k++) {
+    fd = c10k_deque_steal(&workers[(w->id + k) % nworkers].dq);
+    if (fd != -1) {
+      w->st->steals++;
+      return fd;
+    }
+  }
+  return -1;
+}
+
+static void *c10k_worker(void *arg)
+{
+  struct c10k_worker *w = arg;
+  uint64_t one = 1;
+  uint32_t t;
+  int fd, seq;
+
+  c10k_pin(w->st->cpu, "server worker");
+  for (;;) {
+    seq = __atomic_load_n(&work_seq, __ATOMIC_SEQ_CST);
+    if ((fd = c10k_take(w)) == -1) {
+      /* the I/O thread bumps work_seq after every push */
+      __atomic_add_fetch(&sleepers, 1, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&work_seq, __ATOMIC_SEQ_CST) == seq)
+        c10k_futex(&work_seq, FUTEX_WAIT_PRIVATE, seq);
+      __atomic_sub_fetch(&sleepers, 1, __ATOMIC_SEQ_CST);
+      continue;
+    }
+    c10k_handle();
+    w->st->requests++;
+    if (!reply_io) {
+      c10k_write(fd, reqbuf[fd], size);
+      continue;
+    }
+    t = w->done.tail;
+    while (t - __atomic_load_n(&w->done.head, __ATOMIC_ACQUIRE) == C10K_RING)
+      sched_yield();
+    w->done.fd[t % C10K_RING] = fd;
+    __atomic_store_n(&w->done.tail, t + 1, __ATOMIC_RELEASE);
+    if (write(done_fd, &one, sizeof(one)) != sizeof(one))
+      errExit("write eventfd");
+  }
+  return NULL;
+}
+
+/* --reply=io: writes the replies the workers finished. */
+static void c10k_io_replies(void)
+{
+  uint64_t v;
+  uint32_t h, t;
+  int k, fd;
+
+  if (read(done_fd, &v, sizeof(v)) == -1 && errno != EAGAIN)
+    errExit("read eventfd");
+  for (k = 0; k < nworkers; k++) {
+    h = workers[k].done.head;
+    t = __atomic_load_n(&workers[k].done.tail, __ATOMIC_ACQUIRE);
+    for (; h != t; h++) {
+      fd = workers[k].done.fd[h % C10K_RING];
+      c10k_write(fd, reqbuf[fd], size);
+    }
+    __atomic_store_n(&workers[k].done.head, h, __ATOMIC_RELEASE);
+  }
+}
+
+/*
+ * The I/O thread of steal: accepts, reads whole requests and deals them
+ * to the worker deques, round robin but for the skewed share.
+ */
+static void c10k_io(int lfd)
+{
+  struct c10k_rstat *st = &sh->io;
+  struct epoll_event ev, *events;
+  uint64_t x = 88172645463325252ULL;
+  int efd, n, j, fd, cfd, k, rr = 0;
+  ssize_t len;
+
+  if ((events = calloc(C10K_EVENTS, sizeof(*events))) == NULL)
+    errExit("calloc");
+  if ((efd = epoll_create1(0)) == -1)
+    errExit("epoll_create1");
+  ev.events = EPOLLIN;
+  ev.data.fd = lfd;
+  if (epoll_ctl(efd, EPOLL_CTL_ADD, lfd, &ev) == -1)
+    errExit("epoll_ctl");
+  if (reply_io) {
+    ev.data.fd = done_fd;
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, done_fd, &ev) == -1)
+      errExit("epoll_ctl");
+  }
+  fcntl(lfd, F_SETFL, O_NONBLOCK);
+
+  for (;;) {
+    n = c10k_epoll_wait(efd, events, st);
+    for (j = 0; j < n; j++) {
+      fd = events[j].data.fd;
+      if (fd == lfd) {
+        while ((cfd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK)) != -1) {
+          if (reqbuf[cfd] == NULL && (reqbuf[cfd] = malloc(size)) == NULL)
+            errExit("malloc");
+          c10k_register(efd, cfd, st);
+        }
+        if (errno != EAGAIN)
+          errExit("accept4");
+        continue;
+      }
+      if (fd == done_fd) {
+        c10k_io_replies();
+        continue;
+      }
+      len = read(fd, reqbuf[fd] + got[fd], size - got[fd]);
+      if (len <= 0) {
+        if (len == -1 && errno == EAGAIN)
+          continue;
+        close(fd);
+        continue;
+      }
+      got[fd] += len;
+      if (got[fd] < size)
+        continue;
+      got[fd] = 0;
+      st->requests++;
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      k = (int)(x % 100) < skew_pct ? 0 : rr++ % nworkers;
+      c10k_deque_push(&workers[k].dq, fd);
+      __atomic_add_fetch(&work_seq, 1, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&sleepers, __ATOMIC_SEQ_CST) > 0)
+        c10k_futex(&work_seq, FUTEX_WAKE_PRIVATE, 1);
+    }
+  }
+}
+
+static void c10k_steal_server(int lfd, int serverCPU)
+{
+  struct rlimit rl;
+  int64_t cap;
+  int k;
+
+  getrlimit(RLIMIT_NOFILE, &rl);
+  for (cap = 1; cap < (int64_t)rl.rlim_cur; cap <<= 1)
+    ;
+  nworkers = sh->nreactors;
+  workers = calloc(nworkers, sizeof(*workers));
+  reqbuf = calloc(rl.rlim_cur, sizeof(char *));
+  if (workers == NULL || reqbuf == NULL)
+    errExit("calloc");
+  if (reply_io && (done_fd = eventfd(0, EFD_NONBLOCK)) == -1)
+    errExit("eventfd");
+  for (k = 0; k < nworkers; k++) {
+    workers[k].id = k;
+    workers[k].st = &sh->r[k];
+    workers[k].dq.mask = cap - 1;
+    if ((workers[k].dq.fd = calloc(cap, sizeof(int))) == NULL)
+      errExit("calloc");
+  }
+  for (k = 0; k < nworkers; k++)
+    if (pthread_create(&workers[k].tid, NULL, c10k_worker, &workers[k]) != 0)
+      errExit("pthread_create");
+  c10k_pin(serverCPU, "server I/O thread");
+  sh->ready = 1;
+  c10k_io(lfd);
+}
+
+/* A listener on the port of server_addr, for the reuseport group. */
+static int c10k_listener(void)
+{
+  int fd, yes = 1;
+
+  if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+    errExit("socket");
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1)
+    errExit("setsockopt SO_REUSEPORT");
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+  if (bind(fd, (struct sockaddr *)&server_addr, server_len) == -1 ||
+      listen(fd, SOMAXCONN) == -1)
+    errExit("bind of reuseport listener");
+  return fd;
+}
+
+/*
+ * Steers a connection to the listener of the reactor pinned to the CPU that
+ * runs the program, by socket index in the group; other CPUs go by
+ * cpu % n. Listeners join the group in reactor order.
+ */
+static void c10k_attach_cbpf(int lfd, int n)
+{
+  struct sock_filter code[3 + 2 * C10K_MAX_REACTORS];
+  struct sock_fprog prog;
+  int k, len = 0;
+
+  code[len++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                                             SKF_AD_OFF + SKF_AD_CPU);
+  /* jeq k jumps over the remaining jeqs, the mod and its ret to ret #k */
+  for (k = 0; k < n; k++)
+    code[len++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                                               sh->r[k].cpu, n + 1, 0);
+  code[len++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, n);
+  code[len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+  for (k = 0; k < n; k++)
+    code[len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, k);
+
+  prog.len = len;
+  prog.filter = code;
+  if (setsockopt(lfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+                 sizeof(prog)) == -1)
+    errExit("setsockopt SO_ATTACH_REUSEPORT_CBPF");
+}
+
+static void c10k_server(int lfd, int arch, int serverCPU)
+{
+  struct c10k_reactor *r;
+  struct rlimit rl;
+  int k, n = sh->nreactors;
+
+  getrlimit(RLIMIT_NOFILE, &rl);
+  got = calloc(rl.rlim_cur, sizeof(int));
+  r = calloc(n, sizeof(*r));
+  if (got == NULL || r == NULL)
+    errExit("calloc");
+
+  for (k = 0; k < n; k++) {
+    r[k].st = &sh->r[k];
+    r[k].lfd = r[k].evfd = -1;
+  }
+  switch (arch) {
+  case C10K_STEAL:
+    c10k_steal_server(lfd, serverCPU);
+    return;
+  case C10K_SINGLE:
+    r[0].lfd = lfd;
+    sh->ready = 1;
+    c10k_reactor(&r[0]);
+    return;
+  case C10K_REUSEPORT:
+  case C10K_REUSEPORT_CBPF:
+    r[0].lfd = lfd;
+    for (k = 1; k < n; k++)
+      r[k].lfd = c10k_listener();
+    if (arch == C10K_REUSEPORT_CBPF)
+      c10k_attach_cbpf(lfd, n);
+    break;
+  default:
+    for (k = 0; k < n; k++)
+      if ((r[k].evfd = eventfd(0, EFD_NONBLOCK)) == -1)
+        errExit("eventfd");
+    break;
+  }
+
+  for (k = 0; k < n; k++)
+    if (pthread_create(&r[k].tid, NULL, c10k_reactor, &r[k]) != 0)
+      errExit("pthread_create");
+  sh->ready = 1;
+  if (arch == C10K_HANDOFF) {
+    c10k_pin(serverCPU, "acceptor");
+    c10k_acceptor(lfd, r, n);
+  }
+  pthread_join(r[0].tid, NULL);
+}
+
+/* Parses --handler and --reply. Returns -1 with a message. */
+static int c10k_parse_handler(int arch)
+{
+  const char *spec = kopts.handler;
+  char *end;
+
+  if (spec != NULL) {
+    handler_ns = strtoll(spec, &end, 10);
+    if (end == spec || handler_ns < 0) {
+      fprintf(stderr, "handler: bad cost '%s' (<ns>[:<skew %%>])\n", spec);
+      return -1;
+    }
+    if (*end == ':') {
+      spec = end + 1;
+      skew_pct = strtol(spec, &end, 10);
+      if (end == spec || skew_pct < 0 || skew_pct > 100) {
+        fprintf(stderr, "handler: bad skew '%s'\n", spec);
+        return -1;
+      }
+      if (arch != C10K_STEAL) {
+        fprintf(stderr, "handler: skew needs --server=steal\n");
+        return -1;
+      }
+    }
+    if (*end) {
+      fprintf(stderr, "handler: bad spec '%s' (<ns>[:<skew %%>])\n",
+              kopts.handler);
+      return -1;
+    }
+  }
+
+  if (kopts.reply == NULL || strcmp(kopts.reply, "worker") == 0) {
+    reply_io = 0;
+  } else if (strcmp(kopts.reply, "io") == 0) {
+    reply_io = 1;
+  } else {
+    fprintf(stderr, "reply: bad mode '%s' (worker, io)\n", kopts.reply);
+    return -1;
+  }
+  if (kopts.reply != NULL && arch != C10K_STEAL) {
+    fprintf(stderr, "reply: needs --server=steal\n");
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Parses --server into the architecture and the reactor CPUs in
+ * sh->r[].cpu. Returns -1 with a message.
+ */
+static int c10k_parse_server(int *arch, int serverCPU)
+{
+  const char *spec = kopts.server, *list = NULL;
+  char map[C10K_MAX_CPUS];
+  int k, a;
+
+  *arch = C10K_SINGLE;
+  sh->nreactors = 1;
+  sh->r[0].cpu = serverCPU;
+  if (spec == NULL || strcmp(spec, "single") == 0)
+    return 0;
+
+  for (a = C10K_REUSEPORT; a <= C10K_STEAL; a++) {
+    k = strlen(c10k_arch_names[a]);
+    if (strncmp(spec, c10k_arch_names[a], k) == 0 && spec[k] == ':') {
+      list = spec + k + 1;
+      break;
+    }
+  }
+  if (list == NULL) {
+    fprintf(stderr, "server: bad architecture '%s' (single, reuseport:<cpus>, "
+            "reuseport-cbpf:<cpus>, handoff:<cpus>, steal:<cpus>)\n",
+            spec);
+    return -1;
+  }
+  if (ktopo_parse_list(list, map, C10K_MAX_CPUS) == 0) {
+    fprintf(stderr, "server: bad cpu list '%s'\n", list);
+    return -1;
+  }
+  sh->nreactors = 0;
+  for (k = 0; k < C10K_MAX_CPUS; k++) {
+    if (!map[k])
+      continue;
+    if (sh->nreactors == C10K_MAX_REACTORS) {
+      fprintf(stderr, "server: more than %d reactors\n", C10K_MAX_REACTORS);
+      return -1;
+    }
+    sh->r[sh->nreactors++].cpu = k;
+  }
+  if ((a == C10K_REUSEPORT || a == C10K_REUSEPORT_CBPF) && unixsock) {
+    fprintf(stderr, "server: SO_REUSEPORT needs tcp\n");
+    return -1;
+  }
+  *arch = a;
+  return 0;
+}
+
+static int c10k_connect(int64_t c)
+{
+  struct sockaddr_in src;
+  int fd, one = 1;
+
+  if ((fd = socket(server_addr.ss_family, SOCK_STREAM, 0)) == -1)
+    errExit("socket");
+  if (!unixsock) {
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+    memset(&src, 0, sizeof(src));
+    src.sin_family = AF_INET;
+    src.sin_addr.s_addr = htonl(0x7f000001 + 0x100 * (c / C10K_PER_SRC + 1));
+    if (bind(fd, (struct sockaddr *)&src, sizeof(src)) == -1)
+      errExit("bind of client");
+  }
+  if (connect(fd, (struct sockaddr *)&server_addr, server_len) == -1)
+    errExit("connect");
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  return fd;
+}
+
+static void c10k_send(struct c10k_conn *cn, char *buf)
+{
+  cn->t_send = kutils_now_ns();
+  c10k_write(cn->fd, buf, size);
+}
+
+static int c10k_wait(int efd, struct epoll_event *events, int64_t timeout_ns)
+{
+  struct timespec ts;
+  int n;
+
+  ts.tv_sec = timeout_ns / 1000000000;
+  ts.tv_nsec = timeout_ns % 1000000000;
+  n = syscall(__NR_epoll_pwait2, efd, events, C10K_EVENTS, &ts, NULL, 0);
+  if (n == -1 && errno == ENOSYS)
+    n = epoll_wait(efd, events, C10K_EVENTS, (timeout_ns + 999999) / 1000000);
+  return n;
+}
+
+static void *c10k_client(void *arg)
+{
+  struct c10k_thread *t = arg;
+  struct epoll_event ev, *events;
+  int64_t k, c, now, timeout, head = 0, tail = 0, lat;
+  struct c10k_conn *cn;
+  char *buf;
+  ssize_t r;
+  int efd, n, j;
+
+  c10k_pin(t->cpu, "client thread");
+  t->conns = calloc(t->n, sizeof(*t->conns));
+  t->fifo = calloc(t->n + 1, sizeof(int64_t));
+  t->due = calloc(t->n + 1, sizeof(int64_t));
+  events = calloc(C10K_EVENTS, sizeof(*events));
+  buf = malloc(size);
+  if (t->conns == NULL || t->fifo == NULL || t->due == NULL ||
+      events == NULL || buf == NULL)
+    errExit("malloc");
+  memset(buf, 0, size);
+  t->lat_min = INT64_MAX;
+
+  if ((efd = epoll_create1(0)) == -1)
+    errExit("epoll_create1");
+  for (k = 0; k < t->n; k++) {
+    t->conns[k].fd = c10k_connect(t->first + k);
+    ev.events = EPOLLIN;
+    ev.data.u64 = k;
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, t->conns[k].fd, &ev) == -1)
+      errExit("epoll_ctl");
+  }
+  pthread_barrier_wait(&up);
+  pthread_barrier_wait(&go);
+
+  /* spread the active connections evenly over the index space */
+  for (k = 0; k < t->n; k++) {
+    c = t->first + k;
+    if ((int64_t)((c + 1) * active_ratio) > (int64_t)(c * active_ratio))
+      c10k_send(&t->conns[k], buf);
+  }
+
+  while ((now = kutils_now_ns()) < t_end) {
+    timeout = t_end - now;
+    if (head != tail && t->due[head] - now < timeout)
+      timeout = t->due[head] > now ? t->due[head] - now : 0;
+    n = c10k_wait(efd, events, timeout);
+    if (n == -1 && errno != EINTR)
+      errExit("epoll_pwait2");
+    now = kutils_now_ns();
+    for (j = 0; j < n; j++) {
+      cn = &t->conns[events[j].data.u64];
+      r = read(cn->fd, buf, size - cn->got);
+      if (r <= 0) {
+        if (r == -1 && errno == EAGAIN)
+          continue;
+        fprintf(stderr, "client: connection closed by the server\n");
+        exit(EXIT_FAILURE);
+      }
+      cn->got += r;
+      if (cn->got < size)
+        continue;
+      cn->got = 0;
+      if (now >= t_end)
+        break;
+      lat = now - cn->t_send;
+      khist_add(&t->hist, lat);
+      t->lat_sum += lat;
+      t->lat_min = lat < t->lat_min ? lat : t->lat_min;
+      t->lat_max = lat > t->lat_max ? lat : t->lat_max;
+      t->requests++;
+      if (think_us == 0) {
+        c10k_send(cn, buf);
+      } else {
+        t->fifo[tail] = events[j].data.u64;
+        t->due[tail] = now + think_us * 1000LL;
+        tail = (tail + 1) % (t->n + 1);
+      }
+    }
+    for (; head != tail && t->due[head] <= now; head = (head + 1) % (t->n + 1))
+      c10k_send(&t->conns[t->fifo[head]], buf);
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  int64_t conns, seconds, rss0, rss1, slab0, slab1, tcp0, tcp1, t0, t_up, delta;
+  int64_t requests = 0, lat_sum = 0, lat_min = INT64_MAX, lat_max = 0, nactive;
+  struct c10k_thread *threads;
+  struct kstats_summary s;
+  struct sockaddr_in *sin;
+  struct sockaddr_un *sun;
+  struct khist hist;
+  struct rlimit rl;
+  char map[C10K_MAX_CPUS];
+  int ncpus = 0, cpus[C10K_MAX_CPUS];
+  int ap, lfd, serverCPU, nthreads, arch, k, b, yes = 1;
+  uint64_t nwait = 0, nevents = 0, batch[C10K_BATCH_BUCKETS];
+  double active_pct;
+  pid_t pid;
+
+  ap = kopts_parse(argc, argv, KOPT_SCHED | KOPT_SERVER);
+  if (ap < 0 || argc - ap != 9) {
+    printf("usage: c10k_lat [options] <tcp|unix> <connections> <active %%> <request size> <think us> <seconds> <server cpu> <client cpus|none> <client threads>\n");
+    kopts_usage(KOPT_SCHED | KOPT_SERVER);
+    return 1;
+  }
+  if (ksched_check() == -1)
+    return 1;
+
+  if (strcmp(argv[ap], "unix") == 0) {
+    unixsock = 1;
+  } else if (strcmp(argv[ap], "tcp") != 0) {
+    fprintf(stderr, "c10k_lat: transport must be tcp or unix\n");
+    return 1;
+  }
+  conns = atol(argv[ap + 1]);
+  active_pct = atof(argv[ap + 2]);
+  size = atoi(argv[ap + 3]);
+  think_us = atoi(argv[ap + 4]);
+  seconds = atol(argv[ap + 5]);
+  serverCPU = atoi(argv[ap + 6]);
+  nthreads = atoi(argv[ap + 8]);
+  if (strcmp(argv[ap + 7], "none") != 0) {
+    if (ktopo_parse_list(argv[ap + 7], map, C10K_MAX_CPUS) == 0) {
+      fprintf(stderr, "c10k_lat: bad client cpu list '%s' (or none)\n",
+              argv[ap + 7]);
+      return 1;
+    }
+    for (k = 0; k < C10K_MAX_CPUS; k++)
+      if (map[k])
+        cpus[ncpus++] = k;
+  }
+  if (conns < 1 || size < 1 || think_us < 0 || seconds < 1 || nthreads < 1 ||
+      nthreads > conns || active_pct < 0 || active_pct > 100) {
+    fprintf(stderr, "c10k_lat: bad arguments\n");
+    return 1;
+  }
+  active_ratio = active_pct / 100.0;
+
+  /*
+   * Every connection costs an fd on both sides, plus some slack. The
+   * server sizes its per fd tables from the soft limit, so it is set to
+   * what the run needs rather than to a hard limit that may be huge.
+   */
+  getrlimit(RLIMIT_NOFILE, &rl);
+  if (rl.rlim_max == RLIM_INFINITY ||
+      (int64_t)rl.rlim_max > conns + C10K_FD_SLACK)
+    rl.rlim_cur = conns + C10K_FD_SLACK;
+  else
+    rl.rlim_cur = rl.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &rl);
+  if ((int64_t)rl.rlim_cur < conns + 64) {
+    fprintf(stderr, "c10k_lat: RLIMIT_NOFILE of %lu is too low for %" PRId64
+            " connections\n", (unsigned long)rl.rlim_cur, conns);
+    return 1;
+  }
+
+  sh = mmap(NULL, sizeof(*sh), PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (sh == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+  if (c10k_parse_server(&arch, serverCPU) == -1 ||
+      c10k_parse_handler(arch) == -1)
+    return 1;
+
+  /* bound before fork() so the client knows the address */
+  memset(&server_addr, 0, sizeof(server_addr));
+  if (unixsock) {
+    sun = (struct sockaddr_un *)&server_addr;
+    sun->sun_family = AF_UNIX;
+    /* abstract name */
+    snprintf(sun->sun_path + 1, sizeof(sun->sun_path) - 1, "c10k_lat.%d",
+             getpid());
+    server_len = offsetof(struct sockaddr_un, sun_path) + 1 +
+                 strlen(sun->sun_path + 1);
+  } else {
+    sin = (struct sockaddr_in *)&server_addr;
+    sin->sin_family = AF_INET;
+    sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server_len = sizeof(*sin);
+  }
+  if ((lfd = socket(server_addr.ss_family, SOCK_STREAM, 0)) == -1) {
+    perror("socket");
+    return 1;
+  }
+  if (!unixsock) {
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    setsockopt(lfd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    if ((arch == C10K_REUSEPORT || arch == C10K_REUSEPORT_CBPF) &&
+        setsockopt(lfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1) {
+      perror("setsockopt SO_REUSEPORT");
+      return 1;
+    }
+  }
+  if (bind(lfd, (struct sockaddr *)&server_addr, server_len) == -1 ||
+      getsockname(lfd, (struct sockaddr *)&server_addr, &server_len) == -1 ||
+      listen(lfd, SOMAXCONN) == -1) {
+    perror("bind");
+    return 1;
+  }
+
+  printf("transport: %s\n", unixsock ? "unix" : "tcp");
+  printf("connections: %" PRId64 ", %.1f%% active\n", conns, active_pct);
+  printf("request size: %d octets, think time: %d us\n", size, think_us);
+  printf("client threads: %d\n", nthreads);
+  printf("server: %s, %d %s%s\n", c10k_arch_names[arch], sh->nreactors,
+         arch == C10K_STEAL ? "worker" : "reactor", sh->nreactors > 1 ? "s" : "");
+  if (handler_ns > 0 || arch == C10K_STEAL)
+    printf("handler: %" PRId64 " ns%s", handler_ns, arch == C10K_STEAL ? "" : "\n");
+  if (arch == C10K_STEAL)
+    printf(", skew %d%% to worker 0, replies by the %s\n", skew_pct,
+           reply_io ? "I/O thread" : "worker");
+
+  fflush(stdout);
+  if ((pid = fork()) == -1) {
+    perror("fork");
+    return 1;
+  }
+  if (pid == 0) { /* server */
+    ksched_apply_side(KSCHED_CHILD);
+    c10k_server(lfd, arch, serverCPU);
+    return 0;
+  }
+
+  /* client */
+  close(lfd);
+  ksched_apply_side(KSCHED_PARENT);
+  while (!sh->ready)
+    usleep(1000);
+  rss0 = c10k_rss_kb(pid);
+  slab0 = c10k_meminfo_kb("Slab");
+  tcp0 = c10k_tcp_mem_pages();
+
+  threads = calloc(nthreads, sizeof(*threads));
+  if (threads == NULL) {
+    perror("calloc");
+    return 1;
+  }
+  pthread_barrier_init(&up, NULL, nthreads + 1);
+  pthread_barrier_init(&go, NULL, nthreads + 1);
+  t0 = kutils_now_ns();
+  for (k = 0; k < nthreads; k++) {
+    threads[k].id = k;
+    threads[k].cpu = ncpus ? cpus[k % ncpus] : -1;
+    threads[k].first = conns * k / nthreads;
+    threads[k].n = conns * (k + 1) / nthreads - threads[k].first;
+    if (pthread_create(&threads[k].tid, NULL, c10k_client, &threads[k]) != 0) {
+      perror("pthread_create");
+      return 1;
+    }
+  }
+  pthread_barrier_wait(&up);
+  while (__atomic_load_n(&sh->accepted, __ATOMIC_ACQUIRE) < conns)
+    usleep(1000);
+  t_up = kutils_now_ns() - t0;
+
+  /* let the server settle, then take the idle connection cost */
+  usleep(100000);
+  rss1 = c10k_rss_kb(pid);
+  slab1 = c10k_meminfo_kb("Slab");
+  tcp1 = c10k_tcp_mem_pages();
+  for (k = 0; k < sh->nreactors; k++) {
+    memset(sh->r[k].batch, 0, sizeof(sh->r[k].batch));
+    sh->r[k].nwait = sh->r[k].nevents = 0;
+    sh->r[k].requests = sh->r[k].steals = 0;
+  }
+  memset(sh->io.batch, 0, sizeof(sh->io.batch));
+  sh->io.nwait = sh->io.nevents = 0;
+
+  t0 = kutils_now_ns();
+  t_end = t0 + seconds * 1000000000;
+  pthread_barrier_wait(&go);
+  memset(&hist, 0, sizeof(hist));
+  for (k = 0; k < nthreads; k++) {
+    pthread_join(threads[k].tid, NULL);
+    requests += threads[k].requests;
+    lat_sum += threads[k].lat_sum;
+    if (threads[k].requests > 0) {
+      lat_min = threads[k].lat_min < lat_min ? threads[k].lat_min : lat_min;
+      lat_max = threads[k].lat_max > lat_max ? threads[k].lat_max : lat_max;
+    }
+    khist_merge(&hist, &threads[k].hist);
+  }
+  delta = kutils_now_ns() - t0;
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+
+  for (k = 0, nactive = 0; k < conns; k++)
+    nactive += (int64_t)((k + 1) * active_ratio) > (int64_t)(k * active_ratio);
+  printf("active connections: %" PRId64 ", idle: %" PRId64 "\n", nactive,
+         conns - nactive);
+  printf("connection setup: %.1f ms\n", t_up / 1e6);
+  printf("requests: %" PRId64 " in %.2f s, %.0f requests/s\n", requests,
+         delta / 1e9, requests / (delta / 1e9));
+
+  memset(&s, 0, sizeof(s));
+  s.n = requests;
+  if (requests > 0) {
+    s.min = lat_min;
+    s.max = lat_max;
+    s.avg = lat_sum / requests;
+    s.p50 = khist_percentile(&hist, 50.0);
+    s.p90 = khist_percentile(&hist, 90.0);
+    s.p99 = khist_percentile(&hist, 99.0);
+    s.p999 = khist_percentile(&hist, 99.9);
+  }
+  kstats_print_header("latency (ns)");
+  kstats_print_row("request", &s);
+
+  printf("server rss: %" PRId64 " kB idle, %" PRId64 " kB with all connections, "
+         "%.0f bytes per connection\n", rss0, rss1,
+         (rss1 - rss0) * 1024.0 / conns);
+  if (slab0 >= 0 && slab1 >= 0)
+    printf("kernel slab: %+" PRId64 " kB, %.0f bytes per connection "
+           "(both ends, system wide)\n", slab1 - slab0,
+           (slab1 - slab0) * 1024.0 / conns);
+  if (!unixsock && tcp0 >= 0 && tcp1 >= 0)
+    printf("tcp buffer memory: %+" PRId64 " pages\n", tcp1 - tcp0);
+
+  memset(batch, 0, sizeof(batch));
+  if (arch == C10K_STEAL) {
+    nwait = sh->io.nwait;
+    nevents = sh->io.nevents;
+    memcpy(batch, sh->io.batch, sizeof(batch));
+    printf("%8s %5s %12s %12s %12s\n", "worker", "cpu", "requests",
+           "requests/s", "stolen");
+    for (k = 0; k < sh->nreactors; k++)
+      printf("%8d %5d %12" PRId64 " %12.0f %11.1f%%\n", k, sh->r[k].cpu,
+             sh->r[k].requests, sh->r[k].requests / (delta / 1e9),
+             sh->r[k].requests ? 100.0 * sh->r[k].steals / sh->r[k].requests
+             : 0.0);
+  } else if (sh->nreactors > 1) {
+    printf("%8s %5s %12s %12s %12s %10s\n", "reactor", "cpu", "connections",
+           "requests", "requests/s", "batch");
+  }
+  for (k = 0; arch != C10K_STEAL && k < sh->nreactors; k++) {
+    nwait += sh->r[k].nwait;
+    nevents += sh->r[k].nevents;
+    for (b = 0; b < C10K_BATCH_BUCKETS; b++)
+      batch[b] += sh->r[k].batch[b];
+    if (sh->nreactors > 1)
+      printf("%8d %5d %12" PRId64 " %12" PRId64 " %12.0f %10.2f\n", k,
+             sh->r[k].cpu, sh->r[k].conns, sh->r[k].requests,
+             sh->r[k].requests / (delta / 1e9), sh->r[k].nwait ?
+             (double)sh->r[k].nevents / sh->r[k].nwait : 0.0);
+  }
+
+  printf("server epoll_wait: %" PRIu64 " calls, %.2f events per call\n",
+         nwait, nwait ? (double)nevents / nwait : 0.0);
+  printf("%16s %12s %8s\n", "events", "calls", "share");
+  for (b = 0; b < C10K_BATCH_BUCKETS; b++) {
+    char label[32];
+
+    if (batch[b] == 0)
+      continue;
+    if (b == 0)
+      snprintf(label, sizeof(label), "1");
+    else if (b == C10K_BATCH_BUCKETS - 1)
+      snprintf(label, sizeof(label), "%d+", 1 << b);
+    else
+      snprintf(label, sizeof(label), "%d-%d", 1 << b, (1 << (b + 1)) - 1);
+    printf("%16s %12" PRIu64 " %7.2f%%\n", label, batch[b],
+           100.0 * batch[b] / nwait);
+  }
+  return 0;
+}
@@ -32,9 +32,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 #include "KUtils.h"
+#include "KSched.h"
+#include "KBuf.h"
+#include "KCounters.h"
+#include "KThreads.h"
+#include "KAntag.h"
+#include "KHiccup.h"
+#include "KPoll.h"
+#include "KStream.h"
+#include "KTrace.h"
+#include "KCold.h"
+#include "KPower.h"
+#include "KNuma.h"
+#include "KPhase.h"
+#include "KSchedTrace.h"
 
 #if defined(_POSIX_TIMERS) && (_POSIX_TIMERS > 0) &&                           \
     defined(_POSIX_MONOTONIC_CLOCK)
@@ -52,7 +67,7 @@ int main(int argc, char *argv[]) {
   int ofds[2];
   int ifds[2];
 
-  int size;
+  int size, resp, bsize;
   char *buf;
   int64_t count, i, delta;
 #ifdef HAS_CLOCK_GETTIME_MONOTONIC
@@ -63,27 +78,81 @@ int main(int argc, char *argv[]) {
   cpu_set_t set;
   int parentCPU, childCPU;
   bool isEnableAngelSignals;
-
-  if (argc != 6) {
-    printf("usage: pipe_lat <message-size> <roundtrip-count> <parent cpu> <child cpu> <Enable(1)/Disable(0) angel signals>\n");
+  struct kphase phase, *ph = NULL;
+  int64_t t_read_enter;
+  struct klat rtt, *lat = NULL;
+  struct kschedtrace strace, *st = NULL;
+  int64_t t_rtt = 0, t_end;
+  pid_t child;
+  struct kpower power;
+  int power_cpus[2];
+  struct kcounters counters, *kc = NULL;
+  struct kantag ka;
+  int64_t t_ant;
+  int pass;
+  struct khiccup hiccup, *hm = NULL;
+  struct kpoll kp;
+  struct kcold cold;
+  struct ktrace ktr;
+  char *cbuf;
+  int64_t t_cold;
+  int ap;
+
+  ap = kopts_parse(argc, argv, KOPT_PHASES | KOPT_HIST | KOPT_SCHEDTRACE | KOPT_SCHED | KOPT_POWER | KOPT_NUMA | KOPT_BUF | KOPT_COUNTERS | KOPT_COLD | KOPT_ANTAG | KOPT_HICCUP | KOPT_THREADS | KOPT_POLL | KOPT_RESPONSE | KOPT_TRACE | KOPT_STREAM);
+  if (ap < 0 || argc - ap != 5) {
+    printf("usage: pipe_lat [options] <message-size> <roundtrip-count> <parent cpu> <child cpu> <Enable(1)/Disable(0) angel signals>\n");
+    kopts_usage(KOPT_PHASES | KOPT_HIST | KOPT_SCHEDTRACE | KOPT_SCHED | KOPT_POWER | KOPT_NUMA | KOPT_BUF | KOPT_COUNTERS | KOPT_COLD | KOPT_ANTAG | KOPT_HICCUP | KOPT_THREADS | KOPT_POLL | KOPT_RESPONSE | KOPT_TRACE | KOPT_STREAM);
     return 1;
   }
 
-  size = atoi(argv[1]);
-  count = atol(argv[2]);
-  parentCPU = atoi(argv[3]);
-  childCPU = atoi(argv[4]);
-  isEnableAngelSignals = atoi(argv[5]);
+  if (ksched_check() == -1 || kbuf_mode_get() == -1 || knuma_check() == -1 ||
+      kcold_parse(&cold) == -1 || kstream_check() == -1)
+    return 1;
+
+  size = atoi(argv[ap]);
+  count = atol(argv[ap + 1]);
+  parentCPU = atoi(argv[ap + 2]);
+  childCPU = atoi(argv[ap + 3]);
+  isEnableAngelSignals = atoi(argv[ap + 4]);
   CPU_ZERO(&set);
 
-  buf = malloc(size);
+  if ((resp = kopts_response(size)) == -1)
+    return 1;
+  bsize = resp > size ? resp : size;
+
+  if (kantag_parse(&ka, count) == -1 || khiccup_parse(&hiccup, count) == -1 ||
+      kpoll_parse(&kp) == -1 || ktrace_parse(&ktr, size, count, 0) == -1)
+    return 1;
+  if (kopts.hiccup != NULL)
+    hm = &hiccup;
+
+  buf = kbuf_alloc(bsize);
   if (buf == NULL) {
-    perror("malloc");
+    perror("kbuf_alloc");
     return 1;
   }
 
+  if (kopts.phases) {
+    if (kphase_init(&phase, count, size) == -1)
+      return 1;
+    ph = &phase;
+  }
+
+  if (kopts.hist) {
+    if (klat_init(&rtt, count) == -1)
+      return 1;
+    lat = &rtt;
+  }
+
   printf("message size: %i octets\n", size);
+  if (resp != size)
+    printf("response size: %i octets\n", resp);
   printf("roundtrip count: %li\n", count);
+  kbuf_describe(bsize);
+
+  if (kopts.threads)
+    return kthreads_run(KTHREADS_PIPE, KTHREADS_LAT, size, count, parentCPU,
+                        childCPU);
 
   if (pipe(ofds) == -1) {
     perror("pipe");
@@ -95,25 +164,78 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  if (!fork()) { /* child */
+  if (kopts.counters) {
+    kcounters_open(&counters);
+    kc = &counters;
+  }
+
+  child = fork();
+  if (!child) { /* child */
     CPU_SET(childCPU, &set);
 
     if (sched_setaffinity(getpid(), sizeof(set), &set) == -1){
      errExit("sched_setaffinity of child failed");
     }
 
+    ksched_apply_side(KSCHED_CHILD);
+    kbuf_side(buf, bsize);
+    buf = knuma_buffer(buf, bsize, KNUMA_CHILD, childCPU);
+    kcold_side(&cold, size);
+    kpoll_setup(&kp, ifds[0]);
+
+    kpoll_begin(&kp);
     for (i = 0; i < count; i++) {
 
-      if (read(ifds[0], buf, size) != size) {
+      t_read_enter = kphase_recv_begin(ph, ifds[0]);
+      if (kstream_recv(&kp, ifds[0], buf, size) != size) {
         perror("read");
         return 1;
       }
+      kphase_recv_end(ph, 2 * i, buf, t_read_enter);
 
-      if (write(ofds[1], buf, size) != size) {
+      kphase_send_begin(ph, 2 * i + 1, buf);
+      if (kstream_write(ofds[1], buf, resp) != resp) {
         perror("write");
         return 1;
       }
+      kphase_send_end(ph, 2 * i + 1);
     }
+    kpoll_end(&kp, KPOLL_CHILD);
+
+    for (i = 0; cold.mode != KCOLD_NONE && i < count; i++) {
+      cbuf = kcold_buf(&cold, buf, i);
+
+      if (kstream_read(ifds[0], cbuf, size) != size) {
+        perror("read");
+        return 1;
+      }
+
+      if (kstream_write(ofds[1], cbuf, size) != size) {
+        perror("write");
+        return 1;
+      }
+
+      kcold_wait(&cold, KCOLD_CHILD, i + 1);
+      kcold_evict(&cold, cbuf, size);
+      kcold_done(&cold, KCOLD_CHILD, i);
+    }
+
+    /* quiet and loaded pass of --antagonist */
+    for (i = 0; ka.n > 0 && i < 2 * count; i++) {
+
+      if (kstream_read(ifds[0], buf, size) != size) {
+        perror("read");
+        return 1;
+      }
+
+      if (kstream_write(ofds[1], buf, size) != size) {
+        perror("write");
+        return 1;
+      }
+    }
+
+    if (ktr.n > 0 && ktrace_child(&ktr, ifds[0], ofds[1]) == -1)
+      return 1;
   } else { /* parent */
     CPU_SET(parentCPU, &set);
 
@@ -121,6 +243,20 @@ int main(int argc, char *argv[]) {
      errExit("sched_setaffinity of parent failed");
     }
 
+    ksched_apply_side(KSCHED_PARENT);
+    kbuf_side(buf, bsize);
+    buf = knuma_buffer(buf, bsize, KNUMA_PARENT, parentCPU);
+    kcold_side(&cold, size);
+    kpoll_setup(&kp, ofds[0]);
+
+    if (kopts.schedtrace) {
+      if (kschedtrace_open(&strace, getpid(), child, parentCPU, childCPU,
+                           2 * count) == 0)
+        st = &strace;
+      else
+        fprintf(stderr, "schedtrace: collector disabled\n");
+    }
+
 #ifdef ANGEL
     if( isEnableAngelSignals )
     {
@@ -128,6 +264,15 @@ int main(int argc, char *argv[]) {
     }
 #endif
 
+    if (kopts.power) {
+      power_cpus[0] = parentCPU;
+      power_cpus[1] = childCPU;
+      if (kpower_begin(&power, power_cpus, 2) == -1)
+        return 1;
+    }
+
+    khiccup_begin(hm, parentCPU, childCPU);
+
 #ifdef HAS_CLOCK_GETTIME_MONOTONIC
     if (clock_gettime(CLOCK_MONOTONIC, &start) == -1) {
       perror("clock_gettime");
@@ -140,19 +285,44 @@ int main(int argc, char *argv[]) {
     }
 #endif
 
+    kcounters_enable(kc);
+    kpoll_begin(&kp);
+
+    if (st != NULL)
+      kschedtrace_enable(st);
+
     for (i = 0; i < count; i++) {
 
-      if (write(ifds[1], buf, size) != size) {
+      if (lat != NULL || hm != NULL)
+        t_rtt = kutils_now_ns();
+
+      kphase_send_begin(ph, 2 * i, buf);
+      if (kstream_write(ifds[1], buf, size) != size) {
         perror("write");
         return 1;
       }
+      kphase_send_end(ph, 2 * i);
 
-      if (read(ofds[0], buf, size) != size) {
+      t_read_enter = kphase_recv_begin(ph, ofds[0]);
+      if (kstream_recv(&kp, ofds[0], buf, resp) != resp) {
         perror("read");
         return 1;
       }
+      kphase_recv_end(ph, 2 * i + 1, buf, t_read_enter);
+
+      if (lat != NULL || hm != NULL) {
+        t_end = kutils_now_ns();
+        klat_record(lat, t_end - t_rtt);
+        khiccup_rt(hm, t_rtt, t_end);
+      }
     }
 
+    if (st != NULL)
+      kschedtrace_disable(st);
+
+    kpoll_end(&kp, KPOLL_PARENT);
+    kcounters_disable(kc);
+
 #ifdef HAS_CLOCK_GETTIME_MONOTONIC
     if (clock_gettime(CLOCK_MONOTONIC, &stop) == -1) {
       perror("clock_gettime");
@@ -173,7 +343,92 @@ int main(int argc, char *argv[]) {
 
 #endif
 
+    khiccup_end(hm, parentCPU, childCPU);
+
     printf("average latency: %li ns\n", delta / (count * 2));
+    kstream_report(delta, count, size, resp);
+
+    if (kopts.power) {
+      kpower_end(&power);
+      kpower_report(&power);
+    }
+
+    for (i = 0; cold.mode != KCOLD_NONE && i < count; i++) {
+      cbuf = kcold_buf(&cold, buf, i);
+      kcold_wait(&cold, KCOLD_PARENT, i);
+      t_cold = kutils_now_ns();
+
+      if (kstream_write(ifds[1], cbuf, size) != size) {
+        perror("write");
+        return 1;
+      }
+
+      if (kstream_read(ofds[0], cbuf, size) != size) {
+        perror("read");
+        return 1;
+      }
+
+      cold.delta_ns += kutils_now_ns() - t_cold;
+      kcold_done(&cold, KCOLD_PARENT, i);
+      kcold_evict(&cold, cbuf, size);
+    }
+    if (cold.mode != KCOLD_NONE)
+      kcold_report(&cold, delta, count);
+
+    if (ka.n > 0) {
+      for (pass = 0; pass < 2; pass++) {
+        if (pass == 1)
+          kantag_start(&ka);
+        for (i = 0; i < count; i++) {
+          t_ant = kutils_now_ns();
+
+          if (kstream_write(ifds[1], buf, size) != size) {
+            perror("write");
+            return 1;
+          }
+
+          if (kstream_read(ofds[0], buf, size) != size) {
+            perror("read");
+            return 1;
+          }
+
+          klat_record(&ka.lat[pass], kutils_now_ns() - t_ant);
+        }
+      }
+      kantag_stop(&ka);
+      kantag_report(&ka, "round trip");
+    }
+
+    if (ktr.n > 0 && ktrace_parent(&ktr, ifds[1], ofds[0]) == -1)
+      return 1;
+
+    if (ph != NULL) {
+      wait(NULL);
+      kphase_report(ph, "pipe");
+    }
+
+    if (lat != NULL) {
+      klat_report(lat, "round trip");
+      if (st != NULL) {
+        kschedtrace_collect(st);
+        kschedtrace_report(st, lat, "round trip");
+      } else {
+        klat_print_hist(lat, "round trip");
+      }
+    }
+
+    if (kp.use != NULL) {
+      wait(NULL);
+      kpoll_report(&kp, count);
+    }
+
+    if (hm != NULL)
+      khiccup_report(hm, "round trips");
+
+    if (kc != NULL) {
+      wait(NULL);
+      kcounters_report(kc, count, "per roundtrip");
+    }
 
 #ifdef ANGEL
     if( isEnableAngelSignals )
@@ -26,12 +26,20 @@
     OTHER DEALINGS IN THE SOFTWARE.
 */
 
+#define _GNU_SOURCE
+#include <sched.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
+#include "KUtils.h"
+#include "KBuf.h"
+#include "KCounters.h"
+#include "KThreads.h"
+#include "KNuma.h"
 
 #if defined(_POSIX_TIMERS) && (_POSIX_TIMERS > 0) &&                           \
     defined(_POSIX_MONOTONIC_CLOCK)
@@ -49,32 +57,66 @@ int main(int argc, char *argv[]) {
 #else
   struct timeval start, stop;
 #endif
-
-  if (argc != 3) {
-    printf("usage: pipe_thr <message-size> <message-count>\n");
+  cpu_set_t set;
+  int parentCPU = -1, childCPU = -1;
+  struct kcounters counters, *kc = NULL;
+  int ap;
+
+  ap = kopts_parse(argc, argv, KOPT_NUMA | KOPT_BUF | KOPT_COUNTERS | KOPT_THREADS);
+  if (ap < 0 || (argc - ap != 2 && argc - ap != 4)) {
+    printf("usage: pipe_thr [options] <message-size> <message-count> [<parent cpu> <child cpu>]\n");
+    kopts_usage(KOPT_NUMA | KOPT_BUF | KOPT_COUNTERS | KOPT_THREADS);
     return 1;
   }
 
-  size = atoi(argv[1]);
-  count = atol(argv[2]);
+  if (knuma_check() == -1 || kbuf_mode_get() == -1)
+    return 1;
 
-  buf = malloc(size);
+  size = atoi(argv[ap]);
+  count = atol(argv[ap + 1]);
+  if (argc - ap == 4) {
+    parentCPU = atoi(argv[ap + 2]);
+    childCPU = atoi(argv[ap + 3]);
+  }
+
+  buf = kbuf_alloc(size);
   if (buf == NULL) {
-    perror("malloc");
+    perror("kbuf_alloc");
     return 1;
   }
 
   printf("message size: %i octets\n", size);
   printf("message count: %li\n", count);
+  kbuf_describe(size);
+
+  if (kopts.threads)
+    return kthreads_run(KTHREADS_PIPE, KTHREADS_THR, size, count, parentCPU,
+                        childCPU);
 
   if (pipe(fds) == -1) {
     perror("pipe");
     return 1;
   }
 
+  if (kopts.counters) {
+    kcounters_open(&counters);
+    kc = &counters;
+  }
+
   if (!fork()) {
     /* child */
 
+    if (childCPU >= 0) {
+      CPU_ZERO(&set);
+      CPU_SET(childCPU, &set);
+      if (sched_setaffinity(getpid(), sizeof(set), &set) == -1) {
+        perror("sched_setaffinity of child failed");
+        return 1;
+      }
+    }
+    kbuf_side(buf, size);
+    buf = knuma_buffer(buf, size, KNUMA_CHILD, childCPU);
+
     for (i = 0; i < count; i++) {
       if (read(fds[0], buf, size) != size) {
         perror("read");
@@ -84,6 +126,17 @@ int main(int argc, char *argv[]) {
   } else {
 /* parent */
 
+    if (parentCPU >= 0) {
+      CPU_ZERO(&set);
+      CPU_SET(parentCPU, &set);
+      if (sched_setaffinity(getpid(), sizeof(set), &set) == -1) {
+        perror("sched_setaffinity of parent failed");
+        return 1;
+      }
+    }
+    kbuf_side(buf, size);
+    buf = knuma_buffer(buf, size, KNUMA_PARENT, parentCPU);
+
 #ifdef HAS_CLOCK_GETTIME_MONOTONIC
     if (clock_gettime(CLOCK_MONOTONIC, &start) == -1) {
       perror("clock_gettime");
@@ -96,6 +149,8 @@ int main(int argc, char *argv[]) {
     }
 #endif
 
+    kcounters_enable(kc);
+
     for (i = 0; i < count; i++) {
       if (write(fds[1], buf, size) != size) {
         perror("write");
@@ -103,6 +158,8 @@ int main(int argc, char *argv[]) {
       }
     }
 
+    kcounters_disable(kc);
+
 #ifdef HAS_CLOCK_GETTIME_MONOTONIC
     if (clock_gettime(CLOCK_MONOTONIC, &stop) == -1) {
       perror("clock_gettime");
@@ -126,6 +183,11 @@ int main(int argc, char *argv[]) {
     printf("average throughput: %li msg/s\n", (count * 1000000) / delta);
     printf("average throughput: %li Mb/s\n",
            (((count * 1000000) / delta) * size * 8) / 1000000);
+
+    if (kc != NULL) {
+      wait(NULL);
+      kcounters_report(kc, count, "per message");
+    }
   }
 
   return 0;
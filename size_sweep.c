@@ -0,0 +1,126 @@
+/*
+    Sweep request and response sizes of a ping-pong latency benchmark
+
+    Runs one of pipe_lat, unix_lat, tcp_lat, udp_lat, their *_self_lat and
+    *_nonoverlap variants once per pair of request size and response size
+    (the response size is passed as --response) and tabulates the average
+    latency as a 2D grid, request sizes down and response sizes across.
+    Small requests with large responses are the shape of a key-value GET,
+    large requests with small responses the shape of a PUT.
+
+    A size list is either a comma separated list or <from>:<to>[:<factor>],
+    the sizes from..to multiplied by factor (default 2) each step. The
+    arguments after the size lists are the benchmark's own arguments that
+    follow <message-size>, options included, e.g.
+
+      size_sweep tcp_lat 16:4096:4 16:65536:4 10000 0 1 0
+
+    The benchmark binaries are looked up next to this one with the same
+    suffix, as by topo_sweep (see KSweep.h).
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "KSweep.h"
+
+#define MAX_SIZES 32
+#define MAX_ARGS 64
+
+/* Parses a size list into sizes[]; returns the count or -1. */
+static int parse_sizes(const char *spec, long sizes[MAX_SIZES])
+{
+  long from, to, factor = 2, s;
+  const char *p = spec;
+  char *end;
+  int n = 0;
+
+  if (strchr(spec, ':') != NULL) {
+    from = strtol(p, &end, 10);
+    if (*end != ':')
+      goto bad;
+    to = strtol(end + 1, &end, 10);
+    if (*end == ':')
+      factor = strtol(end + 1, &end, 10);
+    if (*end || from < 1 || to < from || factor < 2)
+      goto bad;
+    for (s = from; s <= to && n < MAX_SIZES; s *= factor)
+      sizes[n++] = s;
+    return n;
+  }
+
+  while (*p) {
+    s = strtol(p, &end, 10);
+    if (end == p || s < 1 || (*end && *end != ',') || n == MAX_SIZES)
+      goto bad;
+    sizes[n++] = s;
+    p = *end ? end + 1 : end;
+  }
+  if (n > 0)
+    return n;
+
+bad:
+  fprintf(stderr, "bad size list '%s' (<n>[,<n>...] or <from>:<to>[:<factor>],"
+          " up to %d sizes)\n", spec, MAX_SIZES);
+  return -1;
+}
+
+int main(int argc, char *argv[]) {
+  long req[MAX_SIZES], resp[MAX_SIZES];
+  long avg[MAX_SIZES][MAX_SIZES];
+  char path[512], rsize[32], qsize[32];
+  char *bargv[MAX_ARGS];
+  struct ksweep ks;
+  int nreq, nresp, nargs, q, r, k;
+
+  if (argc < 5 || argc - 4 + 3 > MAX_ARGS) {
+    printf("usage: size_sweep <benchmark> <request sizes> <response sizes> <benchmark args after message-size...>\n");
+    return 1;
+  }
+
+  if ((nreq = parse_sizes(argv[2], req)) == -1 ||
+      (nresp = parse_sizes(argv[3], resp)) == -1)
+    return 1;
+
+  ksweep_init(&ks, argv[0], "size_sweep");
+  ksweep_path(&ks, argv[1], path, sizeof(path));
+
+  /* <path> --response=<r> <q> <benchmark args...> */
+  nargs = 0;
+  bargv[nargs++] = path;
+  bargv[nargs++] = rsize;
+  bargv[nargs++] = qsize;
+  for (k = 4; k < argc; k++)
+    bargv[nargs++] = argv[k];
+  bargv[nargs] = NULL;
+
+  for (q = 0; q < nreq; q++) {
+    for (r = 0; r < nresp; r++) {
+      snprintf(rsize, sizeof(rsize), "--response=%li", resp[r]);
+      snprintf(qsize, sizeof(qsize), "%li", req[q]);
+      printf("%s: request %li, response %li\n", argv[1], req[q], resp[r]);
+      avg[q][r] = ksweep_run(bargv);
+    }
+  }
+
+  printf("\naverage latency (ns) of %s, request size down, response size "
+         "across:\n", argv[1]);
+  printf("%10s", "req\\resp");
+  for (r = 0; r < nresp; r++)
+    printf(" %10li", resp[r]);
+  printf("\n");
+
+  for (q = 0; q < nreq; q++) {
+    printf("%10li", req[q]);
+    for (r = 0; r < nresp; r++) {
+      if (avg[q][r] < 0)
+        printf(" %10s", "failed");
+      else
+        printf(" %10li", avg[q][r]);
+    }
+    printf("\n");
+  }
+
+  return 0;
+}
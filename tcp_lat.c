@@ -33,8 +33,23 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 #include <netdb.h>
 #include "KUtils.h"
+#include "KSched.h"
+#include "KBuf.h"
+#include "KCounters.h"
+#include "KThreads.h"
+#include "KAntag.h"
+#include "KHiccup.h"
+#include "KPoll.h"
+#include "KDepth.h"
+#include "KTrace.h"
+#include "KCold.h"
+#include "KPower.h"
+#include "KNuma.h"
+#include "KPhase.h"
+#include "KTstamp.h"
 #include <time.h>
 #include <unistd.h>
 
@@ -51,7 +66,7 @@ typedef int bool;
 #define true  1
 
 int main(int argc, char *argv[]) {
-  int size;
+  int size, resp, bsize;
   char *buf;
   int64_t count, i, delta;
 #ifdef HAS_CLOCK_GETTIME_MONOTONIC
@@ -64,6 +79,23 @@ int main(int argc, char *argv[]) {
   cpu_set_t set;
   int parentCPU, childCPU;
   bool isEnableAngelSignals;
+  struct kphase phase, *ph = NULL;
+  struct ktstamp tstamp, *ts = NULL;
+  int64_t t_read_enter, t_hic = 0;
+  struct kpower power;
+  int power_cpus[2];
+  struct kcounters counters, *kc = NULL;
+  struct kantag ka;
+  int64_t t_ant;
+  int pass;
+  struct khiccup hiccup, *hm = NULL;
+  struct kpoll kp;
+  struct kdepth kd;
+  struct ktrace ktr;
+  struct kcold cold;
+  char *cbuf;
+  int64_t t_cold;
+  int ap;
 
   ssize_t len;
   size_t sofar;
@@ -76,29 +108,58 @@ int main(int argc, char *argv[]) {
   struct addrinfo *res;
   int sockfd, new_fd;
 
-  if (argc != 6) {
-    printf("usage: tcp_lat <message-size> <roundtrip-count> <parent cpu> <child cpu> <Enable(1)/Disable(0) angel signals>\n");
+  ap = kopts_parse(argc, argv, KOPT_PHASES | KOPT_TSTAMP | KOPT_SCHED | KOPT_POWER | KOPT_NUMA | KOPT_BUF | KOPT_COUNTERS | KOPT_COLD | KOPT_ANTAG | KOPT_HICCUP | KOPT_THREADS | KOPT_POLL | KOPT_DEPTH | KOPT_RESPONSE | KOPT_TRACE);
+  if (ap < 0 || argc - ap != 5) {
+    printf("usage: tcp_lat [options] <message-size> <roundtrip-count> <parent cpu> <child cpu> <Enable(1)/Disable(0) angel signals>\n");
+    kopts_usage(KOPT_PHASES | KOPT_TSTAMP | KOPT_SCHED | KOPT_POWER | KOPT_NUMA | KOPT_BUF | KOPT_COUNTERS | KOPT_COLD | KOPT_ANTAG | KOPT_HICCUP | KOPT_THREADS | KOPT_POLL | KOPT_DEPTH | KOPT_RESPONSE | KOPT_TRACE);
     return 1;
   }
 
-  size = atoi(argv[1]);
-  count = atol(argv[2]);
-  parentCPU = atoi(argv[3]);
-  childCPU = atoi(argv[4]);
-  isEnableAngelSignals = atoi(argv[5]);
+  if (ksched_check() == -1 || kbuf_mode_get() == -1 || knuma_check() == -1 ||
+      kcold_parse(&cold) == -1)
+    return 1;
+
+  size = atoi(argv[ap]);
+  count = atol(argv[ap + 1]);
+  parentCPU = atoi(argv[ap + 2]);
+  childCPU = atoi(argv[ap + 3]);
+  isEnableAngelSignals = atoi(argv[ap + 4]);
   CPU_ZERO(&set);
 
+  if ((resp = kopts_response(size)) == -1)
+    return 1;
+  bsize = resp > size ? resp : size;
+
+  if (kantag_parse(&ka, count) == -1 || khiccup_parse(&hiccup, count) == -1 ||
+      kpoll_parse(&kp) == -1 || kdepth_parse(&kd, size, count) == -1 ||
+      ktrace_parse(&ktr, size, count, 0) == -1)
+    return 1;
+  if (kopts.hiccup != NULL)
+    hm = &hiccup;
+
 #ifdef PERF_INSTRUMENT
    perf_event_init( (enable_perf_events) ENABLE_HW_CYCLES_PER );
    perf_event_enable ( (enable_perf_events) ENABLE_HW_CYCLES_PER );
 #endif //PERF_INSTRUMENT_PER
 
-  buf = malloc(size);
+  buf = kbuf_alloc(bsize);
   if (buf == NULL) {
-    perror("malloc");
+    perror("kbuf_alloc");
     return 1;
   }
 
+  if (kopts.phases) {
+    if (kphase_init(&phase, count, size) == -1)
+      return 1;
+    ph = &phase;
+  }
+
+  if (kopts.tstamp) {
+    if (ktstamp_init(&tstamp, count) == -1)
+      return 1;
+    ts = &tstamp;
+  }
+
   memset(&hints, 0, sizeof hints);
   hints.ai_family = AF_UNSPEC; // use IPv4 or IPv6, whichever
   hints.ai_socktype = SOCK_STREAM;
@@ -109,7 +170,19 @@ int main(int argc, char *argv[]) {
   }
 
   printf("message size: %i octets\n", size);
+  if (resp != size)
+    printf("response size: %i octets\n", resp);
   printf("roundtrip count: %li\n", count);
+  kbuf_describe(bsize);
+
+  if (kopts.threads)
+    return kthreads_run(KTHREADS_TCP, KTHREADS_LAT, size, count, parentCPU,
+                        childCPU);
+
+  if (kopts.counters) {
+    kcounters_open(&counters);
+    kc = &counters;
+  }
 
   if (!fork()) { /* child */
     CPU_SET(childCPU, &set);
@@ -118,6 +191,11 @@ int main(int argc, char *argv[]) {
      errExit("sched_setaffinity of child failed");
     }
 
+    ksched_apply_side(KSCHED_CHILD);
+    kbuf_side(buf, bsize);
+    buf = knuma_buffer(buf, bsize, KNUMA_CHILD, childCPU);
+    kcold_side(&cold, size);
+
     if ((sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) ==
         -1) {
       perror("socket");
@@ -147,10 +225,67 @@ int main(int argc, char *argv[]) {
       return 1;
     }
 
+    if (ktstamp_enable(ts, new_fd, 1) == -1)
+      return 1;
+    kpoll_setup(&kp, new_fd);
+
+    kpoll_begin(&kp);
     for (i = 0; i < count; i++) {
 
+      t_read_enter = kphase_recv_begin(ph, new_fd);
+      for (sofar = 0; sofar < size;) {
+        if (ts != NULL)
+          len = ktstamp_recvfrom(ts, new_fd, buf + sofar, size - sofar, NULL, NULL, 2 * i);
+        else
+          len = kpoll_read(&kp, new_fd, buf + sofar, size - sofar);
+        if (len == -1) {
+          perror("read");
+          return 1;
+        }
+        sofar += len;
+      }
+      ktstamp_recv_end(ts, 2 * i);
+      kphase_recv_end(ph, 2 * i, buf, t_read_enter);
+
+      kphase_send_begin(ph, 2 * i + 1, buf);
+      ktstamp_send_begin(ts, 2 * i + 1);
+      if (write(new_fd, buf, resp) != resp) {
+        perror("write");
+        return 1;
+      }
+      kphase_send_end(ph, 2 * i + 1);
+      ktstamp_drain_tx(ts, new_fd, 0);
+    }
+    kpoll_end(&kp, KPOLL_CHILD);
+    ktstamp_drain_tx(ts, new_fd, 1);
+
+    for (i = 0; cold.mode != KCOLD_NONE && i < count; i++) {
+      cbuf = kcold_buf(&cold, buf, i);
+
+      for (sofar = 0; sofar < size;) {
+        len = read(new_fd, cbuf + sofar, size - sofar);
+        if (len == -1) {
+          perror("read");
+          return 1;
+        }
+        sofar += len;
+      }
+
+      if (write(new_fd, cbuf, size) != size) {
+        perror("write");
+        return 1;
+      }
+
+      kcold_wait(&cold, KCOLD_CHILD, i + 1);
+      kcold_evict(&cold, cbuf, size);
+      kcold_done(&cold, KCOLD_CHILD, i);
+    }
+
+    /* quiet and loaded pass of --antagonist */
+    for (i = 0; ka.n > 0 && i < 2 * count; i++) {
+
       for (sofar = 0; sofar < size;) {
-        len = read(new_fd, buf, size - sofar);
+        len = read(new_fd, buf + sofar, size - sofar);
         if (len == -1) {
           perror("read");
           return 1;
@@ -163,6 +298,11 @@ int main(int argc, char *argv[]) {
         return 1;
       }
     }
+
+    if (kd.n > 0 && kdepth_child(&kd, new_fd, count) == -1)
+      return 1;
+    if (ktr.n > 0 && ktrace_child(&ktr, new_fd, new_fd) == -1)
+      return 1;
   } else { /* parent */
 
     sleep(1);
@@ -173,6 +313,11 @@ int main(int argc, char *argv[]) {
      errExit("sched_setaffinity of parent failed");
     }
 
+    ksched_apply_side(KSCHED_PARENT);
+    kbuf_side(buf, bsize);
+    buf = knuma_buffer(buf, bsize, KNUMA_PARENT, parentCPU);
+    kcold_side(&cold, size);
+
     if ((sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) ==
         -1) {
       perror("socket");
@@ -183,6 +328,10 @@ int main(int argc, char *argv[]) {
       perror("connect");
       return 1;
     }
+
+    if (ktstamp_enable(ts, sockfd, 0) == -1)
+      return 1;
+    kpoll_setup(&kp, sockfd);
 #ifdef ANGEL
   if( isEnableAngelSignals )
   {
@@ -190,6 +339,15 @@ int main(int argc, char *argv[]) {
   }
 #endif
 
+    if (kopts.power) {
+      power_cpus[0] = parentCPU;
+      power_cpus[1] = childCPU;
+      if (kpower_begin(&power, power_cpus, 2) == -1)
+        return 1;
+    }
+
+    khiccup_begin(hm, parentCPU, childCPU);
+
 #ifdef HAS_CLOCK_GETTIME_MONOTONIC
     if (clock_gettime(CLOCK_MONOTONIC, &start) == -1) {
       perror("clock_gettime");
@@ -204,23 +362,45 @@ int main(int argc, char *argv[]) {
     beginC = perf_per_cycle_event_read();
 #endif
 
+    kcounters_enable(kc);
+    kpoll_begin(&kp);
+
     for (i = 0; i < count; i++) {
 
+      if (hm != NULL)
+        t_hic = kutils_now_ns();
+
+      kphase_send_begin(ph, 2 * i, buf);
+      ktstamp_send_begin(ts, 2 * i);
       if (write(sockfd, buf, size) != size) {
         perror("write");
         return 1;
       }
-
-      for (sofar = 0; sofar < size;) {
-        len = read(sockfd, buf, size - sofar);
+      kphase_send_end(ph, 2 * i);
+      ktstamp_drain_tx(ts, sockfd, 0);
+
+      t_read_enter = kphase_recv_begin(ph, sockfd);
+      for (sofar = 0; sofar < resp;) {
+        if (ts != NULL)
+          len = ktstamp_recvfrom(ts, sockfd, buf + sofar, resp - sofar, NULL, NULL, 2 * i + 1);
+        else
+          len = kpoll_read(&kp, sockfd, buf + sofar, resp - sofar);
         if (len == -1) {
           perror("read");
           return 1;
         }
         sofar += len;
       }
+      ktstamp_recv_end(ts, 2 * i + 1);
+      kphase_recv_end(ph, 2 * i + 1, buf, t_read_enter);
+
+      if (hm != NULL)
+        khiccup_rt(hm, t_hic, kutils_now_ns());
     }
 
+    kpoll_end(&kp, KPOLL_PARENT);
+    kcounters_disable(kc);
+
 #ifdef HAS_CLOCK_GETTIME_MONOTONIC
     if (clock_gettime(CLOCK_MONOTONIC, &stop) == -1) {
       perror("clock_gettime");
@@ -249,6 +429,94 @@ int main(int argc, char *argv[]) {
    printf("Not supported\n");
 #endif
 
+    if (kopts.power) {
+      kpower_end(&power);
+      kpower_report(&power);
+    }
+
+    khiccup_end(hm, parentCPU, childCPU);
+
+    ktstamp_drain_tx(ts, sockfd, 1);
+
+    for (i = 0; cold.mode != KCOLD_NONE && i < count; i++) {
+      cbuf = kcold_buf(&cold, buf, i);
+      kcold_wait(&cold, KCOLD_PARENT, i);
+      t_cold = kutils_now_ns();
+
+      if (write(sockfd, cbuf, size) != size) {
+        perror("write");
+        return 1;
+      }
+
+      for (sofar = 0; sofar < size;) {
+        len = read(sockfd, cbuf + sofar, size - sofar);
+        if (len == -1) {
+          perror("read");
+          return 1;
+        }
+        sofar += len;
+      }
+
+      cold.delta_ns += kutils_now_ns() - t_cold;
+      kcold_done(&cold, KCOLD_PARENT, i);
+      kcold_evict(&cold, cbuf, size);
+    }
+    if (cold.mode != KCOLD_NONE)
+      kcold_report(&cold, delta, count);
+
+    if (ka.n > 0) {
+      for (pass = 0; pass < 2; pass++) {
+        if (pass == 1)
+          kantag_start(&ka);
+        for (i = 0; i < count; i++) {
+          t_ant = kutils_now_ns();
+
+          if (write(sockfd, buf, size) != size) {
+            perror("write");
+            return 1;
+          }
+
+          for (sofar = 0; sofar < size;) {
+            len = read(sockfd, buf + sofar, size - sofar);
+            if (len == -1) {
+              perror("read");
+              return 1;
+            }
+            sofar += len;
+          }
+
+          klat_record(&ka.lat[pass], kutils_now_ns() - t_ant);
+        }
+      }
+      kantag_stop(&ka);
+      kantag_report(&ka, "round trip");
+    }
+
+    if (kd.n > 0 && kdepth_parent(&kd, sockfd, count) == -1)
+      return 1;
+    if (ktr.n > 0 && ktrace_parent(&ktr, sockfd, sockfd) == -1)
+      return 1;
+
+    if (ph != NULL || ts != NULL)
+      wait(NULL);
+    if (ph != NULL)
+      kphase_report(ph, "tcp");
+    if (ts != NULL)
+      ktstamp_report(ts, "tcp");
+
+    if (kp.use != NULL) {
+      wait(NULL);
+      kpoll_report(&kp, count);
+    }
+
+    if (hm != NULL)
+      khiccup_report(hm, "round trips");
+
+    if (kc != NULL) {
+      wait(NULL);
+      kcounters_report(kc, count, "per roundtrip");
+    }
+
 #ifdef ANGEL
     if( isEnableAngelSignals )
     {
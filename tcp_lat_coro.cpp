@@ -0,0 +1,606 @@
+/*
+    Measure the cost of C++20 coroutines on a tcp ping-pong
+
+    The exchange of tcp_lat_epoll_with_ack --epoll=lt: the client sends
+    <client-send-size> bytes, the server answers with <server-send-size>
+    bytes, for <roundtrip-count> round trips. Both ends are coroutines on a
+    single threaded executor instead of hand-written state machines, so the
+    two binaries make the same syscalls per round trip and the difference
+    in latency is the cost of the coroutine machinery.
+
+    Every round trip is a child coroutine (send_recv / recv_send) awaited
+    by the side's main loop, as a request handler would be, so each round
+    trip allocates a frame, suspends on the read and is resumed by the
+    executor. async_write() sends inline and suspends only when the socket
+    buffer is full; async_read() suspends until data is there:
+
+      --executor=epoll   level triggered EPOLLIN registered once, recv()
+                         after the wakeup (the default)
+      --executor=uring   IORING_OP_RECV on a raw io_uring, the completion
+                         resumes the coroutine with the result
+
+    --frames=pool (the default) serves coroutine frames from per size class
+    free lists, --frames=heap from malloc(). Each side reports suspensions,
+    resumptions, frames and executor waits per round trip; the parent then
+    times a bare suspend / resume and a frame allocate / call / free in a
+    loop, without I/O.
+
+    Needs a C++20 compiler; it is not part of the aarch64 build, whose
+    toolchain predates coroutines.
+*/
+
+#include <coroutine>
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "KUtils.h"
+#include "KSched.h"
+#include "KBuf.h"
+#include "KEpoll.h"
+
+#define errExit(msg)	do { perror(msg); exit(EXIT_FAILURE); \
+							  } while (0)
+
+#define CORO_MAXFD 1024
+#define CORO_CLASS 64                   /* frame size class granularity */
+#define CORO_NCLASSES 32                /* pooled up to 2 KB */
+
+enum { CORO_EPOLL, CORO_URING };
+
+/* Counted per side, handed to the parent in a MAP_SHARED area. */
+struct coro_stats
+{
+  uint64_t nsuspend, nresume, nframe, npool, nwait;
+};
+
+static struct coro_stats *stats;
+static int pool_frames = 1;
+static void *freelist[CORO_NCLASSES];
+
+/* Frame allocation: a size class free list, or malloc() with --frames=heap. */
+static void *coro_alloc(size_t n)
+{
+  size_t c = (n + CORO_CLASS - 1) / CORO_CLASS;
+  void *p;
+
+  stats->nframe++;
+  if (!pool_frames || c >= CORO_NCLASSES)
+    p = malloc(n);
+  else if ((p = freelist[c]) != NULL) {
+    freelist[c] = *(void **)p;
+    stats->npool++;
+  } else
+    p = malloc(c * CORO_CLASS);
+  if (p == NULL)
+    errExit("malloc");
+  return p;
+}
+
+static void coro_free(void *p, size_t n)
+{
+  size_t c = (n + CORO_CLASS - 1) / CORO_CLASS;
+
+  if (!pool_frames || c >= CORO_NCLASSES) {
+    free(p);
+    return;
+  }
+  *(void **)p = freelist[c];
+  freelist[c] = p;
+}
+
+/*
+ * A lazily started coroutine returning an int. Awaiting it starts it, and
+ * its final suspend transfers straight back to the awaiter.
+ */
+struct task
+{
+  struct promise_type
+  {
+    std::coroutine_handle<> cont;
+    int result = 0;
+
+    task get_return_object()
+    {
+      return task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct final_awaiter
+    {
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<>
+      await_suspend(std::coroutine_handle<promise_type> h) noexcept
+      {
+        if (h.promise().cont)
+          return h.promise().cont;
+        return std::noop_coroutine();
+      }
+      void await_resume() noexcept {}
+    };
+    final_awaiter final_suspend() noexcept { return {}; }
+    void return_value(int v) { result = v; }
+    void unhandled_exception() { abort(); }
+
+    static void *operator new(size_t n) { return coro_alloc(n); }
+    static void operator delete(void *p, size_t n) { coro_free(p, n); }
+  };
+
+  std::coroutine_handle<promise_type> h;
+
+  explicit task(std::coroutine_handle<promise_type> c) : h(c) {}
+  task(task &&t) noexcept : h(t.h) { t.h = nullptr; }
+  task(const task &) = delete;
+  ~task()
+  {
+    if (h)
+      h.destroy();
+  }
+
+  bool await_ready() { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> c)
+  {
+    h.promise().cont = c;
+    return h;
+  }
+  int await_resume() { return h.promise().result; }
+};
+
+/* A pending read or write: who to resume and, for uring, with what. */
+struct coro_op
+{
+  std::coroutine_handle<> h;
+  int res;
+};
+
+struct executor
+{
+  int backend;
+  int efd;                              /* epoll */
+  uint32_t interest[CORO_MAXFD];
+  coro_op *rd[CORO_MAXFD], *wr[CORO_MAXFD];
+  struct kepoll_uring ring;             /* uring */
+};
+
+static void coro_epoll_ctl(executor *ex, int fd, uint32_t events)
+{
+  struct epoll_event ev;
+  int op = ex->interest[fd] ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+  ev.events = events;
+  ev.data.fd = fd;
+  if (epoll_ctl(ex->efd, op, fd, &ev) == -1)
+    errExit("epoll_ctl");
+  ex->interest[fd] = events;
+}
+
+static void coro_open(executor *ex, int backend, int fd)
+{
+  memset(ex, 0, sizeof(*ex));
+  ex->backend = backend;
+  if (fd >= CORO_MAXFD) {
+    fprintf(stderr, "executor: fd %d out of range\n", fd);
+    exit(EXIT_FAILURE);
+  }
+  if (backend == CORO_URING) {
+    kepoll_uring_setup(&ex->ring, 8);
+    return;
+  }
+  if ((ex->efd = epoll_create1(0)) == -1)
+    errExit("epoll_create1");
+  coro_epoll_ctl(ex, fd, EPOLLIN);
+}
+
+static void coro_uring_submit(executor *ex, int opcode, int fd, void *buf,
+                              size_t len, coro_op *op)
+{
+  struct kepoll_uring *r = &ex->ring;
+  struct io_uring_sqe *sqe;
+  unsigned tail, idx;
+
+  tail = *r->sq_tail;
+  if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) == r->entries &&
+      kepoll_uring_enter(r, 0) == -1)
+    errExit("io_uring_enter");
+  idx = tail & *r->sq_mask;
+  sqe = &r->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t)buf;
+  sqe->len = len;
+  sqe->user_data = (uintptr_t)op;
+  r->sq_array[idx] = idx;
+  __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  r->pending++;
+}
+
+/* Waits once and resumes every coroutine whose operation is ready. */
+static void coro_poll(executor *ex)
+{
+  struct epoll_event events[8];
+  struct kepoll_uring *r = &ex->ring;
+  struct io_uring_cqe *cqe;
+  unsigned head, tail;
+  coro_op *op;
+  int n, j, fd;
+
+  stats->nwait++;
+  if (ex->backend == CORO_URING) {
+    if (kepoll_uring_enter(r, 1) == -1 && errno != EINTR)
+      errExit("io_uring_enter");
+    head = *r->cq_head;
+    tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      cqe = &r->cqes[head & *r->cq_mask];
+      op = (coro_op *)(uintptr_t)cqe->user_data;
+      op->res = cqe->res;
+      __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+      stats->nresume++;
+      op->h.resume();
+    }
+    return;
+  }
+
+  if ((n = epoll_wait(ex->efd, events, 8, -1)) == -1) {
+    if (errno == EINTR)
+      return;
+    errExit("epoll_wait");
+  }
+  for (j = 0; j < n; j++) {
+    fd = events[j].data.fd;
+    if ((events[j].events & EPOLLOUT) && (op = ex->wr[fd]) != NULL) {
+      ex->wr[fd] = NULL;
+      coro_epoll_ctl(ex, fd, EPOLLIN);
+      stats->nresume++;
+      op->h.resume();
+    }
+    if ((events[j].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) &&
+        (op = ex->rd[fd]) != NULL) {
+      ex->rd[fd] = NULL;
+      stats->nresume++;
+      op->h.resume();
+    }
+  }
+}
+
+/* Runs t until it returns. */
+static int coro_run(executor *ex, task &t)
+{
+  t.h.resume();
+  while (!t.h.done())
+    coro_poll(ex);
+  return t.h.promise().result;
+}
+
+/* co_await async_read(): bytes received, 0 at EOF, -1 with errno. */
+struct async_read
+{
+  executor *ex;
+  int fd;
+  char *buf;
+  size_t len;
+  coro_op op;
+
+  bool await_ready() { return false; }
+  void await_suspend(std::coroutine_handle<> h)
+  {
+    stats->nsuspend++;
+    op.h = h;
+    if (ex->backend == CORO_URING)
+      coro_uring_submit(ex, IORING_OP_RECV, fd, buf, len, &op);
+    else
+      ex->rd[fd] = &op;
+  }
+  int await_resume()
+  {
+    if (ex->backend == CORO_URING) {
+      if (op.res < 0) {
+        errno = -op.res;
+        return -1;
+      }
+      return op.res;
+    }
+    /* level triggered readiness: this does not block */
+    return recv(fd, buf, len, 0);
+  }
+};
+
+/* co_await async_write(): bytes sent, only suspends on a full socket. */
+struct async_write
+{
+  executor *ex;
+  int fd;
+  char *buf;
+  size_t len;
+  coro_op op;
+  ssize_t sent;
+
+  bool await_ready()
+  {
+    sent = send(fd, buf, len, MSG_DONTWAIT);
+    return sent >= 0 || errno != EAGAIN;
+  }
+  void await_suspend(std::coroutine_handle<> h)
+  {
+    stats->nsuspend++;
+    op.h = h;
+    if (ex->backend == CORO_URING) {
+      coro_uring_submit(ex, IORING_OP_SEND, fd, buf, len, &op);
+    } else {
+      ex->wr[fd] = &op;
+      coro_epoll_ctl(ex, fd, EPOLLIN | EPOLLOUT);
+    }
+  }
+  int await_resume()
+  {
+    if (sent >= 0)
+      return sent;
+    if (ex->backend == CORO_URING) {
+      if (op.res < 0) {
+        errno = -op.res;
+        return -1;
+      }
+      return op.res;
+    }
+    /* writable now; 0 makes the caller try again */
+    return 0;
+  }
+};
+
+static task send_recv(executor *ex, int fd, char *wbuf, int wsize, char *rbuf,
+                      int rsize)
+{
+  int sofar, n;
+
+  for (sofar = 0; sofar < wsize; sofar += n)
+    if ((n = co_await async_write{ ex, fd, wbuf + sofar,
+                                   (size_t)(wsize - sofar) }) == -1)
+      errExit("send");
+  for (sofar = 0; sofar < rsize; sofar += n)
+    if ((n = co_await async_read{ ex, fd, rbuf + sofar,
+                                  (size_t)(rsize - sofar) }) <= 0)
+      co_return -1;
+  co_return 0;
+}
+
+static task recv_send(executor *ex, int fd, char *rbuf, int rsize, char *wbuf,
+                      int wsize)
+{
+  int sofar, n;
+
+  for (sofar = 0; sofar < rsize; sofar += n)
+    if ((n = co_await async_read{ ex, fd, rbuf + sofar,
+                                  (size_t)(rsize - sofar) }) <= 0)
+      co_return -1;
+  for (sofar = 0; sofar < wsize; sofar += n)
+    if ((n = co_await async_write{ ex, fd, wbuf + sofar,
+                                   (size_t)(wsize - sofar) }) == -1)
+      errExit("send");
+  co_return 0;
+}
+
+static task client(executor *ex, int fd, char *wbuf, int wsize, char *rbuf,
+                   int rsize, int64_t count)
+{
+  for (int64_t i = 0; i < count; i++)
+    if (co_await send_recv(ex, fd, wbuf, wsize, rbuf, rsize) == -1) {
+      fprintf(stderr, "Client: connection closed after %" PRId64
+              " round trips\n", i);
+      co_return -1;
+    }
+  co_return 0;
+}
+
+static task server(executor *ex, int fd, char *rbuf, int rsize, char *wbuf,
+                   int wsize, int64_t count)
+{
+  for (int64_t i = 0; i < count; i++)
+    if (co_await recv_send(ex, fd, rbuf, rsize, wbuf, wsize) == -1)
+      co_return -1;
+  co_return 0;
+}
+
+/* For the loops without I/O. */
+static task ticker(int64_t n)
+{
+  for (int64_t i = 0; i < n; i++)
+    co_await std::suspend_always{};
+  co_return 0;
+}
+
+static task nop()
+{
+  co_return 1;
+}
+
+static task caller(int64_t n)
+{
+  int sum = 0;
+
+  for (int64_t i = 0; i < n; i++)
+    sum += co_await nop();
+  co_return sum;
+}
+
+static void coro_report(const char *side, struct coro_stats *s, int64_t count)
+{
+  printf("%s per round trip: %.2f suspends, %.2f resumes, %.2f frames "
+         "(%.2f from the pool), %.2f waits\n", side,
+         (double)s->nsuspend / count, (double)s->nresume / count,
+         (double)s->nframe / count, (double)s->npool / count,
+         (double)s->nwait / count);
+}
+
+int main(int argc, char *argv[])
+{
+  int server_send_size, client_send_size, parentCPU, childCPU, backend, ap;
+  char *client_rbuf, *client_wbuf, *server_rbuf, *server_wbuf;
+  int64_t count, t0, delta;
+  struct coro_stats *shared;
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  executor *ex;
+  cpu_set_t set;
+  int lfd, fd, yes = 1;
+  pid_t pid;
+
+  ap = kopts_parse(argc, argv, KOPT_SCHED | KOPT_BUF | KOPT_CORO);
+  if (ap < 0 || argc - ap != 5) {
+    printf("usage: tcp_lat_coro [options] <server-send-size> <client-send-size> <roundtrip-count> <parent cpu> <child cpu>\n");
+    kopts_usage(KOPT_SCHED | KOPT_BUF | KOPT_CORO);
+    return 1;
+  }
+  if (ksched_check() == -1 || kbuf_mode_get() == -1)
+    return 1;
+
+  backend = CORO_EPOLL;
+  if (kopts.executor != NULL && strcmp(kopts.executor, "uring") == 0) {
+    backend = CORO_URING;
+  } else if (kopts.executor != NULL && strcmp(kopts.executor, "epoll") != 0) {
+    fprintf(stderr, "executor: bad backend '%s' (epoll, uring)\n",
+            kopts.executor);
+    return 1;
+  }
+  if (kopts.frames != NULL && strcmp(kopts.frames, "heap") == 0) {
+    pool_frames = 0;
+  } else if (kopts.frames != NULL && strcmp(kopts.frames, "pool") != 0) {
+    fprintf(stderr, "frames: bad allocator '%s' (pool, heap)\n", kopts.frames);
+    return 1;
+  }
+
+  server_send_size = atoi(argv[ap]);
+  client_send_size = atoi(argv[ap + 1]);
+  count = atol(argv[ap + 2]);
+  parentCPU = atoi(argv[ap + 3]);
+  childCPU = atoi(argv[ap + 4]);
+  if (server_send_size < 1 || client_send_size < 1 || count < 1) {
+    fprintf(stderr, "tcp_lat_coro: bad arguments\n");
+    return 1;
+  }
+
+  client_rbuf = (char *)kbuf_alloc(server_send_size);
+  server_wbuf = (char *)kbuf_alloc(server_send_size);
+  client_wbuf = (char *)kbuf_alloc(client_send_size);
+  server_rbuf = (char *)kbuf_alloc(client_send_size);
+  shared = (struct coro_stats *)mmap(NULL, 2 * sizeof(*shared),
+                                     PROT_READ | PROT_WRITE,
+                                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  ex = (executor *)malloc(sizeof(*ex));
+  if (client_rbuf == NULL || client_wbuf == NULL || server_rbuf == NULL ||
+      server_wbuf == NULL || shared == MAP_FAILED || ex == NULL) {
+    perror("alloc");
+    return 1;
+  }
+  memset(shared, 0, 2 * sizeof(*shared));
+
+  /* bound before fork() so the client knows the port */
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if ((lfd = socket(AF_INET, SOCK_STREAM, 0)) == -1 ||
+      bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      getsockname(lfd, (struct sockaddr *)&addr, &addr_len) == -1 ||
+      listen(lfd, 1) == -1) {
+    perror("bind");
+    return 1;
+  }
+
+  printf("server send message size: %d, client send message size: %d\n",
+         server_send_size, client_send_size);
+  printf("roundtrip count: %" PRId64 "\n", count);
+  printf("executor: %s, frames: %s\n", backend == CORO_URING ? "uring" : "epoll",
+         pool_frames ? "pool" : "heap");
+  kbuf_describe(client_send_size);
+  CPU_ZERO(&set);
+
+  fflush(stdout);
+  if ((pid = fork()) == -1) {
+    perror("fork");
+    return 1;
+  }
+  if (pid == 0) { /* server */
+    CPU_SET(childCPU, &set);
+    if (sched_setaffinity(getpid(), sizeof(set), &set) == -1)
+      errExit("sched_setaffinity of child failed");
+    ksched_apply_side(KSCHED_CHILD);
+    kbuf_side(server_rbuf, client_send_size);
+    kbuf_side(server_wbuf, server_send_size);
+    stats = &shared[1];
+
+    if ((fd = accept(lfd, NULL, NULL)) == -1)
+      errExit("accept");
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    coro_open(ex, backend, fd);
+    task t = server(ex, fd, server_rbuf, client_send_size, server_wbuf,
+                    server_send_size, count);
+    coro_run(ex, t);
+    close(fd);
+    return 0;
+  }
+
+  /* client */
+  CPU_SET(parentCPU, &set);
+  if (sched_setaffinity(getpid(), sizeof(set), &set) == -1)
+    errExit("sched_setaffinity of parent failed");
+  ksched_apply_side(KSCHED_PARENT);
+  kbuf_side(client_rbuf, server_send_size);
+  kbuf_side(client_wbuf, client_send_size);
+  stats = &shared[0];
+  close(lfd);
+
+  if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1 ||
+      connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    perror("connect");
+    return 1;
+  }
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+  coro_open(ex, backend, fd);
+
+  {
+    task t = client(ex, fd, client_wbuf, client_send_size, client_rbuf,
+                    server_send_size, count);
+
+    t0 = kutils_now_ns();
+    if (coro_run(ex, t) == -1)
+      return 1;
+    delta = kutils_now_ns() - t0;
+  }
+  close(fd);
+  waitpid(pid, NULL, 0);
+
+  printf("Client : Clock average latency: %" PRId64 " ns\n", delta / count);
+  coro_report("Client", &shared[0], count);
+  coro_report("Server", &shared[1], count);
+
+  /* the machinery alone, on the parent's CPU */
+  {
+    task t = ticker(count);
+
+    t0 = kutils_now_ns();
+    while (!t.h.done())
+      t.h.resume();
+    delta = kutils_now_ns() - t0;
+    printf("suspend + resume: %.1f ns\n", (double)delta / count);
+  }
+  {
+    task t = caller(count);
+
+    t0 = kutils_now_ns();
+    t.h.resume();
+    delta = kutils_now_ns() - t0;
+    printf("frame alloc + call + return + free: %.1f ns\n",
+           (double)delta / count);
+  }
+  return 0;
+}
@@ -36,6 +36,9 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include "KUtils.h"
+#include "KSched.h"
+#include "KBuf.h"
+#include "KEpoll.h"
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
@@ -53,6 +56,7 @@ typedef int bool;
 #define true  1
 
 int main(int argc, char *argv[]) {
+  int ap;
   int size;
   char *buf;
   int64_t count, delta;
@@ -76,17 +80,23 @@ int main(int argc, char *argv[]) {
   struct addrinfo hints;
   struct addrinfo *res;
   int sockfd, new_fd;
+  struct kepoll ke;
 
-  if (argc != 6) {
-    printf("usage: tcp_lat_epoll <message-size> <roundtrip-count> <parent cpu> <child cpu> <Enable(1)/Disable(0) angel signals>\n");
+  ap = kopts_parse(argc, argv, KOPT_SCHED | KOPT_BUF | KOPT_EPOLL);
+  if (ap < 0 || argc - ap != 5) {
+    printf("usage: tcp_lat_epoll [options] <message-size> <roundtrip-count> <parent cpu> <child cpu> <Enable(1)/Disable(0) angel signals>\n");
+    kopts_usage(KOPT_SCHED | KOPT_BUF | KOPT_EPOLL);
     return 1;
   }
 
-  size = atoi(argv[1]);
-  count = atol(argv[2]);
-  parentCPU = atoi(argv[3]);
-  childCPU = atoi(argv[4]);
-  isEnableAngelSignals = atoi(argv[5]);
+  if (ksched_check() == -1 || kbuf_mode_get() == -1 || kepoll_parse(&ke) == -1)
+    return 1;
+
+  size = atoi(argv[ap]);
+  count = atol(argv[ap + 1]);
+  parentCPU = atoi(argv[ap + 2]);
+  childCPU = atoi(argv[ap + 3]);
+  isEnableAngelSignals = atoi(argv[ap + 4]);
   CPU_ZERO(&set);
 
 #ifdef PERF_INSTRUMENT
@@ -94,9 +104,9 @@ int main(int argc, char *argv[]) {
    perf_event_enable ( (enable_perf_events) ENABLE_HW_CYCLES_PER );
 #endif //PERF_INSTRUMENT_PER
 
-  buf = malloc(size);
+  buf = kbuf_alloc(size);
   if (buf == NULL) {
-    perror("malloc");
+    perror("kbuf_alloc");
     return 1;
   }
 
@@ -111,6 +121,7 @@ int main(int argc, char *argv[]) {
 
   printf("message size: %i octets\n", size);
   printf("roundtrip count: %li\n", count);
+  kbuf_describe(size);
 
   if (!fork()) { /* child */
     CPU_SET(childCPU, &set);
@@ -119,6 +130,9 @@ int main(int argc, char *argv[]) {
      errExit("sched_setaffinity of child failed");
     }
 
+    ksched_apply_side(KSCHED_CHILD);
+    kbuf_side(buf, size);
+
     if ((sockfd = socket(res->ai_family, res->ai_socktype, IPPROTO_IP)) ==
         -1) {
       perror("socket");
@@ -148,17 +162,8 @@ int main(int argc, char *argv[]) {
       return 1;
     }
 
-    int s,efd = epoll_create1(0);
-    struct epoll_event event;
-    struct epoll_event *events;
-    event.data.fd = new_fd;
-    event.events = EPOLLIN|EPOLLRDHUP|EPOLLET;
-    s = epoll_ctl (efd, EPOLL_CTL_ADD, new_fd, &event);
-    if(s == -1) {
-       perror ("epoll_ctl");
-       exit(1);
-    }
-    events = calloc (64, sizeof event);
+    kepoll_open(&ke, new_fd, EPOLLIN|EPOLLRDHUP|EPOLLET);
+    struct epoll_event *events = ke.events;
 
 #ifdef HAS_CLOCK_GETTIME_MONOTONIC
     if (clock_gettime(CLOCK_MONOTONIC, &start) == -1) {
@@ -173,12 +178,13 @@ int main(int argc, char *argv[]) {
 #endif
     int r_count =0;
     int j, done=0;
+    int64_t rbytes = 0;
     while(1) {
-        int n = epoll_wait (efd, events, 64, 65000);
+        int n = kepoll_wait(&ke, 65000);
         for (j = 0; j < n; j++) {
               if ((events[j].events & EPOLLERR) ||
                  (events[j].events & EPOLLHUP) ||
-                 (!(events[j].events & EPOLLIN)))
+                 (!(events[j].events & EPOLLIN) && ke.mode == KEPOLL_CLASSIC))
               {
                         perror ("epoll error\n");
                         close (events[j].data.fd);
@@ -186,7 +192,12 @@ int main(int argc, char *argv[]) {
               }
               if(events[j].events & EPOLLIN) {
                    while(1) {
-                        len = recv(events[j].data.fd, buf, size, 0);
+                        /* classic drains read by read, the others let
+                           kepoll_recv() decide */
+                        if (ke.mode == KEPOLL_CLASSIC)
+                          len = kepoll_recv1(&ke, events[j].data.fd, buf, size);
+                        else
+                          len = kepoll_recv(&ke, events[j].data.fd, buf, size);
                         if (len == -1) {
                              if(errno != EAGAIN) {
                                       perror("recv err\n");
@@ -199,20 +210,29 @@ int main(int argc, char *argv[]) {
 			     done = 1;
                              break;
                         }
-                        r_count++;
-                        if(r_count == count)
+                        /* classic counts reads, the others messages */
+                        if (ke.mode == KEPOLL_CLASSIC) {
+                          r_count++;
+                        } else {
+                          rbytes += len;
+                          r_count = rbytes / size;
+                        }
+                        if(r_count >= count)
 			{
 			     done = 1;
                              break;
 			}
+                        if (ke.mode != KEPOLL_CLASSIC)
+                             break;
                     }
                 }
            }
+           if (n > 0)
+                   kepoll_rearm(&ke, new_fd);
            if(done)
                    break;
 
         }
-        free (events);
         close(new_fd);
 
 #ifdef HAS_CLOCK_GETTIME_MONOTONIC
@@ -232,6 +252,7 @@ int main(int argc, char *argv[]) {
 #endif
 
     printf("Clock recv latency: %li ns\n", delta / (count ));
+    kepoll_report(&ke, "recv side ", count, "per message");
 
 
   } else { /* parent */
@@ -244,6 +265,9 @@ int main(int argc, char *argv[]) {
      errExit("sched_setaffinity of parent failed");
     }
 
+    ksched_apply_side(KSCHED_PARENT);
+    kbuf_side(buf, size);
+
     if ((sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) ==
         -1) {
       perror("socket");
@@ -275,29 +299,28 @@ int main(int argc, char *argv[]) {
     beginC = perf_per_cycle_event_read();
 #endif
 
-    int s,efd = epoll_create1(0);
-    struct epoll_event event;
-    struct epoll_event *events;
-    event.data.fd = sockfd;
-    event.events = EPOLLOUT;
-    s = epoll_ctl (efd, EPOLL_CTL_ADD, sockfd, &event);
-    if(s == -1) {
-       perror ("epoll_ctl");
-       exit(1);
-    }
-    events = calloc (64, sizeof event);
+    kepoll_plain(&ke);
+    kepoll_open(&ke, sockfd, EPOLLOUT);
+    struct epoll_event *events = ke.events;
 
     struct iovec iobuf;
     iobuf.iov_base = buf;
     iobuf.iov_len= size;
     int w_count = 0;
 
-    while(1) {
+    /* only the classic loop waits for EPOLLOUT, the others just send */
+    while (ke.mode != KEPOLL_CLASSIC && w_count < count) {
+           if (kepoll_send(&ke, sockfd, &iobuf) != size)
+               errExit("write err");
+           w_count++;
+    }
+
+    while(w_count < count) {
            int j;
-           int n = epoll_wait (efd, events, 64, 65000);
+           int n = kepoll_wait(&ke, 65000);
            for (j = 0; j < n; j++) {
                 if(events[j].events & EPOLLOUT) {
-                      if (writev(sockfd, &iobuf, 1) != size) {
+                      if (kepoll_send(&ke, sockfd, &iobuf) != size) {
                           perror("write err\n");
 			  break;
                       }
@@ -321,6 +344,7 @@ int main(int argc, char *argv[]) {
              (stop.tv_nsec - start.tv_nsec));
 
     printf("Clock average latency: %li ns\n", delta / (count));
+    kepoll_report(&ke, "send side ", count, "per message");
 #elif defined(HAS_GETTIMEOFDAY)
     if (gettimeofday(&stop, NULL) == -1) {
       perror("gettimeofday");
@@ -36,6 +36,9 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include "KUtils.h"
+#include "KSched.h"
+#include "KBuf.h"
+#include "KEpoll.h"
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
@@ -51,7 +54,6 @@
 typedef int bool;
 #define false 0
 #define true  1
-#define EPOLL_ARRAY_SIZE   64
 int main(int argc, char *argv[]) {
   int server_send_size, client_send_size;
   char *client_rbuf, *client_wbuf, *server_rbuf, *server_wbuf;
@@ -78,25 +80,32 @@ int main(int argc, char *argv[]) {
   int sockfd, new_fd;
   int tcp_nopush = 0;
   int tcp_nodelay = 0;
+  int ap;
+  struct kepoll ke;
 
+  ap = kopts_parse(argc, argv, KOPT_SCHED | KOPT_BUF | KOPT_EPOLL);
 #ifdef ANGEL
-  if (argc != 9) {
-    printf("usage: tcp_lat_epoll_with_ack <server-send-size> <client-send-size> <roundtrip-count> <tcp_nodelay:0|1> <tcp_nopush:0|1> <parent cpu> <child cpu> <Enable(1)/Disable(0) angel signals>\n");
+  if (ap < 0 || argc - ap != 8) {
+    printf("usage: tcp_lat_epoll_with_ack [options] <server-send-size> <client-send-size> <roundtrip-count> <tcp_nodelay:0|1> <tcp_nopush:0|1> <parent cpu> <child cpu> <Enable(1)/Disable(0) angel signals>\n");
 #else
-  if (argc != 8) {
-    printf("usage: tcp_lat_epoll_with_ack <server-send-size> <client-send-size> <roundtrip-count> <tcp_nodelay:0|1> <tcp_nopush:0|1> <parent cpu> <child cpu>\n");
+  if (ap < 0 || argc - ap != 7) {
+    printf("usage: tcp_lat_epoll_with_ack [options] <server-send-size> <client-send-size> <roundtrip-count> <tcp_nodelay:0|1> <tcp_nopush:0|1> <parent cpu> <child cpu>\n");
 #endif
+    kopts_usage(KOPT_SCHED | KOPT_BUF | KOPT_EPOLL);
     return 1;
   }
-  server_send_size = atoi(argv[1]);
-  client_send_size = atoi(argv[2]);
-  count = atol(argv[3]);
-  tcp_nodelay = atoi(argv[4]);
-  tcp_nopush = atoi(argv[5]);
-  parentCPU = atoi(argv[6]);
-  childCPU = atoi(argv[7]);
+
+  if (ksched_check() == -1 || kbuf_mode_get() == -1 || kepoll_parse(&ke) == -1)
+    return 1;
+  server_send_size = atoi(argv[ap]);
+  client_send_size = atoi(argv[ap + 1]);
+  count = atol(argv[ap + 2]);
+  tcp_nodelay = atoi(argv[ap + 3]);
+  tcp_nopush = atoi(argv[ap + 4]);
+  parentCPU = atoi(argv[ap + 5]);
+  childCPU = atoi(argv[ap + 6]);
 #ifdef ANGEL
-  isEnableAngelSignals = atoi(argv[8]);
+  isEnableAngelSignals = atoi(argv[ap + 7]);
 #endif
   CPU_ZERO(&set);
 
@@ -105,12 +114,12 @@ int main(int argc, char *argv[]) {
    perf_event_enable ( (enable_perf_events) ENABLE_HW_CYCLES_PER );
 #endif //PERF_INSTRUMENT_PER
 
-  client_rbuf = malloc(server_send_size);
-  server_wbuf = malloc(server_send_size);
-  client_wbuf = malloc(client_send_size);
-  server_rbuf = malloc(client_send_size);
+  client_rbuf = kbuf_alloc(server_send_size);
+  server_wbuf = kbuf_alloc(server_send_size);
+  client_wbuf = kbuf_alloc(client_send_size);
+  server_rbuf = kbuf_alloc(client_send_size);
   if ( (client_rbuf == NULL) || (client_wbuf == NULL) || (server_rbuf == NULL) || (server_wbuf == NULL) ){
-    perror("malloc");
+    perror("kbuf_alloc");
     return 1;
   }
 
@@ -125,6 +134,7 @@ int main(int argc, char *argv[]) {
 
   printf("server send message size: %d, client send message size: %d\n", server_send_size, client_send_size);
   printf("roundtrip count: %li\n", count);
+  kbuf_describe(client_send_size);
 
   if (!fork()) { /* server */
     CPU_SET(childCPU, &set);
@@ -133,6 +143,10 @@ int main(int argc, char *argv[]) {
      errExit("sched_setaffinity of child failed");
     }
 
+    ksched_apply_side(KSCHED_CHILD);
+    kbuf_side(server_rbuf, client_send_size);
+    kbuf_side(server_wbuf, server_send_size);
+
     if ((sockfd = socket(res->ai_family, res->ai_socktype, IPPROTO_IP)) == -1) {
       perror("socket");
       return 1;
@@ -165,17 +179,8 @@ int main(int argc, char *argv[]) {
       return 1;
     }
 
-    int s,efd = epoll_create1(0);
-    struct epoll_event event;
-    struct epoll_event *events;
-    event.data.fd = new_fd;
-    event.events = EPOLLIN|EPOLLRDHUP|EPOLLET;
-    events = calloc (EPOLL_ARRAY_SIZE, sizeof event);
-    s = epoll_ctl (efd, EPOLL_CTL_ADD, new_fd, &event);
-    if(s == -1) {
-       perror ("epoll_ctl EPOLL_CTL_ADD");
-       exit(1);
-    }
+    kepoll_open(&ke, new_fd, EPOLLIN|EPOLLRDHUP|EPOLLET);
+    struct epoll_event *events = ke.events;
 
 #ifdef HAS_CLOCK_GETTIME_MONOTONIC
     if (clock_gettime(CLOCK_MONOTONIC, &start) == -1) {
@@ -188,12 +193,12 @@ int main(int argc, char *argv[]) {
       return 1;
     }
 #endif
-    int sw_count = 0, sr_count = 0, cork = 0;
+    int sw_count = 0, sr_count = 0, cork = 0, rbytes = 0, reqs;
     struct iovec iobuf;
     iobuf.iov_base = server_wbuf;
     iobuf.iov_len= server_send_size;
     do{
-        int n = epoll_wait (efd, events, EPOLL_ARRAY_SIZE, -1);
+        int n = kepoll_wait(&ke, -1);
 
         for (int j = 0; j < n; j++) {
           if (events[j].events & EPOLLERR)
@@ -209,7 +214,7 @@ int main(int argc, char *argv[]) {
           }
 
           if(events[j].events & EPOLLIN) {
-            len = recv(events[j].data.fd, server_rbuf, client_send_size, 0);
+            len = kepoll_recv(&ke, events[j].data.fd, server_rbuf, client_send_size);
             if (len == -1) {
                  if(errno != EAGAIN) {
                      perror("recv err\n");
@@ -221,32 +226,45 @@ int main(int argc, char *argv[]) {
                  exit(1);
                  break;
             }
-            sr_count++;
-            cork = 1;
-
-            if(tcp_nopush) {
-              setsockopt(sockfd, SOL_TCP, TCP_CORK, &cork, 4);
+            /* classic counts every read as a request, the others count bytes */
+            if (ke.mode == KEPOLL_CLASSIC) {
+              reqs = 1;
+            } else {
+              rbytes += len;
+              reqs = rbytes / client_send_size;
+              rbytes %= client_send_size;
             }
+            for (; reqs > 0; reqs--) {
+              sr_count++;
+              cork = 1;
 
-            if (writev(events[j].data.fd, &iobuf, 1) != server_send_size) {
-              perror("write err\n");
-              break;
-            }
+              if(tcp_nopush) {
+                kepoll_other(&ke);
+                setsockopt(sockfd, SOL_TCP, TCP_CORK, &cork, 4);
+              }
 
-            cork = 0;
-            if(tcp_nopush) {
-              setsockopt(sockfd, SOL_TCP, TCP_CORK, &cork, 4);
+              if (kepoll_send(&ke, events[j].data.fd, &iobuf) != server_send_size) {
+                perror("write err\n");
+                break;
+              }
+
+              cork = 0;
+              if(tcp_nopush) {
+                kepoll_other(&ke);
+                setsockopt(sockfd, SOL_TCP, TCP_CORK, &cork, 4);
+              }
+              sw_count++;
             }
-            sw_count++;
           }
         } //End of for loop
+        if (n > 0)
+          kepoll_rearm(&ke, new_fd);
 
         if ( (sr_count == count) || (sw_count == count) ) {
           break;
         }
 
      } while(1);
-     free (events);
      close(new_fd);
 
 #ifdef HAS_CLOCK_GETTIME_MONOTONIC
@@ -266,6 +284,7 @@ int main(int argc, char *argv[]) {
 #endif
 
     printf("Server: Clock recv latency: %li ns\n", delta / (count ));
+    kepoll_report(&ke, "Server: ", count, "per round trip");
 
 
   } else { /* client */
@@ -278,6 +297,10 @@ int main(int argc, char *argv[]) {
      errExit("sched_setaffinity of parent failed");
     }
 
+    ksched_apply_side(KSCHED_PARENT);
+    kbuf_side(client_rbuf, server_send_size);
+    kbuf_side(client_wbuf, client_send_size);
+
     if ((sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) == -1) {
       perror("socket");
       return 1;
@@ -310,24 +333,54 @@ int main(int argc, char *argv[]) {
     beginC = perf_per_cycle_event_read();
 #endif
 
-    int s,efd = epoll_create1(0);
-    struct epoll_event event;
-    struct epoll_event *events;
-    event.data.fd = sockfd;
-    event.events = EPOLLOUT|EPOLLRDHUP|EPOLLET;
-    events = calloc (EPOLL_ARRAY_SIZE, sizeof event);
-    s = epoll_ctl (efd, EPOLL_CTL_ADD, sockfd, &event);
-    if(s == -1) {
-       perror ("epoll_ctl EPOLL_CTL_ADD");
-       exit(1);
-    }
+    kepoll_plain(&ke);
+    kepoll_open(&ke, sockfd, EPOLLOUT|EPOLLRDHUP|EPOLLET);
+    struct epoll_event *events = ke.events;
     struct iovec iobuf;
     iobuf.iov_base = client_wbuf;
     iobuf.iov_len= client_send_size;
-    int cw_count = 0, cr_count = 0, wr_rd = 0;
+    int cw_count = 0, cr_count = 0, wr_rd = 0, rbytes;
 
-    do {
-           int n = epoll_wait (efd, events, EPOLL_ARRAY_SIZE, -1);
+    if (ke.mode != KEPOLL_CLASSIC) {
+      /* send right away, wait only for the reply: no interest flipping */
+      while (cr_count < count) {
+        if (kepoll_send(&ke, sockfd, &iobuf) != client_send_size) {
+          perror("write err\n");
+          break;
+        }
+        cw_count++;
+        for (rbytes = 0; rbytes < server_send_size;) {
+          int n = kepoll_wait(&ke, -1);
+
+          for (int j = 0; j < n; j++) {
+            if (events[j].events & EPOLLERR) {
+              printf ("Client: epoll event error: 0x%x\n", events[j].events);
+              continue;
+            }
+            /* the server closes right after the last reply */
+            if ((events[j].events & EPOLLRDHUP) && !(events[j].events & EPOLLIN)) {
+              printf ("Client: Stream socket peer closed connection error: 0x%x\n", events[j].events);
+              exit(1);
+            }
+            if (events[j].events & EPOLLIN) {
+              int rlen = kepoll_recv(&ke, sockfd, client_rbuf, server_send_size);
+              if (rlen == 0) {
+                perror("Client: received ZERO\n");
+                exit(1);
+              }
+              if (rlen == -1 && errno != EAGAIN)
+                errExit("recv err");
+              if (rlen > 0)
+                rbytes += rlen;
+            }
+          }
+          if (n > 0)
+            kepoll_rearm(&ke, sockfd);
+        }
+        cr_count++;
+      }
+    } else do {
+           int n = kepoll_wait(&ke, -1);
 
            for (int j = 0; j < n; j++) {
               if (events[j].events & EPOLLERR)
@@ -343,7 +396,7 @@ int main(int argc, char *argv[]) {
               }
 
               if(events[j].events & EPOLLOUT) {
-                if (writev(sockfd, &iobuf, 1) != client_send_size) {
+                if (kepoll_send(&ke, sockfd, &iobuf) != client_send_size) {
                     perror("write err\n");
                     break;
                 }
@@ -352,7 +405,7 @@ int main(int argc, char *argv[]) {
               }
 
               if(events[j].events & EPOLLIN) {
-                int rlen = recv(events[j].data.fd, client_rbuf, server_send_size, 0);
+                int rlen = kepoll_recv(&ke, events[j].data.fd, client_rbuf, server_send_size);
                 if (rlen == -1) {
                    if(errno != EAGAIN) {
                      perror("recv err\n");
@@ -373,21 +426,12 @@ int main(int argc, char *argv[]) {
                 break;
            }
 #if 1
-	   if (wr_rd) {
-    	 event.events = EPOLLIN;
-     }
-	   else {
-    	 event.events = EPOLLOUT;
-     }
-
-     s = epoll_ctl (efd, EPOLL_CTL_MOD, sockfd, &event);
-	   if(s == -1) {
+	   if (kepoll_ctl(&ke, EPOLL_CTL_MOD, sockfd, wr_rd ? EPOLLIN : EPOLLOUT) == -1) {
 	       perror ("Client: epoll_ctl EPOLL_CTL_MOD");
 	       exit(1);
 	   }
 #endif
     } while (1);
-    free (events);
     close(sockfd);
 
 #ifdef HAS_CLOCK_GETTIME_MONOTONIC
@@ -400,6 +444,7 @@ int main(int argc, char *argv[]) {
              (stop.tv_nsec - start.tv_nsec));
 
     printf("Client : Clock average latency: %li ns\n", delta / (count));
+    kepoll_report(&ke, "Client: ", count, "per round trip");
 #elif defined(HAS_GETTIMEOFDAY)
     if (gettimeofday(&stop, NULL) == -1) {
       perror("gettimeofday");
@@ -33,8 +33,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 #include <netdb.h>
 #include "KUtils.h"
+#include "KSched.h"
+#include "KBuf.h"
+#include "KCounters.h"
+#include "KPlace.h"
+#include "KStream.h"
 #include <time.h>
 #include <unistd.h>
 
@@ -50,10 +56,9 @@ typedef int bool;
 #define false 0
 #define true  1
 
-#define SCALE 2
-
 int main(int argc, char *argv[]) {
-  int size;
+  int ap;
+  int size, resp, bsize;
   //char *buf, *buf1half, *buf2half;
   int64_t count, i, delta;
 #ifdef HAS_CLOCK_GETTIME_MONOTONIC
@@ -66,9 +71,10 @@ int main(int argc, char *argv[]) {
   cpu_set_t set;
   int parentCPU, childCPU;
   bool isEnableAngelSignals;
-
-  ssize_t len;
-  size_t sofar;
+  struct kplace place;
+  struct kcounters counters, *kc = NULL;
+  char *base, *src, *dst;
+  int c;
 
   int yes = 1;
   int ret;
@@ -78,18 +84,30 @@ int main(int argc, char *argv[]) {
   struct addrinfo *res;
   int sockfd, new_fd;
 
-  if (argc != 6) {
-    printf("usage: tcp_lat_nonoverlap <message-size> <roundtrip-count> <parent cpu> <child cpu> <Enable(1)/Disable(0) angel signals>\n");
+  ap = kopts_parse(argc, argv, KOPT_SCHED | KOPT_BUF | KOPT_PLACE | KOPT_COUNTERS | KOPT_RESPONSE | KOPT_STREAM);
+  if (ap < 0 || argc - ap != 5) {
+    printf("usage: tcp_lat_nonoverlap [options] <message-size> <roundtrip-count> <parent cpu> <child cpu> <Enable(1)/Disable(0) angel signals>\n");
+    kopts_usage(KOPT_SCHED | KOPT_BUF | KOPT_PLACE | KOPT_COUNTERS | KOPT_RESPONSE | KOPT_STREAM);
     return 1;
   }
 
-  size = atoi(argv[1]);
-  count = atol(argv[2]);
-  parentCPU = atoi(argv[3]);
-  childCPU = atoi(argv[4]);
-  isEnableAngelSignals = atoi(argv[5]);
+  if (ksched_check() == -1 || kbuf_mode_get() == -1 || kstream_check() == -1)
+    return 1;
+
+  size = atoi(argv[ap]);
+  count = atol(argv[ap + 1]);
+  parentCPU = atoi(argv[ap + 2]);
+  childCPU = atoi(argv[ap + 3]);
+  isEnableAngelSignals = atoi(argv[ap + 4]);
   CPU_ZERO(&set);
 
+  if ((resp = kopts_response(size)) == -1)
+    return 1;
+  bsize = resp > size ? resp : size;
+
+  if (kplace_init(&place, kopts.place, bsize) == -1)
+    return 1;
+
 #ifdef PERF_INSTRUMENT
    perf_event_init( (enable_perf_events) ENABLE_HW_CYCLES_PER );
    perf_event_enable ( (enable_perf_events) ENABLE_HW_CYCLES_PER );
@@ -114,24 +132,35 @@ int main(int argc, char *argv[]) {
   }
 
   printf("message size: %i octets\n", size);
+  if (resp != size)
+    printf("response size: %i octets\n", resp);
   printf("roundtrip count: %li\n", count);
+  kbuf_describe(place.buflen);
 
   if (!fork()) { /* child */
     CPU_SET(childCPU, &set);
 
     char *bufC;
-    bufC = malloc(size);
+    bufC = kbuf_alloc(place.buflen);
       if (bufC == NULL) {
-        perror("malloc");
+        perror("kbuf_alloc");
         return 1;
     }
     //printf("Buffer pointer client=%p\n", bufC);
-    memset((void *)bufC, 0xFF, size);
+    memset((void *)bufC, 0xFF, place.buflen);
 
     if (sched_setaffinity(getpid(), sizeof(set), &set) == -1){
      errExit("sched_setaffinity of child failed");
     }
 
+    ksched_apply_side(KSCHED_CHILD);
+    base = kplace_base(&place, bufC);
+
+    if (kopts.counters) {
+      kcounters_open_self(&counters);
+      kc = &counters;
+    }
+
     if ((sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) ==
         -1) {
       perror("socket");
@@ -161,21 +190,25 @@ int main(int argc, char *argv[]) {
       return 1;
     }
 
-    for (i = 0; i < count; i++) {
+    for (c = 0; c < place.n; c++) {
+      src = base + place.cases[c].src[KPLACE_CHILD];
+      dst = base + place.cases[c].dst[KPLACE_CHILD];
+      kplace_begin(&place, kc);
 
-      for (sofar = 0; sofar < size;) {
-        len = read(new_fd, bufC, size - sofar);
-        if (len == -1) {
+      for (i = 0; i < count; i++) {
+
+        if (kstream_read(new_fd, dst, size) != size) {
           perror("read");
           return 1;
         }
-        sofar += len;
-      }
 
-      if (write(new_fd, bufC, size) != size) {
-        perror("write");
-        return 1;
+        if (kstream_write(new_fd, src, resp) != resp) {
+          perror("write");
+          return 1;
+        }
       }
+
+      kplace_end(&place, c, KPLACE_CHILD, kc);
     }
   } else { /* parent */
 
@@ -183,20 +216,27 @@ int main(int argc, char *argv[]) {
 
     CPU_SET(parentCPU, &set);
 
-    char *bufP, *bufP2Half;
-    bufP = malloc(size*SCALE);
+    char *bufP;
+    bufP = kbuf_alloc(place.buflen);
       if (bufP == NULL) {
-        perror("malloc");
+        perror("kbuf_alloc");
         return 1;
     }
-    bufP2Half = bufP + size;
-    //printf("Buffer pointer server=%p and 2Half=%p\n", bufP, bufP2Half);
-    memset((void *)bufP, 0x00, size*SCALE);
+    //printf("Buffer pointer server=%p\n", bufP);
+    memset((void *)bufP, 0x00, place.buflen);
 
     if (sched_setaffinity(getpid(), sizeof(set), &set) == -1){
      errExit("sched_setaffinity of parent failed");
     }
 
+    ksched_apply_side(KSCHED_PARENT);
+    base = kplace_base(&place, bufP);
+
+    if (kopts.counters) {
+      kcounters_open_self(&counters);
+      kc = &counters;
+    }
+
     if ((sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) ==
         -1) {
       perror("socket");
@@ -228,21 +268,25 @@ int main(int argc, char *argv[]) {
     beginC = perf_per_cycle_event_read();
 #endif
 
-    for (i = 0; i < count; i++) {
+    for (c = 0; c < place.n; c++) {
+      src = base + place.cases[c].src[KPLACE_PARENT];
+      dst = base + place.cases[c].dst[KPLACE_PARENT];
+      kplace_begin(&place, kc);
 
-      if (write(sockfd, bufP2Half, size) != size) {
-        perror("write");
-        return 1;
-      }
+      for (i = 0; i < count; i++) {
+
+        if (kstream_write(sockfd, src, size) != size) {
+          perror("write");
+          return 1;
+        }
 
-      for (sofar = 0; sofar < size;) {
-        len = read(sockfd, bufP2Half, size - sofar);
-        if (len == -1) {
+        if (kstream_read(sockfd, dst, resp) != resp) {
           perror("read");
           return 1;
         }
-        sofar += len;
       }
+
+      kplace_end(&place, c, KPLACE_PARENT, kc);
     }
 
 #ifdef HAS_CLOCK_GETTIME_MONOTONIC
@@ -254,7 +298,8 @@ int main(int argc, char *argv[]) {
     delta = ((stop.tv_sec - start.tv_sec) * 1000000000 +
              (stop.tv_nsec - start.tv_nsec));
 
-    printf("Clock average latency: %li ns\n", delta / (count * 2));
+    printf("Clock average latency: %li ns\n", delta / (count * 2 * place.n));
+    kstream_report(delta, count * place.n, size, resp);
 #elif defined(HAS_GETTIMEOFDAY)
     if (gettimeofday(&stop, NULL) == -1) {
       perror("gettimeofday");
@@ -263,15 +308,20 @@ int main(int argc, char *argv[]) {
 
     delta =
         (stop.tv_sec - start.tv_sec) * 1000000000 + (stop.tv_usec - start.tv_usec) * 1000;
-    printf("GTOD average latency %li ns\n", delta/ (count*2));
+    printf("GTOD average latency %li ns\n", delta/ (count*2*place.n));
+    kstream_report(delta, count * place.n, size, resp);
 #elif defined(PERF_INSTRUMENT)
    endC = perf_per_cycle_event_read();
    delta = endC - beginC;
 
-   printf("Perf average cycle: %li\n", delta / (count * 2));
+   printf("Perf average cycle: %li\n", delta / (count * 2 * place.n));
 #else
    printf("Not supported\n");
 #endif
+    if (kopts.place != NULL || kopts.counters) {
+      wait(NULL);
+      kplace_report(&place, count);
+    }
 
 #ifdef ANGEL
     if( isEnableAngelSignals )
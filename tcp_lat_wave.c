@@ -35,6 +35,8 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include "KUtils.h"
+#include "KSched.h"
+#include "KBuf.h"
 #include <time.h>
 #include <unistd.h>
 
@@ -51,6 +53,7 @@ typedef int bool;
 #define true  1
 
 int main(int argc, char *argv[]) {
+  int ap;
   int size;
   char *buf;
   int64_t count, i, delta;
@@ -76,16 +79,21 @@ int main(int argc, char *argv[]) {
   struct addrinfo *res;
   int sockfd, new_fd;
 
-  if (argc != 6) {
-    printf("usage: tcp_lat <message-size> <roundtrip-count> <parent cpu> <child cpu> <Enable(1)/Disable(0) angel signals>\n");
+  ap = kopts_parse(argc, argv, KOPT_SCHED | KOPT_BUF);
+  if (ap < 0 || argc - ap != 5) {
+    printf("usage: tcp_lat [options] <message-size> <roundtrip-count> <parent cpu> <child cpu> <Enable(1)/Disable(0) angel signals>\n");
+    kopts_usage(KOPT_SCHED | KOPT_BUF);
     return 1;
   }
 
-  size = atoi(argv[1]);
-  count = atol(argv[2]);
-  parentCPU = atoi(argv[3]);
-  childCPU = atoi(argv[4]);
-  isEnableAngelSignals = atoi(argv[5]);
+  if (ksched_check() == -1 || kbuf_mode_get() == -1)
+    return 1;
+
+  size = atoi(argv[ap]);
+  count = atol(argv[ap + 1]);
+  parentCPU = atoi(argv[ap + 2]);
+  childCPU = atoi(argv[ap + 3]);
+  isEnableAngelSignals = atoi(argv[ap + 4]);
   CPU_ZERO(&set);
 
 #ifdef PERF_INSTRUMENT
@@ -93,9 +101,9 @@ int main(int argc, char *argv[]) {
    perf_event_enable ( (enable_perf_events) ENABLE_HW_CYCLES_PER );
 #endif //PERF_INSTRUMENT_PER
 
-  buf = malloc(size);
+  buf = kbuf_alloc(size);
   if (buf == NULL) {
-    perror("malloc");
+    perror("kbuf_alloc");
     return 1;
   }
 
@@ -110,6 +118,7 @@ int main(int argc, char *argv[]) {
 
   printf("message size: %i octets\n", size);
   printf("roundtrip count: %li\n", count);
+  kbuf_describe(size);
 
   if (!fork()) { /* child */
     CPU_SET(childCPU, &set);
@@ -118,6 +127,9 @@ int main(int argc, char *argv[]) {
      errExit("sched_setaffinity of child failed");
     }
 
+    ksched_apply_side(KSCHED_CHILD);
+    kbuf_side(buf, size);
+
     if ((sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) ==
         -1) {
       perror("socket");
@@ -173,6 +185,9 @@ int main(int argc, char *argv[]) {
      errExit("sched_setaffinity of parent failed");
     }
 
+    ksched_apply_side(KSCHED_PARENT);
+    kbuf_side(buf, size);
+
     if ((sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) ==
         -1) {
       perror("socket");
@@ -35,8 +35,12 @@
 #include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
+#include "KUtils.h"
+#include "KSched.h"
+#include "KBuf.h"
 
 int main(int argc, char *argv[]) {
+  int ap;
   int size;
   char *buf;
   int64_t count, i;
@@ -52,29 +56,34 @@ int main(int argc, char *argv[]) {
   struct addrinfo *res;
   int sockfd, new_fd;
 
-  if (argc != 5) {
-    printf("usage: tcp_local_lat <bind-to> <port> <message-size> "
-           "<roundtrip-count>\n");
+  ap = kopts_parse(argc, argv, KOPT_SCHED | KOPT_BUF);
+  if (ap < 0 || argc - ap != 4) {
+    printf("usage: tcp_local_lat [options] <bind-to> <port> <message-size> <roundtrip-count>\n");
+    kopts_usage(KOPT_SCHED | KOPT_BUF);
     return 1;
   }
 
-  size = atoi(argv[3]);
-  count = atol(argv[4]);
+  if (ksched_check() == -1 || kbuf_mode_get() == -1)
+    return 1;
+
+  size = atoi(argv[ap + 2]);
+  count = atol(argv[ap + 3]);
 
-  buf = malloc(size);
+  buf = kbuf_alloc(size);
   if (buf == NULL) {
-    perror("malloc");
+    perror("kbuf_alloc");
     return 1;
   }
 
   printf("message size: %i octets\n", size);
   printf("roundtrip count: %li\n", count);
+  kbuf_describe(size);
 
   memset(&hints, 0, sizeof hints);
   hints.ai_family = AF_UNSPEC; // use IPv4 or IPv6, whichever
   hints.ai_socktype = SOCK_STREAM;
   hints.ai_flags = AI_PASSIVE; // fill in my IP for me
-  if ((ret = getaddrinfo(argv[1], argv[2], &hints, &res)) != 0) {
+  if ((ret = getaddrinfo(argv[ap], argv[ap + 1], &hints, &res)) != 0) {
     fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(ret));
     return 1;
   }
@@ -108,6 +117,8 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  ksched_apply_side(KSCHED_CHILD);
+
   for (i = 0; i < count; i++) {
 
     for (sofar = 0; sofar < size;) {
@@ -35,6 +35,8 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include "KUtils.h"
+#include "KSched.h"
+#include "KBuf.h"
 #include <time.h>
 #include <unistd.h>
 
@@ -51,7 +53,8 @@ typedef int bool;
 #define true  1
 
 int main(int argc, char *argv[]) {
-  int size;
+  int ap;
+  int size, resp, bsize;
   char *buf;
   int64_t count, i, delta;
 #ifdef HAS_CLOCK_GETTIME_MONOTONIC
@@ -76,25 +79,34 @@ int main(int argc, char *argv[]) {
   struct addrinfo *res;
   int sockfds, sockfdc, new_fd;
 
-  if (argc != 5) {
-    printf("usage: tcp_self_lat <message-size> <roundtrip-count> <parent cpu> <Enable(1)/Disable(0) angel signals>\n");
+  ap = kopts_parse(argc, argv, KOPT_SCHED | KOPT_BUF | KOPT_RESPONSE);
+  if (ap < 0 || argc - ap != 4) {
+    printf("usage: tcp_self_lat [options] <message-size> <roundtrip-count> <parent cpu> <Enable(1)/Disable(0) angel signals>\n");
+    kopts_usage(KOPT_SCHED | KOPT_BUF | KOPT_RESPONSE);
     return 1;
   }
 
-  size = atoi(argv[1]);
-  count = atol(argv[2]);
-  parentCPU = atoi(argv[3]);
-  isEnableAngelSignals = atoi(argv[4]);
+  if (ksched_check() == -1 || kbuf_mode_get() == -1)
+    return 1;
+
+  size = atoi(argv[ap]);
+  count = atol(argv[ap + 1]);
+  parentCPU = atoi(argv[ap + 2]);
+  isEnableAngelSignals = atoi(argv[ap + 3]);
   CPU_ZERO(&set);
 
+  if ((resp = kopts_response(size)) == -1)
+    return 1;
+  bsize = resp > size ? resp : size;
+
 #ifdef PERF_INSTRUMENT
    perf_event_init( (enable_perf_events) ENABLE_HW_CYCLES_PER );
    perf_event_enable ( (enable_perf_events) ENABLE_HW_CYCLES_PER );
 #endif //PERF_INSTRUMENT_PER
 
-  buf = malloc(size);
+  buf = kbuf_alloc(bsize);
   if (buf == NULL) {
-    perror("malloc");
+    perror("kbuf_alloc");
     return 1;
   }
 
@@ -108,7 +120,10 @@ int main(int argc, char *argv[]) {
   }
 
   printf("message size: %i octets\n", size);
+  if (resp != size)
+    printf("response size: %i octets\n", resp);
   printf("roundtrip count: %li\n", count);
+  kbuf_describe(bsize);
 
   CPU_SET(parentCPU, &set);
 
@@ -116,6 +131,8 @@ int main(int argc, char *argv[]) {
    errExit("sched_setaffinity of parent failed");
   }
 
+  ksched_apply_side(KSCHED_PARENT);
+
   /* server kinda (one end of socket) */
   if ((sockfds = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) ==
       -1) {
@@ -195,13 +212,13 @@ int main(int argc, char *argv[]) {
       sofar += len;
     }
 
-    if (write(sockfdc, buf, size) != size) {
+    if (write(sockfdc, buf, resp) != resp) {
       perror("write");
       return 1;
     }
 
-    for (sofar = 0; sofar < size;) {
-      len = read(new_fd, buf, size - sofar);
+    for (sofar = 0; sofar < resp;) {
+      len = read(new_fd, buf, resp - sofar);
       if (len == -1) {
         perror("read");
         return 1;
@@ -26,15 +26,23 @@
     OTHER DEALINGS IN THE SOFTWARE.
 */
 
+#define _GNU_SOURCE
 #include <netdb.h>
 #include <netinet/tcp.h>
+#include <sched.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
+#include "KUtils.h"
+#include "KBuf.h"
+#include "KCounters.h"
+#include "KThreads.h"
+#include "KNuma.h"
 
 #if defined(_POSIX_TIMERS) && (_POSIX_TIMERS > 0) &&                           \
     defined(_POSIX_MONOTONIC_CLOCK)
@@ -50,6 +58,10 @@ int main(int argc, char *argv[]) {
 #else
   struct timeval start, stop;
 #endif
+  cpu_set_t set;
+  int parentCPU = -1, childCPU = -1;
+  struct kcounters counters, *kc = NULL;
+  int ap;
 
   ssize_t len;
   size_t sofar;
@@ -62,17 +74,26 @@ int main(int argc, char *argv[]) {
   struct addrinfo *res;
   int sockfd, new_fd;
 
-  if (argc != 3) {
-    printf("usage: tcp_thr <message-size> <message-count>\n");
+  ap = kopts_parse(argc, argv, KOPT_NUMA | KOPT_BUF | KOPT_COUNTERS | KOPT_THREADS);
+  if (ap < 0 || (argc - ap != 2 && argc - ap != 4)) {
+    printf("usage: tcp_thr [options] <message-size> <message-count> [<parent cpu> <child cpu>]\n");
+    kopts_usage(KOPT_NUMA | KOPT_BUF | KOPT_COUNTERS | KOPT_THREADS);
     return 1;
   }
 
-  size = atoi(argv[1]);
-  count = atol(argv[2]);
+  if (knuma_check() == -1 || kbuf_mode_get() == -1)
+    return 1;
+
+  size = atoi(argv[ap]);
+  count = atol(argv[ap + 1]);
+  if (argc - ap == 4) {
+    parentCPU = atoi(argv[ap + 2]);
+    childCPU = atoi(argv[ap + 3]);
+  }
 
-  buf = malloc(size);
+  buf = kbuf_alloc(size);
   if (buf == NULL) {
-    perror("malloc");
+    perror("kbuf_alloc");
     return 1;
   }
 
@@ -87,10 +108,31 @@ int main(int argc, char *argv[]) {
 
   printf("message size: %i octets\n", size);
   printf("message count: %li\n", count);
+  kbuf_describe(size);
+
+  if (kopts.threads)
+    return kthreads_run(KTHREADS_TCP, KTHREADS_THR, size, count, parentCPU,
+                        childCPU);
+
+  if (kopts.counters) {
+    kcounters_open(&counters);
+    kc = &counters;
+  }
 
   if (!fork()) {
     /* child */
 
+    if (childCPU >= 0) {
+      CPU_ZERO(&set);
+      CPU_SET(childCPU, &set);
+      if (sched_setaffinity(getpid(), sizeof(set), &set) == -1) {
+        perror("sched_setaffinity of child failed");
+        return 1;
+      }
+    }
+    kbuf_side(buf, size);
+    buf = knuma_buffer(buf, size, KNUMA_CHILD, childCPU);
+
     if ((sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) ==
         -1) {
       perror("socket");
@@ -131,6 +173,17 @@ int main(int argc, char *argv[]) {
   } else {
     /* parent */
 
+    if (parentCPU >= 0) {
+      CPU_ZERO(&set);
+      CPU_SET(parentCPU, &set);
+      if (sched_setaffinity(getpid(), sizeof(set), &set) == -1) {
+        perror("sched_setaffinity of parent failed");
+        return 1;
+      }
+    }
+    kbuf_side(buf, size);
+    buf = knuma_buffer(buf, size, KNUMA_PARENT, parentCPU);
+
     sleep(1);
 
     if ((sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) ==
@@ -161,6 +214,8 @@ int main(int argc, char *argv[]) {
     }
 #endif
 
+    kcounters_enable(kc);
+
     for (i = 0; i < count; i++) {
       if (write(sockfd, buf, size) != size) {
         perror("write");
@@ -168,6 +223,8 @@ int main(int argc, char *argv[]) {
       }
     }
 
+    kcounters_disable(kc);
+
 #ifdef HAS_CLOCK_GETTIME_MONOTONIC
     if (clock_gettime(CLOCK_MONOTONIC, &stop) == -1) {
       perror("clock_gettime");
@@ -191,6 +248,11 @@ int main(int argc, char *argv[]) {
     printf("average throughput: %li msg/s\n", (count * 1000000) / delta);
     printf("average throughput: %li Mb/s\n",
            (((count * 1000000) / delta) * size * 8) / 1000000);
+
+    if (kc != NULL) {
+      wait(NULL);
+      kcounters_report(kc, count, "per message");
+    }
   }
 
   return 0;
@@ -0,0 +1,119 @@
+/*
+    Run the ping-pong latency benchmarks over representative CPU pairs
+
+    Reads the CPU topology from /sys/devices/system/cpu and, starting from a
+    base CPU, picks one partner CPU per relationship (same cpu, SMT sibling,
+    same LLC, cross LLC, cross socket). pipe_lat, unix_lat and tcp_lat are
+    run for every pair found and their average latency is tabulated by
+    relationship.
+
+    The benchmark binaries are looked up next to this one with the same
+    suffix, so binaries/topo_sweep.aarch64.elf runs
+    binaries/pipe_lat.aarch64.elf and so on (see KSweep.h).
+*/
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "KTopo.h"
+#include "KSweep.h"
+
+#define NTRANSPORTS 3
+
+static const char *transports[NTRANSPORTS] = { "pipe_lat", "unix_lat", "tcp_lat" };
+
+/*
+ * Runs one benchmark with the given placement and returns its average
+ * latency in ns, or -1.
+ */
+static long run_bench(const char *path, const char *size, const char *count,
+                      int parentCPU, int childCPU)
+{
+  char pcpu[16], ccpu[16];
+  char *argv[] = { (char *)path, (char *)size, (char *)count, pcpu, ccpu,
+                   "0", NULL };
+
+  snprintf(pcpu, sizeof(pcpu), "%d", parentCPU);
+  snprintf(ccpu, sizeof(ccpu), "%d", childCPU);
+  return ksweep_run(argv);
+}
+
+int main(int argc, char *argv[]) {
+  char path[512];
+  struct ksweep ks;
+  struct ktopo topo;
+  cpu_set_t set;
+  int base = -1, cpu[KTOPO_NREL];
+  long avg[KTOPO_NREL][NTRANSPORTS];
+  int r, t;
+
+  if (argc != 3 && argc != 4) {
+    printf("usage: topo_sweep <message-size> <roundtrip-count> [base cpu]\n");
+    return 1;
+  }
+
+  ksweep_init(&ks, argv[0], "topo_sweep");
+
+  if (ktopo_discover(&topo) == -1 || topo.n == 0)
+    return 1;
+
+  if (argc == 4) {
+    base = atoi(argv[3]);
+  } else if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (r = 0; r < topo.n && base < 0; r++)
+      if (CPU_ISSET(topo.cpus[r].cpu, &set))
+        base = topo.cpus[r].cpu;
+  }
+  if (ktopo_find(&topo, base) == NULL) {
+    fprintf(stderr, "base cpu %d is not online\n", base);
+    return 1;
+  }
+
+  printf("cpu topology (core/cluster/llc are the first cpu of the group):\n");
+  ktopo_print(&topo);
+  printf("base cpu: %d\n", base);
+
+  for (r = 0; r < KTOPO_NREL; r++) {
+    cpu[r] = ktopo_pick(&topo, base, r);
+    for (t = 0; t < NTRANSPORTS; t++) {
+      avg[r][t] = -1;
+      if (cpu[r] < 0)
+        continue;
+      ksweep_path(&ks, transports[t], path, sizeof(path));
+      printf("%s: %s %d <-> %d\n", ktopo_rel_name(r), transports[t], base,
+             cpu[r]);
+      avg[r][t] = run_bench(path, argv[1], argv[2], base, cpu[r]);
+    }
+  }
+
+  printf("\naverage latency (ns), message size %s, %s roundtrips:\n",
+         argv[1], argv[2]);
+  printf("%-14s %9s", "relationship", "cpus");
+  for (t = 0; t < NTRANSPORTS; t++)
+    printf(" %10s", transports[t]);
+  printf("\n");
+
+  for (r = 0; r < KTOPO_NREL; r++) {
+    if (cpu[r] < 0) {
+      printf("%-14s %9s", ktopo_rel_name(r), "-");
+      for (t = 0; t < NTRANSPORTS; t++)
+        printf(" %10s", "n/a");
+      printf("\n");
+      continue;
+    }
+    snprintf(path, sizeof(path), "%d,%d", base, cpu[r]);
+    printf("%-14s %9s", ktopo_rel_name(r), path);
+    for (t = 0; t < NTRANSPORTS; t++) {
+      if (avg[r][t] < 0)
+        printf(" %10s", "failed");
+      else
+        printf(" %10li", avg[r][t]);
+    }
+    printf("\n");
+  }
+
+  return 0;
+}
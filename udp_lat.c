@@ -34,9 +34,19 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 #include <netdb.h>
 #include <time.h>
 #include <unistd.h>
+#include "KUtils.h"
+#include "KSched.h"
+#include "KBuf.h"
+#include "KCounters.h"
+#include "KThreads.h"
+#include "KAntag.h"
+#include "KTrace.h"
+#include "KPower.h"
+#include "KTstamp.h"
 
 #if defined(_POSIX_TIMERS) && (_POSIX_TIMERS > 0) &&                           \
     defined(_POSIX_MONOTONIC_CLOCK)
@@ -48,7 +58,7 @@
 
 
 int main(int argc, char *argv[]) {
-  int size;
+  int size, resp, bsize;
   char *buf;
   int64_t count, i, delta;
 #ifdef HAS_CLOCK_GETTIME_MONOTONIC
@@ -58,6 +68,15 @@ int main(int argc, char *argv[]) {
 #endif
   cpu_set_t set;
   int parentCPU, childCPU;
+  struct ktstamp tstamp, *ts = NULL;
+  struct kpower power;
+  int power_cpus[2];
+  struct kcounters counters, *kc = NULL;
+  struct kantag ka;
+  struct ktrace ktr;
+  int64_t t_ant;
+  int pass;
+  int ap;
 
   ssize_t len;
   size_t sofar;
@@ -69,23 +88,39 @@ int main(int argc, char *argv[]) {
   struct addrinfo *resParent;
   int sockfd;
 
-  if (argc != 5) {
-    printf("usage: udp_lat <message-size> <roundtrip-count> <parent cpu> <child cpu>\n");
+  ap = kopts_parse(argc, argv, KOPT_TSTAMP | KOPT_SCHED | KOPT_POWER | KOPT_BUF | KOPT_COUNTERS | KOPT_ANTAG | KOPT_THREADS | KOPT_RESPONSE | KOPT_TRACE);
+  if (ap < 0 || argc - ap != 4) {
+    printf("usage: udp_lat [options] <message-size> <roundtrip-count> <parent cpu> <child cpu>\n");
+    kopts_usage(KOPT_TSTAMP | KOPT_SCHED | KOPT_POWER | KOPT_BUF | KOPT_COUNTERS | KOPT_ANTAG | KOPT_THREADS | KOPT_RESPONSE | KOPT_TRACE);
     return 1;
   }
 
-  size = atoi(argv[1]);
-  count = atol(argv[2]);
-  parentCPU = atoi(argv[3]);
-  childCPU = atoi(argv[4]);
+  if (ksched_check() == -1 || kbuf_mode_get() == -1)
+    return 1;
+
+  size = atoi(argv[ap]);
+  count = atol(argv[ap + 1]);
+  parentCPU = atoi(argv[ap + 2]);
+  childCPU = atoi(argv[ap + 3]);
   CPU_ZERO(&set);
 
-  buf = malloc(size);
+  if ((resp = kopts_response(size)) == -1 || kantag_parse(&ka, count) == -1 ||
+      ktrace_parse(&ktr, size, count, 1) == -1)
+    return 1;
+  bsize = resp > size ? resp : size;
+
+  buf = kbuf_alloc(bsize);
   if (buf == NULL) {
-    perror("malloc");
+    perror("kbuf_alloc");
     return 1;
   }
 
+  if (kopts.tstamp) {
+    if (ktstamp_init(&tstamp, count) == -1)
+      return 1;
+    ts = &tstamp;
+  }
+
   memset(&hints, 0, sizeof hints);
   hints.ai_family = AF_UNSPEC; // use IPv4 or IPv6, whichever
   hints.ai_socktype = SOCK_DGRAM;
@@ -100,7 +135,19 @@ int main(int argc, char *argv[]) {
   }
 
   printf("message size: %i octets\n", size);
+  if (resp != size)
+    printf("response size: %i octets\n", resp);
   printf("roundtrip count: %li\n", count);
+  kbuf_describe(bsize);
+
+  if (kopts.threads)
+    return kthreads_run(KTHREADS_UDP, KTHREADS_LAT, size, count, parentCPU,
+                        childCPU);
+
+  if (kopts.counters) {
+    kcounters_open(&counters);
+    kc = &counters;
+  }
 
   if (!fork()) { /* child */
     CPU_SET(childCPU, &set);
@@ -109,6 +156,9 @@ int main(int argc, char *argv[]) {
       errExit("sched_setaffinity of child failed");
     }
 
+    ksched_apply_side(KSCHED_CHILD);
+    kbuf_side(buf, bsize);
+
     if ((sockfd = socket(resChild->ai_family, resChild->ai_socktype, resChild->ai_protocol)) ==
         -1) {
       perror("socket");
@@ -125,22 +175,53 @@ int main(int argc, char *argv[]) {
       return 1;
     }
 
+    if (ktstamp_enable(ts, sockfd, 1) == -1)
+      return 1;
+
     for (i = 0; i < count; i++) {
 
       for (sofar = 0; sofar < size;) {
-        len = recvfrom(sockfd, buf, size - sofar, 0, resParent->ai_addr, &resParent->ai_addrlen);
+        len = ktstamp_recvfrom(ts, sockfd, buf, size - sofar, resParent->ai_addr, &resParent->ai_addrlen, 2 * i);
         if (len == -1) {
           perror("recvfrom");
           return 1;
         }
         sofar += len;
       }
+      ktstamp_recv_end(ts, 2 * i);
+
+      ktstamp_send_begin(ts, 2 * i + 1);
+      if (sendto(sockfd, buf, resp, 0, resParent->ai_addr, resParent->ai_addrlen) != resp) {
+        perror("sendto");
+        return 1;
+      }
+      ktstamp_drain_tx(ts, sockfd, 0);
+    }
+    ktstamp_drain_tx(ts, sockfd, 1);
+
+    /* quiet and loaded pass of --antagonist */
+    for (i = 0; ka.n > 0 && i < 2 * count; i++) {
+
+      if (recvfrom(sockfd, buf, size, 0, resParent->ai_addr, &resParent->ai_addrlen) != size) {
+        perror("recvfrom");
+        return 1;
+      }
 
       if (sendto(sockfd, buf, size, 0, resParent->ai_addr, resParent->ai_addrlen) != size) {
         perror("sendto");
         return 1;
       }
     }
+
+    /* the trace pass reads and writes, so it talks to the parent only */
+    if (ktr.n > 0) {
+      if (connect(sockfd, resParent->ai_addr, resParent->ai_addrlen) == -1) {
+        perror("connect");
+        return 1;
+      }
+      if (ktrace_child(&ktr, sockfd, sockfd) == -1)
+        return 1;
+    }
   } else { /* parent */
     CPU_SET(parentCPU, &set);
 
@@ -148,6 +229,9 @@ int main(int argc, char *argv[]) {
      errExit("sched_setaffinity of parent failed");
     }
 
+    ksched_apply_side(KSCHED_PARENT);
+    kbuf_side(buf, bsize);
+
     sleep(1);
 
     if ((sockfd = socket(resParent->ai_family, resParent->ai_socktype, resParent->ai_protocol)) ==
@@ -166,6 +250,16 @@ int main(int argc, char *argv[]) {
       return 1;
     }
 
+    if (ktstamp_enable(ts, sockfd, 0) == -1)
+      return 1;
+
+    if (kopts.power) {
+      power_cpus[0] = parentCPU;
+      power_cpus[1] = childCPU;
+      if (kpower_begin(&power, power_cpus, 2) == -1)
+        return 1;
+    }
+
 #ifdef HAS_CLOCK_GETTIME_MONOTONIC
     if (clock_gettime(CLOCK_MONOTONIC, &start) == -1) {
       perror("clock_gettime");
@@ -178,23 +272,30 @@ int main(int argc, char *argv[]) {
     }
 #endif
 
+    kcounters_enable(kc);
+
     for (i = 0; i < count; i++) {
 
+      ktstamp_send_begin(ts, 2 * i);
       if (sendto(sockfd, buf, size, 0, resChild->ai_addr, resChild->ai_addrlen) != size) {
         perror("sendto");
         return 1;
       }
+      ktstamp_drain_tx(ts, sockfd, 0);
 
-      for (sofar = 0; sofar < size;) {
-        len = recvfrom(sockfd, buf, size - sofar, 0, resChild->ai_addr, &resChild->ai_addrlen);
+      for (sofar = 0; sofar < resp;) {
+        len = ktstamp_recvfrom(ts, sockfd, buf, resp - sofar, resChild->ai_addr, &resChild->ai_addrlen, 2 * i + 1);
         if (len == -1) {
           perror("read");
           return 1;
         }
         sofar += len;
       }
+      ktstamp_recv_end(ts, 2 * i + 1);
     }
 
+    kcounters_disable(kc);
+
 #ifdef HAS_CLOCK_GETTIME_MONOTONIC
     if (clock_gettime(CLOCK_MONOTONIC, &stop) == -1) {
       perror("clock_gettime");
@@ -216,6 +317,55 @@ int main(int argc, char *argv[]) {
 #endif
 
     printf("average latency: %li ns\n", delta / (count * 2));
+
+    if (kopts.power) {
+      kpower_end(&power);
+      kpower_report(&power);
+    }
+
+    if (ka.n > 0) {
+      for (pass = 0; pass < 2; pass++) {
+        if (pass == 1)
+          kantag_start(&ka);
+        for (i = 0; i < count; i++) {
+          t_ant = kutils_now_ns();
+
+          if (sendto(sockfd, buf, size, 0, resChild->ai_addr, resChild->ai_addrlen) != size) {
+            perror("sendto");
+            return 1;
+          }
+
+          if (recvfrom(sockfd, buf, size, 0, resChild->ai_addr, &resChild->ai_addrlen) != size) {
+            perror("recvfrom");
+            return 1;
+          }
+
+          klat_record(&ka.lat[pass], kutils_now_ns() - t_ant);
+        }
+      }
+      kantag_stop(&ka);
+      kantag_report(&ka, "round trip");
+    }
+
+    if (ktr.n > 0) {
+      if (connect(sockfd, resChild->ai_addr, resChild->ai_addrlen) == -1) {
+        perror("connect");
+        return 1;
+      }
+      if (ktrace_parent(&ktr, sockfd, sockfd) == -1)
+        return 1;
+    }
+
+    if (ts != NULL) {
+      ktstamp_drain_tx(ts, sockfd, 1);
+      wait(NULL);
+      ktstamp_report(ts, "udp");
+    }
+
+    if (kc != NULL) {
+      wait(NULL);
+      kcounters_report(kc, count, "per roundtrip");
+    }
   }
 
   return 0;
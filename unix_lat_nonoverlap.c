@@ -32,9 +32,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 #include "KUtils.h"
+#include "KSched.h"
+#include "KBuf.h"
+#include "KCounters.h"
+#include "KPlace.h"
+#include "KStream.h"
 
 #if defined(_POSIX_TIMERS) && (_POSIX_TIMERS > 0) &&                           \
     defined(_POSIX_MONOTONIC_CLOCK)
@@ -48,12 +54,11 @@ typedef int bool;
 #define false 0
 #define true  1
 
-#define SCALE 2
-
 int main(int argc, char *argv[]) {
+  int ap;
   int sv[2]; /* the pair of socket descriptors */
-  int size;
-  char *buf, * buf2Half;
+  int size, resp, bsize;
+  char *buf, *base, *src, *dst;
   int64_t count, i, delta;
 #ifdef HAS_CLOCK_GETTIME_MONOTONIC
   struct timespec start, stop;
@@ -63,28 +68,45 @@ int main(int argc, char *argv[]) {
   cpu_set_t set;
   int parentCPU, childCPU;
   bool isEnableAngelSignals;
-
-  if (argc != 6) {
-    printf("usage: unix_lat_nonoverlap <message-size> <roundtrip-count> <parent cpu> <child cpu> <Enable(1)/Disable(0) angel signals>\n");
+  struct kplace place;
+  struct kcounters counters, *kc = NULL;
+  int c;
+
+  ap = kopts_parse(argc, argv, KOPT_SCHED | KOPT_BUF | KOPT_PLACE | KOPT_COUNTERS | KOPT_RESPONSE | KOPT_STREAM);
+  if (ap < 0 || argc - ap != 5) {
+    printf("usage: unix_lat_nonoverlap [options] <message-size> <roundtrip-count> <parent cpu> <child cpu> <Enable(1)/Disable(0) angel signals>\n");
+    kopts_usage(KOPT_SCHED | KOPT_BUF | KOPT_PLACE | KOPT_COUNTERS | KOPT_RESPONSE | KOPT_STREAM);
     return 1;
   }
 
-  size = atoi(argv[1]);
-  count = atol(argv[2]);
-  parentCPU = atoi(argv[3]);
-  childCPU = atoi(argv[4]);
-  isEnableAngelSignals = atoi(argv[5]);
+  if (ksched_check() == -1 || kbuf_mode_get() == -1 || kstream_check() == -1)
+    return 1;
+
+  size = atoi(argv[ap]);
+  count = atol(argv[ap + 1]);
+  parentCPU = atoi(argv[ap + 2]);
+  childCPU = atoi(argv[ap + 3]);
+  isEnableAngelSignals = atoi(argv[ap + 4]);
   CPU_ZERO(&set);
 
-  buf = malloc(size * SCALE);
+  if ((resp = kopts_response(size)) == -1)
+    return 1;
+  bsize = resp > size ? resp : size;
+
+  if (kplace_init(&place, kopts.place, bsize) == -1)
+    return 1;
+
+  buf = kbuf_alloc(place.buflen);
   if (buf == NULL) {
-    perror("malloc");
+    perror("kbuf_alloc");
     return 1;
   }
-  buf2Half = buf + size;
 
   printf("message size: %i octets\n", size);
+  if (resp != size)
+    printf("response size: %i octets\n", resp);
   printf("roundtrip count: %li\n", count);
+  kbuf_describe(place.buflen);
 
   if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
     perror("socketpair");
@@ -101,23 +123,40 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     printf("Buffer pointer client=%p\n", bufC);*/
-    memset((void *)buf, 0x00, size*SCALE);
+    memset((void *)buf, 0x00, place.buflen);
 
     if (sched_setaffinity(getpid(), sizeof(set), &set) == -1){
      errExit("sched_setaffinity of child failed");
     }
 
-    for (i = 0; i < count; i++) {
+    ksched_apply_side(KSCHED_CHILD);
+    kbuf_side(buf, place.buflen);
+    base = kplace_base(&place, buf);
 
-      if (read(sv[1], buf, size) != size) {
-        perror("read");
-        return 1;
-      }
+    if (kopts.counters) {
+      kcounters_open_self(&counters);
+      kc = &counters;
+    }
 
-      if (write(sv[1], buf, size) != size) {
-        perror("write");
-        return 1;
+    for (c = 0; c < place.n; c++) {
+      src = base + place.cases[c].src[KPLACE_CHILD];
+      dst = base + place.cases[c].dst[KPLACE_CHILD];
+      kplace_begin(&place, kc);
+
+      for (i = 0; i < count; i++) {
+
+        if (kstream_read(sv[1], dst, size) != size) {
+          perror("read");
+          return 1;
+        }
+
+        if (kstream_write(sv[1], src, resp) != resp) {
+          perror("write");
+          return 1;
+        }
       }
+
+      kplace_end(&place, c, KPLACE_CHILD, kc);
     }
 
   } else { /* parent */
@@ -131,12 +170,21 @@ int main(int argc, char *argv[]) {
     }
     bufP2Half = bufP + size;
     //printf("Buffer pointer server=%p and 2Half=%p\n", bufP, bufP2Half);*/
-    memset((void *)buf, 0x00, size*SCALE);
+    memset((void *)buf, 0x00, place.buflen);
 
     if (sched_setaffinity(getpid(), sizeof(set), &set) == -1){
      errExit("sched_setaffinity of parent failed");
     }
 
+    ksched_apply_side(KSCHED_PARENT);
+    kbuf_side(buf, place.buflen);
+    base = kplace_base(&place, buf);
+
+    if (kopts.counters) {
+      kcounters_open_self(&counters);
+      kc = &counters;
+    }
+
 #ifdef ANGEL
     if( isEnableAngelSignals )
     {
@@ -156,18 +204,25 @@ int main(int argc, char *argv[]) {
     }
 #endif
 
-    for (i = 0; i < count; i++) {
+    for (c = 0; c < place.n; c++) {
+      src = base + place.cases[c].src[KPLACE_PARENT];
+      dst = base + place.cases[c].dst[KPLACE_PARENT];
+      kplace_begin(&place, kc);
 
-      if (write(sv[0], buf2Half, size) != size) {
-        perror("write");
-        return 1;
-      }
+      for (i = 0; i < count; i++) {
 
-      if (read(sv[0], buf2Half, size) != size) {
-        perror("read");
-        return 1;
+        if (kstream_write(sv[0], src, size) != size) {
+          perror("write");
+          return 1;
+        }
+
+        if (kstream_read(sv[0], dst, resp) != resp) {
+          perror("read");
+          return 1;
+        }
       }
 
+      kplace_end(&place, c, KPLACE_PARENT, kc);
     }
 
 #ifdef HAS_CLOCK_GETTIME_MONOTONIC
@@ -190,7 +245,12 @@ int main(int argc, char *argv[]) {
 
 #endif
 
-    printf("average latency: %li ns\n", delta / (count * 2));
+    printf("average latency: %li ns\n", delta / (count * 2 * place.n));
+    kstream_report(delta, count * place.n, size, resp);
+    if (kopts.place != NULL || kopts.counters) {
+      wait(NULL);
+      kplace_report(&place, count);
+    }
 
 #ifdef ANGEL
     if( isEnableAngelSignals )
@@ -35,6 +35,8 @@
 #include <time.h>
 #include <unistd.h>
 #include "KUtils.h"
+#include "KSched.h"
+#include "KBuf.h"
 
 #if defined(_POSIX_TIMERS) && (_POSIX_TIMERS > 0) &&                           \
     defined(_POSIX_MONOTONIC_CLOCK)
@@ -49,8 +51,9 @@ typedef int bool;
 #define true  1
 
 int main(int argc, char *argv[]) {
+  int ap;
   int sv[2]; /* the pair of socket descriptors */
-  int size;
+  int size, resp, bsize;
   char *buf;
   int64_t count, i, delta;
 #ifdef HAS_CLOCK_GETTIME_MONOTONIC
@@ -62,25 +65,37 @@ int main(int argc, char *argv[]) {
   int parentCPU;
   bool isEnableAngelSignals;
 
-  if (argc != 5) {
-    printf("usage: unix_self_lat <message-size> <roundtrip-count> <parent cpu> <Enable(1)/Disable(0) angel signals>\n");
+  ap = kopts_parse(argc, argv, KOPT_SCHED | KOPT_BUF | KOPT_RESPONSE);
+  if (ap < 0 || argc - ap != 4) {
+    printf("usage: unix_self_lat [options] <message-size> <roundtrip-count> <parent cpu> <Enable(1)/Disable(0) angel signals>\n");
+    kopts_usage(KOPT_SCHED | KOPT_BUF | KOPT_RESPONSE);
     return 1;
   }
 
-  size = atoi(argv[1]);
-  count = atol(argv[2]);
-  parentCPU = atoi(argv[3]);
-  isEnableAngelSignals = atoi(argv[4]);
+  if (ksched_check() == -1 || kbuf_mode_get() == -1)
+    return 1;
+
+  size = atoi(argv[ap]);
+  count = atol(argv[ap + 1]);
+  parentCPU = atoi(argv[ap + 2]);
+  isEnableAngelSignals = atoi(argv[ap + 3]);
   CPU_ZERO(&set);
 
-  buf = malloc(size);
+  if ((resp = kopts_response(size)) == -1)
+    return 1;
+  bsize = resp > size ? resp : size;
+
+  buf = kbuf_alloc(bsize);
   if (buf == NULL) {
-    perror("malloc");
+    perror("kbuf_alloc");
     return 1;
   }
 
   printf("message size: %i octets\n", size);
+  if (resp != size)
+    printf("response size: %i octets\n", resp);
   printf("roundtrip count: %li\n", count);
+  kbuf_describe(bsize);
 
   if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
     perror("socketpair");
@@ -94,6 +109,8 @@ int main(int argc, char *argv[]) {
    errExit("sched_setaffinity of parent failed");
   }
 
+  ksched_apply_side(KSCHED_PARENT);
+
 #ifdef ANGEL
   if( isEnableAngelSignals )
   {
@@ -125,12 +142,12 @@ int main(int argc, char *argv[]) {
       return 1;
     }
 
-    if (write(sv[1], buf, size) != size) {
+    if (write(sv[1], buf, resp) != resp) {
       perror("write socket 1");
       return 1;
     }
 
-    if (read(sv[0], buf, size) != size) {
+    if (read(sv[0], buf, resp) != resp) {
       perror("read socket 0");
       return 1;
     }
@@ -35,6 +35,8 @@
 #include <time.h>
 #include <unistd.h>
 #include "KUtils.h"
+#include "KSched.h"
+#include "KBuf.h"
 
 #if defined(_POSIX_TIMERS) && (_POSIX_TIMERS > 0) &&                           \
     defined(_POSIX_MONOTONIC_CLOCK)
@@ -49,6 +51,7 @@ typedef int bool;
 #define true  1
 
 int main(int argc, char *argv[]) {
+  int ap;
   int sv[2]; /* the pair of socket descriptors */
   int size;
   char *buf;
@@ -62,25 +65,31 @@ int main(int argc, char *argv[]) {
   int parentCPU;
   bool isEnableAngelSignals;
 
-  if (argc != 5) {
-    printf("usage: unix_self_lat <message-size> <roundtrip-count> <parent cpu> <Enable(1)/Disable(0) angel signals>\n");
+  ap = kopts_parse(argc, argv, KOPT_SCHED | KOPT_BUF);
+  if (ap < 0 || argc - ap != 4) {
+    printf("usage: unix_self_lat [options] <message-size> <roundtrip-count> <parent cpu> <Enable(1)/Disable(0) angel signals>\n");
+    kopts_usage(KOPT_SCHED | KOPT_BUF);
     return 1;
   }
 
-  size = atoi(argv[1]);
-  count = atol(argv[2]);
-  parentCPU = atoi(argv[3]);
-  isEnableAngelSignals = atoi(argv[4]);
+  if (ksched_check() == -1 || kbuf_mode_get() == -1)
+    return 1;
+
+  size = atoi(argv[ap]);
+  count = atol(argv[ap + 1]);
+  parentCPU = atoi(argv[ap + 2]);
+  isEnableAngelSignals = atoi(argv[ap + 3]);
   CPU_ZERO(&set);
 
-  buf = malloc(size);
+  buf = kbuf_alloc(size);
   if (buf == NULL) {
-    perror("malloc");
+    perror("kbuf_alloc");
     return 1;
   }
 
   printf("message size: %i octets\n", size);
   printf("roundtrip count: %li\n", count);
+  kbuf_describe(size);
 
   if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
     perror("socketpair");
@@ -94,6 +103,8 @@ int main(int argc, char *argv[]) {
    errExit("sched_setaffinity of parent failed");
   }
 
+  ksched_apply_side(KSCHED_PARENT);
+
 #ifdef ANGEL
   if( isEnableAngelSignals )
   {